@@ -8,11 +8,28 @@
 
 namespace qhy {
 
+/**
+ * \brief Source of buffer memory other than the heap
+ *
+ * An allocator may use different kinds of memory, it returns a cookie
+ * identifying the kind with the memory, which is handed back when the
+ * memory is released.
+ */
+class BufferAllocator {
+public:
+	virtual ~BufferAllocator() { }
+	virtual unsigned char	*allocate(unsigned long length, int& cookie) = 0;
+	virtual void	release(unsigned char *data, unsigned long length,
+				int cookie) = 0;
+};
+
 /**
  * \brief Buffer class to ensure proper memory management
  */
 class Buffer {
 	unsigned long	_length;
+	BufferAllocator	*_allocator;
+	int	_cookie;
 public:
 	/**
  	 * \brief Retrieve the length of the buffer
@@ -30,17 +47,30 @@ private:
 	Buffer&	operator=(const Buffer& other);
 public:
 	Buffer(unsigned long l);
+	Buffer(unsigned long l, BufferAllocator *allocator);
 	~Buffer();
+	/**
+	 * \brief The allocator the memory comes from, NULL for the heap
+	 */
+	BufferAllocator	*allocator() const { return _allocator; }
 	const unsigned char&	operator[](unsigned int i) const;
 	unsigned char&	operator[](unsigned int i);
 };
 
 /**
  * \brief BufferPointer points into a buffer and can be used to add data
+ *
+ * Data can either be appended by copying it into the buffer, or
+ * it can be received in place: reserve() hands out a pointer to a
+ * region of the buffer that some other party (e.g. the USB library)
+ * fills, and commit() then accounts for the data received there.
+ * Both ways ensure that nothing is ever written beyond the end of
+ * the buffer.
  */
 class BufferPointer {
 	Buffer&	_buffer;
 	unsigned long	_offset;
+	unsigned long	_reserved;
 public:
 	/**
 	 * \brief Current offset of the pointer into the buffer
@@ -51,6 +81,8 @@ public:
 	void	append(unsigned char *newdata, unsigned long datalength);
 	void	append(Buffer& buffer);
 	void	append(Buffer& buffer, unsigned long datalength);
+	unsigned char	*reserve(unsigned long datalength);
+	void	commit(unsigned char *data, unsigned long datalength);
 };
 
 } // namespace qhy
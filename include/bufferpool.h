@@ -0,0 +1,81 @@
+/*
+ * bufferpool.h -- recycling of raw data and image buffers
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_bufferpool_h
+#define qhy_bufferpool_h
+
+#include <qhylib.h>
+#include <buffer.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace qhy {
+
+class BufferPool;
+typedef std::shared_ptr<BufferPool>	BufferPoolPtr;
+
+class blockcache;
+
+/**
+ * \brief Pool of raw data and image buffers
+ *
+ * Image buffers are handed out as ImageBufferPtr with a deleter that
+ * returns the buffer to the pool. The deleter keeps the pool alive, so
+ * images may outlive the camera. The control blocks of the shared
+ * pointers are recycled as well, so a request served from the pool
+ * does not allocate any memory at all.
+ *
+ * At most capacity unused buffers of each kind are kept, the oldest
+ * unused buffer is freed when a buffer is returned to a full pool.
+ * Buffers of a size no longer requested, e.g. after a change of the
+ * binning mode, thus eventually disappear from the pool.
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+	mutable std::mutex	_mutex;
+	unsigned int	_capacity;
+	std::vector<Buffer *>	_raw;
+	std::vector<ImageBuffer *>	_images;
+	std::shared_ptr<blockcache>	_blocks;
+	BufferPoolStatistics	_statistics;
+	void	trim();
+private:
+	// prevent copying
+	BufferPool(const BufferPool& other);
+	BufferPool&	operator=(const BufferPool& other);
+public:
+	BufferPool(unsigned int capacity);
+	~BufferPool();
+	void	capacity(unsigned int capacity);
+	Buffer	*rawbuffer(unsigned long length, BufferAllocator *allocator);
+	void	release(Buffer *buffer);
+	void	flushraw();
+	ImageBufferPtr	imagebuffer(const ImageSize& size);
+	void	recycle(ImageBuffer *image);
+	BufferPoolStatistics	statistics() const;
+};
+
+/**
+ * \brief A raw data buffer borrowed from a pool for the lifetime
+ *        of this object
+ */
+class PooledBuffer {
+	BufferPoolPtr	_pool;
+	Buffer	*_buffer;
+private:
+	// prevent copying
+	PooledBuffer(const PooledBuffer& other);
+	PooledBuffer&	operator=(const PooledBuffer& other);
+public:
+	PooledBuffer(BufferPoolPtr pool, unsigned long length,
+		BufferAllocator *allocator = NULL)
+		: _pool(pool), _buffer(pool->rawbuffer(length, allocator)) { }
+	~PooledBuffer() { _pool->release(_buffer); }
+	Buffer&	operator*() const { return *_buffer; }
+};
+
+} // namespace qhy
+
+#endif /* qhy_bufferpool_h */
@@ -0,0 +1,98 @@
+/*
+ * demux.h -- vectorized demultiplexing and conversion kernels, not installed
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_demux_h
+#define qhy_demux_h
+
+namespace qhy {
+
+/*
+ * Instruction set levels of the kernels. The best level the processor
+ * supports is used, unless a lower limit is set with demux_level().
+ */
+#define DEMUX_SCALAR	0
+#define DEMUX_SSE2	1
+#define DEMUX_SSSE3	2
+#define DEMUX_AVX2	3
+
+int	demux_level();
+void	demux_level(int limit);
+
+/**
+ * \brief Kernel converting one raw line of an unbinned QHY8PRO image
+ *
+ * The raw line of 4 * width bytes yields two image rows of width pixels
+ * each, starting at rows.
+ */
+typedef void	(*demux11_kernel)(unsigned short *rows,
+			const unsigned char *raw, unsigned int width);
+
+demux11_kernel	demux11_select();
+
+/**
+ * \brief Kernel converting one raw line of a binned QHY8PRO image
+ *
+ * The raw line consists of 4 * width bytes in 2x2 mode and 8 * width
+ * bytes in 4x4 mode, it yields one image row of width pixels.
+ */
+typedef void	(*demuxbinned_kernel)(unsigned short *row,
+			const unsigned char *raw, unsigned int width);
+
+demuxbinned_kernel	demux22_select();
+demuxbinned_kernel	demux44_select();
+
+/**
+ * \brief Kernel converting one raw line of a binned image to 32 bit pixels
+ *
+ * Same as demuxbinned_kernel, but the sums are not saturated.
+ */
+typedef void	(*demuxwide_kernel)(unsigned int *row,
+			const unsigned char *raw, unsigned int width);
+
+demuxwide_kernel	demux22wide_select();
+demuxwide_kernel	demux44wide_select();
+
+/**
+ * \brief Kernels converting n pixels to floating point
+ */
+typedef void	(*tofloat16_kernel)(float *to, const unsigned short *from,
+			unsigned long n);
+typedef void	(*tofloat32_kernel)(float *to, const unsigned int *from,
+			unsigned long n);
+
+tofloat16_kernel	tofloat16_select();
+tofloat32_kernel	tofloat32_select();
+
+/**
+ * \brief Kernel adding n unsigned short pixels to 32 bit sums
+ */
+typedef void	(*accumulate16_kernel)(unsigned int *sums,
+			const unsigned short *from, unsigned long n);
+
+accumulate16_kernel	accumulate16_select();
+
+/**
+ * \brief Kernels computing (from - offset) * gain for n pixels
+ *
+ * The 16 bit kernel rounds to the nearest integer, ties to even, and
+ * clamps the result to 0 ... 65535. The target may be the same as the
+ * source. The kernels are selected for the masters present, a kernel
+ * selected without offset or without gain ignores that argument, so
+ * it may be NULL. There are scalar kernels for DEMUX_SCALAR, so the
+ * selection never returns NULL.
+ */
+typedef void	(*calibrate16_kernel)(unsigned short *to,
+			const unsigned short *from, const float *offset,
+			const float *gain, unsigned long n);
+typedef void	(*calibratefloat_kernel)(float *to,
+			const unsigned short *from, const float *offset,
+			const float *gain, unsigned long n);
+
+calibrate16_kernel	calibrate16_select(bool offset, bool gain);
+calibratefloat_kernel	calibratefloat_select(bool offset, bool gain);
+
+} // namespace qhy
+
+#endif /* qhy_demux_h */
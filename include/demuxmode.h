@@ -0,0 +1,338 @@
+/*
+ * demuxmode.h -- demultiplexing specialized at compile time for a
+ *                camera model and binning mode, not installed
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_demuxmode_h
+#define qhy_demuxmode_h
+
+#include <qhylib.h>
+#include <reg.h>
+#include <buffer.h>
+#include <demux.h>
+#include <statistics.h>
+#include <stdexcept>
+#include <limits>
+#include <cstring>
+
+namespace qhy {
+
+/*
+ * Descriptors for the binning modes of a camera
+ *
+ * A descriptor is a class with the following constant static members,
+ * which completely describe the geometry of one binning mode:
+ *
+ *   binx, biny		binning mode as seen by the user
+ *   HBIN, VBIN		binning registers of the camera
+ *   LineSize		raw line length in words
+ *   VerticalSize	number of raw lines
+ *   TopSkipPix		words to skip at the start of the raw data
+ *   patch_size		size of a USB transfer
+ *   width, height	size of the demultiplexed image
+ *   rows		image rows contained in a raw line, 1 or 2
+ *   words		raw words added for one image pixel
+ *   activex, activey, activewidth, activeheight	the active area
+ *
+ * With two rows per raw line, the words of the two rows are interleaved
+ * like in the unbinned mode of the QHY8PRO. Adding a mode or a camera
+ * model with the same kind of raw data only requires a new descriptor,
+ * the demultiplexing code is instantiated from the templates below.
+ */
+
+/**
+ * \brief Set the registers and the patch size for a binning mode
+ */
+template<typename Mode>
+void	demuxmode_registers(ccdreg& reg, int& patch_size) {
+	reg.HBIN = Mode::HBIN;
+	reg.VBIN = Mode::VBIN;
+	reg.LineSize = Mode::LineSize;
+	reg.VerticalSize = Mode::VerticalSize;
+	reg.TopSkipPix = Mode::TopSkipPix;
+	patch_size = Mode::patch_size;
+}
+
+/**
+ * \brief Active area of the image of a binning mode
+ */
+template<typename Mode>
+ImageRectangle	demuxmode_activearea() {
+	return ImageRectangle(ImagePoint(Mode::activex, Mode::activey),
+		ImageSize(Mode::activewidth, Mode::activeheight));
+}
+
+/**
+ * \brief Value of saturated pixels of a binning mode
+ *
+ * The 16 bit sums are clamped at 65535. The 32 bit sums of Mode::words
+ * raw words only saturate when all of them do.
+ */
+template<typename Mode, typename Pixel>
+unsigned int	demuxmode_saturation() {
+	return (sizeof(Pixel) > 2) ? 65535 * Mode::words : 65535;
+}
+
+/**
+ * \brief Scalar conversion of a raw line into binned pixels
+ *
+ * Each pixel is the sum of words consecutive big endian words,
+ * saturated at the largest value of the pixel type, which only
+ * matters for 16 bit pixels.
+ */
+template<unsigned int rows, unsigned int words, unsigned int width>
+class demuxline {
+public:
+	static const unsigned int	linewidth = width;
+	template<typename Pixel>
+	static void	convert(Pixel *row, const unsigned char *raw) {
+		const unsigned long	maxpixel
+			= std::numeric_limits<Pixel>::max();
+		for (unsigned int j = 0; j < width; j++) {
+			unsigned long	binpixel = 0;
+			for (unsigned int i = 0; i < words; i++) {
+				const unsigned char	*r = raw + 2 * (words * j + i);
+				binpixel += (r[0] << 8) | r[1];
+			}
+			row[j] = (binpixel > maxpixel) ? maxpixel : binpixel;
+		}
+	}
+	static demuxbinned_kernel	select() {
+		switch (words) {
+		case 2:	return demux22_select();
+		case 4:	return demux44_select();
+		}
+		return NULL;
+	}
+	static demuxwide_kernel	widekernel() {
+		switch (words) {
+		case 2:	return demux22wide_select();
+		case 4:	return demux44wide_select();
+		}
+		return NULL;
+	}
+};
+
+/**
+ * \brief Scalar conversion of a raw line with two interleaved rows
+ *
+ * Produces the same pixels as the SDK code for the unbinned QHY8PRO in
+ * demux11reference(), including the last pixel of the first row, which
+ * is taken from the first word of the line, and the last pixel of the
+ * second row, which is never written.
+ */
+template<unsigned int width>
+class demuxline<2, 1, width> {
+public:
+	static const unsigned int	linewidth = width;
+	template<typename Pixel>
+	static void	convert(Pixel *rows, const unsigned char *raw) {
+		Pixel	*rowa = rows;
+		Pixel	*rowb = rows + width;
+		for (unsigned int g = 0; g < width / 2; g++) {
+			const unsigned char	*r = raw + 8 * g;
+			rowa[2 * g] = (r[4] << 8) | r[5];
+			rowa[2 * g + 1] = (r[6] << 8) | r[7];
+			if (g > 0) {
+				rowb[2 * g - 1] = (r[0] << 8) | r[1];
+			}
+			rowb[2 * g] = (r[2] << 8) | r[3];
+		}
+		rowa[width - 1] = (raw[0] << 8) | raw[1];
+	}
+	static demux11_kernel	select() {
+		return demux11_select();
+	}
+	static demuxwide_kernel	widekernel() {
+		return NULL;
+	}
+};
+
+/**
+ * \brief Conversion of raw lines into pixels of a given type
+ *
+ * The kernel for the processor is selected once, the scalar code of
+ * the line is used if there is none.
+ */
+template<typename line, typename Pixel>
+class demuxconverter;
+
+template<typename line>
+class demuxconverter<line, unsigned short> {
+	demuxbinned_kernel	_kernel;
+public:
+	demuxconverter() : _kernel(line::select()) { }
+	void	operator()(unsigned short *pixels,
+			const unsigned char *raw) const {
+		if (_kernel) {
+			_kernel(pixels, raw, line::linewidth);
+		} else {
+			line::convert(pixels, raw);
+		}
+	}
+};
+
+template<typename line>
+class demuxconverter<line, unsigned int> {
+	demuxwide_kernel	_kernel;
+public:
+	demuxconverter() : _kernel(line::widekernel()) { }
+	void	operator()(unsigned int *pixels,
+			const unsigned char *raw) const {
+		if (_kernel) {
+			_kernel(pixels, raw, line::linewidth);
+		} else {
+			line::convert(pixels, raw);
+		}
+	}
+};
+
+/**
+ * \brief Clamp a range of raw lines and check the raw buffer for it
+ *
+ * \return	false if there are no lines to convert
+ */
+template<typename Mode>
+bool	demuxmode_range(const Buffer& buffer, unsigned int firstline,
+		unsigned int& lastline) {
+	static_assert(Mode::rows * Mode::words * Mode::width
+		== Mode::LineSize, "raw line does not match image width");
+	static_assert(Mode::rows * Mode::VerticalSize == Mode::height,
+		"raw lines do not match image height");
+	if (lastline > Mode::VerticalSize) {
+		lastline = Mode::VerticalSize;
+	}
+	if (firstline >= lastline) {
+		return false;
+	}
+	if (2 * Mode::TopSkipPix + lastline * 2 * Mode::LineSize
+		> buffer.length()) {
+		throw std::range_error("raw buffer too small");
+	}
+	return true;
+}
+
+/**
+ * \brief Add the active pixels of the rows of a raw line to statistics
+ *
+ * \param rows	the rows demultiplexed from raw line n
+ */
+template<typename Mode, typename Pixel>
+void	demuxmode_statistics(PixelStatistics& statistics, const Pixel *rows,
+		unsigned int n) {
+	for (unsigned int r = 0; r < Mode::rows; r++) {
+		unsigned int	y = n * Mode::rows + r;
+		if ((y >= Mode::activey)
+			&& (y < Mode::activey + Mode::activeheight)) {
+			statistics.add(rows + r * Mode::width + Mode::activex,
+				Mode::activewidth);
+		}
+	}
+}
+
+/**
+ * \brief Demultiplex the raw lines firstline to lastline of a mode
+ *
+ * All offsets and loop bounds are constants of the descriptor. If the
+ * processor supports it, a vectorized kernel converts the lines. The
+ * statistics of the active pixels, if requested, are updated right
+ * after each line is converted.
+ */
+template<typename Mode, typename Pixel>
+void	demuxmode(Image<Pixel>& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		PixelStatistics *statistics) {
+	typedef demuxline<Mode::rows, Mode::words, Mode::width>	line;
+	if ((image.width() != Mode::width) || (image.height() != Mode::height)) {
+		throw std::range_error("image size does not match mode");
+	}
+	if (!demuxmode_range<Mode>(buffer, firstline, lastline)) {
+		return;
+	}
+	if (statistics) {
+		statistics->saturation(demuxmode_saturation<Mode, Pixel>());
+	}
+	const unsigned long	linebytes = 2 * Mode::LineSize;
+	Pixel	*pixels = image.pixelbuffer()
+				+ firstline * Mode::rows * Mode::width;
+	const unsigned char	*raw = buffer.data() + 2 * Mode::TopSkipPix
+					+ firstline * linebytes;
+	demuxconverter<line, Pixel>	convert;
+	for (unsigned int n = firstline; n < lastline; n++) {
+		convert(pixels, raw);
+		if (statistics) {
+			demuxmode_statistics<Mode>(*statistics, pixels, n);
+		}
+		pixels += Mode::rows * Mode::width;
+		raw += linebytes;
+	}
+}
+
+/**
+ * \brief Demultiplex raw lines directly into the active area
+ *
+ * Each raw line is converted into a scratch buffer small enough to stay
+ * in the cache, from which the active pixels are copied to their final
+ * place. The rows end up in reverse order, just like active_buffer()
+ * produces them from a full image. The statistics are taken from the
+ * scratch buffer.
+ */
+template<typename Mode, typename Pixel>
+void	demuxmode_cropped(Image<Pixel>& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		PixelStatistics *statistics) {
+	static_assert(Mode::activex + Mode::activewidth <= Mode::width,
+		"active area wider than image");
+	static_assert(Mode::activey + Mode::activeheight <= Mode::height,
+		"active area higher than image");
+	typedef demuxline<Mode::rows, Mode::words, Mode::width>	line;
+	if ((image.width() != Mode::activewidth)
+		|| (image.height() != Mode::activeheight)) {
+		throw std::range_error("image size does not match active area");
+	}
+	if (!demuxmode_range<Mode>(buffer, firstline, lastline)) {
+		return;
+	}
+	if (statistics) {
+		statistics->saturation(demuxmode_saturation<Mode, Pixel>());
+	}
+	// raw lines containing active rows
+	const unsigned int	activefirst = Mode::activey / Mode::rows;
+	const unsigned int	activelast = (Mode::activey + Mode::activeheight
+					+ Mode::rows - 1) / Mode::rows;
+	if (firstline < activefirst) {
+		firstline = activefirst;
+	}
+	if (lastline > activelast) {
+		lastline = activelast;
+	}
+	const unsigned long	linebytes = 2 * Mode::LineSize;
+	const unsigned char	*raw = buffer.data() + 2 * Mode::TopSkipPix
+					+ firstline * linebytes;
+	Pixel	scratch[Mode::rows * Mode::width];
+	demuxconverter<line, Pixel>	convert;
+	for (unsigned int n = firstline; n < lastline; n++) {
+		convert(scratch, raw);
+		for (unsigned int r = 0; r < Mode::rows; r++) {
+			unsigned int	y = n * Mode::rows + r;
+			if ((y < Mode::activey)
+				|| (y >= Mode::activey + Mode::activeheight)) {
+				continue;
+			}
+			Pixel	*row = image.pixelbuffer()
+				+ (Mode::activeheight - 1 - (y - Mode::activey))
+					* Mode::activewidth;
+			memcpy(row, scratch + r * Mode::width + Mode::activex,
+				Mode::activewidth * sizeof(Pixel));
+		}
+		if (statistics) {
+			demuxmode_statistics<Mode>(*statistics, scratch, n);
+		}
+		raw += linebytes;
+	}
+}
+
+} // namespace qhy
+
+#endif /* qhy_demuxmode_h */
@@ -0,0 +1,40 @@
+/*
+ * demuxreference.h -- demultiplexing code of the SDK, kept as the
+ *                     reference for the optimized code, not installed
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_demuxreference_h
+#define qhy_demuxreference_h
+
+#include <qhylib.h>
+#include <buffer.h>
+
+namespace qhy {
+
+/*
+ * Reference demultiplexing
+ *
+ * These are the loops of the SDK provided by QHYCCD, as they were used
+ * by the Qhy8Pro class before the vectorized kernels and the code
+ * instantiated from the mode descriptors replaced them. They are no
+ * longer used to read images, but the optimized code must produce
+ * exactly the same pixels, which the check programs verify.
+ *
+ * The geometry is passed explicitly: PixShift is reg.TopSkipPix, width
+ * and height are the size of the demultiplexed image, and firstline
+ * and lastline select the raw lines to convert.
+ */
+void	demux11reference(ImageBuffer& image, const Buffer& buffer,
+		int PixShift, int width, int height,
+		unsigned int firstline, unsigned int lastline);
+void	demux22reference(ImageBuffer& image, const Buffer& buffer,
+		int PixShift, int width, int height,
+		unsigned int firstline, unsigned int lastline);
+void	demux44reference(ImageBuffer& image, const Buffer& buffer,
+		int PixShift, int width, int height,
+		unsigned int firstline, unsigned int lastline);
+
+} // namespace qhy
+
+#endif /* qhy_demuxreference_h */
@@ -20,18 +20,22 @@
 #include <qhylib.h>
 #include <reg.h>
 #include <buffer.h>
-
-// libusb
-#include <libusb-1.0/libusb.h>
+#include <transport.h>
+#include <threadpool.h>
+#include <bufferpool.h>
+#include <framememory.h>
+#include <statistics.h>
 
 // standard C++ headers
 #include <memory>
 #include <set>
+#include <vector>
 
 
 namespace qhy {
 
 class PDevice; // forward declaration of the private device class
+class PatchListener; // forward declaration of the patch reader interface
 
 /**
  * \brief DC201 device abstraction
@@ -100,6 +104,8 @@ public:
  * The camera class implements communication with the CCD part of the
  * camera.
  */
+class PatchReader;
+
 class PCamera : public Camera {
 protected:
 	PDevice&	_device;
@@ -112,7 +118,12 @@ protected:
 	unsigned long	transfer_size;
 	virtual void	patch();
 
-	int	readpatches(Buffer& buffer);
+	int	readpatches(Buffer& buffer, PatchListener *listener = NULL);
+
+	// metrics of the frame currently being read
+	FrameMetrics	_frame;
+	std::vector<double>	_arrivals;
+	std::vector<double>	_intervals;
 
 protected:
 	// binnig modes available
@@ -125,10 +136,60 @@ public:
 	void	startExposure();
 	void	cancelExposure();
 	virtual ImageBufferPtr	getImage();
+	virtual ImageBufferPtr	getActiveImage();
+	virtual ImageBuffer32Ptr	getImage32();
+	virtual ImageBuffer32Ptr	getActiveImage32();
+	virtual std::string	activebayer() const;
+private:
+	template<typename Pixel>
+	std::shared_ptr<Image<Pixel> >	acquire(bool active);
+	template<typename Pixel>
+	std::shared_ptr<Image<Pixel> >	readimage(bool active);
+	void	newimage(ImageBufferPtr& image, const ImageSize& size);
+	void	newimage(ImageBuffer32Ptr& image, const ImageSize& size);
+	ThreadPoolPtr	_pool;
+	FrameAllocator	_allocator;
+	BufferPoolPtr	_buffers;
+	// partial statistics of the demux bands
+	std::vector<PixelStatistics>	_partials;
+	void	resetstatistics();
+	FrameStatisticsPtr	framestatistics();
+	PatchReader	*_reader;
+public:
+	virtual BufferPoolStatistics	poolstatistics() const;
+public:
 	void	downloadSpeed(enum DownloadSpeed speed);
 protected:
 	void	sendregisters();
-	virtual void	demux(ImageBuffer& image, const Buffer& buffer);
+	template<typename Pixel>
+	void	demux(Image<Pixel>& image, const Buffer& buffer);
+	template<typename Pixel>
+	void	demuxbands(Image<Pixel>& image, const Buffer& buffer,
+				unsigned int firstline, unsigned int lastline,
+				bool active = false);
+	template<typename Pixel>
+	void	demuxband(Image<Pixel>& image, const Buffer& buffer,
+				unsigned int firstline, unsigned int lastline,
+				bool active, unsigned int bands, unsigned int band);
+	virtual void	demuxlines(ImageBuffer& image, const Buffer& buffer,
+				unsigned int firstline, unsigned int lastline,
+				PixelStatistics *statistics);
+	virtual void	demuxlines(ImageBuffer32& image, const Buffer& buffer,
+				unsigned int firstline, unsigned int lastline,
+				PixelStatistics *statistics);
+	virtual bool	activedemux() const;
+	virtual void	demuxactivelines(ImageBuffer& image,
+				const Buffer& buffer, unsigned int firstline,
+				unsigned int lastline, PixelStatistics *statistics);
+	virtual void	demuxactivelines(ImageBuffer32& image,
+				const Buffer& buffer, unsigned int firstline,
+				unsigned int lastline, PixelStatistics *statistics);
+	virtual ImageRectangle	activearea() const;
+private:
+	template<typename Pixel>
+	class DemuxListener;
+	template<typename Pixel>
+	class DemuxBands;
 public:
 	PCamera(PDevice& device);
 	virtual ~PCamera();
@@ -140,12 +201,16 @@ public:
  * Device objects handle all the resources needed to talk to a qhy device.
  */
 class PDevice : public Device {
-	// libusb resources
-	libusb_context	*ctx;
-	libusb_device_handle	*handle;
+	// the transport used to talk to the device
+	Transport	*_transport;
+	void	setup();
 public:
 	PDevice(unsigned short idVendor, unsigned short idProduct);
+	PDevice(Transport *transport);
 	virtual ~PDevice();
+	static bool	supported(unsigned short idVendor,
+				unsigned short idProduct);
+	Transport&	transport() { return *_transport; }
 
 	// control transfers
 private:
@@ -161,7 +226,6 @@ public:
 			uint16_t wLength, unsigned int timeout);
 
 private:
-	unsigned char	dataep;
 	int	transfer(unsigned char ep, unsigned char *buffer, int length,
 				unsigned int timeout);
 public:
@@ -0,0 +1,60 @@
+/*
+ * devicemanager.h -- process wide management of libusb resources
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_devicemanager_h
+#define qhy_devicemanager_h
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <qhylib.h>
+
+// libusb
+#include <libusb-1.0/libusb.h>
+
+namespace qhy {
+
+class DeviceManager;
+typedef std::shared_ptr<DeviceManager>	DeviceManagerPtr;
+
+/**
+ * \brief Owner of the libusb context shared by all devices
+ *
+ * All devices of a process open their handles in the same libusb
+ * context, and all USB events of that context are handled by a single
+ * dedicated thread. Threads waiting for asynchronous transfers thus
+ * never have to handle events themselves, so several cameras can be
+ * read out concurrently without their threads competing for the
+ * event handling.
+ *
+ * The device manager exists as long as some device uses it, the
+ * context and the event thread are released when the last device
+ * is closed.
+ */
+class DeviceManager {
+	libusb_context	*_ctx;
+	std::thread	_thread;
+	std::atomic<int>	_stop;
+	static std::mutex	_mutex;
+	static std::weak_ptr<DeviceManager>	_manager;
+private:
+	DeviceManager();
+	// prevent copying
+	DeviceManager(const DeviceManager& other);
+	DeviceManager&	operator=(const DeviceManager& other);
+public:
+	~DeviceManager();
+	static DeviceManagerPtr	get();
+	libusb_context	*context() const { return _ctx; }
+	void	main();
+	std::vector<DeviceInfo>	list();
+	libusb_device_handle	*open(const DeviceInfo& info);
+};
+
+} // namespace qhy
+
+#endif /* qhy_devicemanager_h */
@@ -0,0 +1,37 @@
+/*
+ * framememory.h -- memory for the raw data of images, not installed
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_framememory_h
+#define qhy_framememory_h
+
+#include <qhylib.h>
+#include <buffer.h>
+#include <transport.h>
+
+namespace qhy {
+
+/**
+ * \brief Allocator for raw image data buffers
+ *
+ * Depending on the configured kind of memory, the allocator tries
+ * memory mapped from the USB driver, then memory on huge pages, and
+ * finally ordinary heap memory.
+ */
+class FrameAllocator : public BufferAllocator {
+	Transport&	_transport;
+	enum Camera::FrameMemory	_memory;
+	bool	_lock;
+	unsigned char	*hugepages(unsigned long length, int& cookie);
+public:
+	FrameAllocator(Transport& transport);
+	bool	configure(enum Camera::FrameMemory memory, bool lock);
+	virtual unsigned char	*allocate(unsigned long length, int& cookie);
+	virtual void	release(unsigned char *data, unsigned long length,
+				int cookie);
+};
+
+} // namespace qhy
+
+#endif /* qhy_framememory_h */
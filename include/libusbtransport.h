@@ -0,0 +1,49 @@
+/*
+ * libusbtransport.h -- USB transport based on libusb
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_libusbtransport_h
+#define qhy_libusbtransport_h
+
+#include <transport.h>
+#include <devicemanager.h>
+
+namespace qhy {
+
+/**
+ * \brief Transport talking to a real camera through libusb
+ *
+ * The device handle is opened in the context of the device manager,
+ * whose event thread completes all asynchronous transfers.
+ */
+class LibusbTransport : public Transport {
+	// libusb resources
+	DeviceManagerPtr	manager;
+	libusb_context	*ctx;
+	libusb_device_handle	*handle;
+	unsigned short	_idVendor;
+	unsigned short	_idProduct;
+	unsigned char	dataep;
+	void	setup();
+public:
+	LibusbTransport(unsigned short idVendor, unsigned short idProduct);
+	LibusbTransport(const DeviceInfo& info);
+	virtual ~LibusbTransport();
+	virtual unsigned short	idVendor() const { return _idVendor; }
+	virtual unsigned short	idProduct() const { return _idProduct; }
+	virtual unsigned char	dataendpoint() const { return dataep; }
+	virtual int	controltransfer(uint8_t bmRequestType, uint8_t bRequest,
+				uint16_t wValue, uint16_t wIndex,
+				unsigned char *data, uint16_t wLength,
+				unsigned int timeout);
+	virtual int	bulktransfer(unsigned char ep, unsigned char *data,
+				int length, unsigned int timeout);
+	virtual BulkRequest	*bulkrequest(unsigned char ep);
+	virtual unsigned char	*dmaalloc(unsigned long length);
+	virtual void	dmafree(unsigned char *data, unsigned long length);
+};
+
+} // namespace qhy
+
+#endif /* qhy_libusbtransport_h */
@@ -0,0 +1,23 @@
+/*
+ * metrics.h -- collection of frame metrics, not installed
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_metrics_h
+#define qhy_metrics_h
+
+#include <qhylib.h>
+#include <vector>
+
+namespace qhy {
+
+void	patchstatistics(FrameMetrics& frame,
+		const std::vector<double>& arrivals,
+		std::vector<double>& intervals);
+void	recordframe(const FrameMetrics& frame,
+		const std::vector<double>& arrivals);
+void	recordfailure();
+
+} // namespace qhy
+
+#endif /* qhy_metrics_h */
@@ -0,0 +1,81 @@
+/*
+ * patchreader.h -- asynchronous readout of image patches
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_patchreader_h
+#define qhy_patchreader_h
+
+#include <device.h>
+#include <buffer.h>
+#include <transport.h>
+#include <vector>
+
+namespace qhy {
+
+/**
+ * \brief Interface for consumers of partially read images
+ *
+ * A PatchListener is informed by the PatchReader whenever more complete
+ * lines of raw image data have become available in the target buffer.
+ */
+class PatchListener {
+public:
+	virtual ~PatchListener() { }
+	virtual void	available(unsigned int lines) = 0;
+};
+
+/**
+ * \brief Asynchronous patch reader
+ *
+ * QHY cameras deliver the image as a sequence of patches of constant
+ * size on the data endpoint. Reading them one at a time with synchronous
+ * bulk transfers leaves the host controller queue empty between two
+ * patches. The PatchReader instead keeps a configurable number of bulk
+ * transfers in flight and completes them in order into the target
+ * buffer, so that the USB link never runs idle during the download.
+ * Each transfer receives its patch directly at its final position in
+ * the target buffer, so no data is copied on the way.
+ */
+class PatchReader {
+	PDevice&	_device;
+	unsigned char	_endpoint;
+	int	_patch_size;
+	int	_total_patches;
+	unsigned int	_depth;
+	unsigned int	_requesteddepth;
+
+	// line geometry of the raw data
+	unsigned long	_skip;
+	unsigned long	_linesize;
+	unsigned int	_lines;
+	unsigned long	_bytes;
+
+	std::vector<BulkRequest *>	requests;
+	void	cancel();
+
+	// arrival time of each patch, and patches shorter than requested
+	std::vector<double>	_arrivals;
+	unsigned int	_shortpatches;
+private:
+	// prevent copying
+	PatchReader(const PatchReader& other);
+	PatchReader&	operator=(const PatchReader& other);
+public:
+	PatchReader(PDevice& device, int patch_size, int total_patches,
+		unsigned int depth);
+	~PatchReader();
+	bool	matches(int patch_size, int total_patches,
+			unsigned int depth) const;
+	void	geometry(unsigned long skip, unsigned long linesize,
+			unsigned int lines);
+	unsigned int	linesavailable() const;
+	unsigned long	read(Buffer& target, unsigned int timeout,
+			PatchListener *listener = NULL);
+	const std::vector<double>&	arrivals() const { return _arrivals; }
+	unsigned int	shortpatches() const { return _shortpatches; }
+};
+
+} // namespace qhy
+
+#endif /* qhy_patchreader_h */
@@ -5,9 +5,65 @@
  */
 #include <device.h>
 #include <camera.h>
+#include <demuxmode.h>
 
 namespace qhy {
 
+/**
+ * \brief Geometry of the unbinned mode of the QHY8PRO
+ *
+ * Each raw line contains two interleaved image rows.
+ */
+struct Qhy8ProMode11 {
+	static const unsigned int	binx = 1, biny = 1;
+	static const unsigned int	HBIN = 1, VBIN = 1;
+	static const unsigned int	LineSize = 6656;
+	static const unsigned int	VerticalSize = 1015;
+	static const unsigned int	TopSkipPix = 2300;
+	static const unsigned int	patch_size = 26624;
+	static const unsigned int	width = 3328, height = 2030;
+	static const unsigned int	rows = 2, words = 1;
+	static const unsigned int	activex = 28, activey = 0;
+	static const unsigned int	activewidth = 3040, activeheight = 2024;
+};
+
+/**
+ * \brief Geometry of the 2x2 binned mode of the QHY8PRO
+ *
+ * The CCD only bins horizontally, two vertically adjacent pixels
+ * are added in software.
+ */
+struct Qhy8ProMode22 {
+	static const unsigned int	binx = 2, biny = 2;
+	static const unsigned int	HBIN = 2, VBIN = 1;
+	static const unsigned int	LineSize = 3328;
+	static const unsigned int	VerticalSize = 1015;
+	static const unsigned int	TopSkipPix = 1250;
+	static const unsigned int	patch_size = 26624;
+	static const unsigned int	width = 1664, height = 1015;
+	static const unsigned int	rows = 1, words = 2;
+	static const unsigned int	activex = 16, activey = 0;
+	static const unsigned int	activewidth = 1520, activeheight = 1012;
+};
+
+/**
+ * \brief Geometry of the 4x4 binned mode of the QHY8PRO
+ *
+ * The CCD bins 2x2, the remaining four pixels are added in software.
+ */
+struct Qhy8ProMode44 {
+	static const unsigned int	binx = 4, biny = 4;
+	static const unsigned int	HBIN = 2, VBIN = 2;
+	static const unsigned int	LineSize = 3328;
+	static const unsigned int	VerticalSize = 507;
+	static const unsigned int	TopSkipPix = 0;
+	static const unsigned int	patch_size = 3296 * 1024;
+	static const unsigned int	width = 832, height = 507;
+	static const unsigned int	rows = 1, words = 4;
+	static const unsigned int	activex = 8, activey = 0;
+	static const unsigned int	activewidth = 760, activeheight = 506;
+};
+
 /**
  * \brief Camera class for the QHY8PRO camera
  *
@@ -16,15 +72,37 @@ namespace qhy {
  * rather extensive demultiplexing. 
  */
 class Qhy8Pro : public CameraOld {
+	typedef void	(*demuxfunction)(ImageBuffer& image,
+				const Buffer& buffer, unsigned int firstline,
+				unsigned int lastline, PixelStatistics *statistics);
+	typedef void	(*demuxwidefunction)(ImageBuffer32& image,
+				const Buffer& buffer, unsigned int firstline,
+				unsigned int lastline, PixelStatistics *statistics);
+	demuxfunction	_demux;
+	demuxfunction	_demuxactive;
+	demuxwidefunction	_demuxwide;
+	demuxwidefunction	_demuxwideactive;
+	ImageRectangle	_active;
+	template<typename Mode>
+	void	modesetup();
 public:
 	Qhy8Pro(PDevice &device);
 	virtual void	mode(const BinningMode& m);
 protected:
-	virtual void	demux(ImageBuffer& image, const Buffer& buffer);
-private:
-	virtual void	demux11(ImageBuffer& image, const Buffer& buffer);
-	virtual void	demux22(ImageBuffer& image, const Buffer& buffer);
-	virtual void	demux44(ImageBuffer& image, const Buffer& buffer);
+	virtual void	demuxlines(ImageBuffer& image, const Buffer& buffer,
+				unsigned int firstline, unsigned int lastline,
+				PixelStatistics *statistics);
+	virtual void	demuxlines(ImageBuffer32& image, const Buffer& buffer,
+				unsigned int firstline, unsigned int lastline,
+				PixelStatistics *statistics);
+	virtual ImageRectangle	activearea() const;
+	virtual bool	activedemux() const;
+	virtual void	demuxactivelines(ImageBuffer& image,
+				const Buffer& buffer, unsigned int firstline,
+				unsigned int lastline, PixelStatistics *statistics);
+	virtual void	demuxactivelines(ImageBuffer32& image,
+				const Buffer& buffer, unsigned int firstline,
+				unsigned int lastline, PixelStatistics *statistics);
 };
 
 } // namespace qhy
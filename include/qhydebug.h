@@ -8,6 +8,10 @@
 #ifndef _qhydebug_h
 #define _qhydebug_h
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
 #include <syslog.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -16,6 +20,23 @@
 #define DEBUG_ERRNO		2
 #define DEBUG_LOG		__FILE__, __LINE__
 
+/*
+ * Messages above the floor are removed by the compiler, configuring with
+ * --disable-debuglog lowers the floor to LOG_INFO, which strips all the
+ * LOG_DEBUG messages from the library.
+ */
+#ifndef QHYDEBUG_FLOOR
+#define QHYDEBUG_FLOOR		LOG_DEBUG
+#endif
+
+/*
+ * Whether messages of a given level are logged at all. For disabled
+ * messages, the qhydebug macro costs a single branch, the arguments are
+ * not evaluated.
+ */
+#define QHYDEBUG_ENABLED(loglevel)					\
+	(((loglevel) <= QHYDEBUG_FLOOR) && ((loglevel) <= qhydebuglevel))
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -23,13 +44,19 @@ extern "C" {
 extern int	qhydebuglevel;
 extern int	qhydebugtimeprecision;
 extern int	qhydebugthreads;
-extern void	qhydebug(int loglevel, const char *filename, int line,
+extern void	(qhydebug)(int loglevel, const char *filename, int line,
 			int flags, const char *format, ...);
 extern void	qhyvdebug(int loglevel, const char *filename, int line,
 			int flags, const char *format, va_list ap);
+extern int	qhydebugstart(const char *logfile);
+extern void	qhydebugstop(void);
 
 #ifdef __cplusplus
 }
 #endif
 
+#define qhydebug(loglevel, ...)						\
+	(QHYDEBUG_ENABLED(loglevel)					\
+		? (qhydebug)(loglevel, __VA_ARGS__) : (void)0)
+
 #endif /* _qhydebug_h */
@@ -10,6 +10,9 @@
 #include <set>
 #include <string>
 #include <memory>
+#include <vector>
+#include <thread>
+#include <exception>
 
 namespace qhy {
 
@@ -29,8 +32,13 @@ public:
  * When any USB related error happens, an USBError exception is thrown.
  */
 class USBError : public std::runtime_error {
+	int	_usberror;
 public:
 	USBError(int usberror);
+	/**
+	 * \brief The libusb error code that caused the exception
+	 */
+	int	usberror() const { return _usberror; }
 };
 
 /**
@@ -204,23 +212,145 @@ public:
 	bool	empty() const { return size.empty(); }
 };
 
-class ImageBuffer;
+/**
+ * \brief Timing and transfer statistics of a single frame
+ *
+ * Time stamps are in seconds as returned by gettimeofday(), durations
+ * are in seconds. The patch interval is the time between the arrival
+ * of a patch and the arrival of the previous one, the statistics
+ * thus tell whether the USB link delivered the image at a steady rate.
+ */
+class FrameMetrics {
+public:
+	double	registers;	// registers sent to the camera
+	double	exposurestart;	// exposure started
+	double	firstpatch;	// first patch received
+	double	lastpatch;	// last patch received
+	double	allocationtime;	// time to allocate the image buffers
+	double	demuxtime;	// time spent demultiplexing
+	unsigned long	bytes;	// bytes transferred
+	unsigned int	patches;	// number of patches
+	unsigned int	shortpatches;	// patches with fewer bytes than requested
+	double	intervalmin;
+	double	intervalmax;
+	double	interval50;	// median
+	double	interval90;
+	double	interval99;
+	FrameMetrics();
+	std::string	toString() const;
+};
+
+/**
+ * \brief Pixel statistics of a frame
+ *
+ * If Camera::statistics() is enabled, the statistics of the active area
+ * are collected while the image is demultiplexed. The histogram has a
+ * bin for every 16 bit pixel value, pixels of 32 bit images beyond that
+ * are only included in the other statistics. Pixels of 16 bit images
+ * saturate at 65535, binned pixels of 32 bit images at 65535 times the
+ * number of raw values added up by the camera.
+ */
+class FrameStatistics {
+public:
+	unsigned long	count;		// number of pixels
+	unsigned int	min;
+	unsigned int	max;
+	double	mean;
+	double	stddev;
+	unsigned long	saturated;	// pixels at the saturation value
+	std::vector<unsigned long>	histogram;
+	FrameStatistics();
+	std::string	toString() const;
+};
+typedef std::shared_ptr<FrameStatistics>	FrameStatisticsPtr;
+
+/**
+ * \brief Histogram of durations
+ *
+ * The buckets have upper bounds 1, 2 and 5 times the powers of ten from
+ * one microsecond to 100 seconds, values beyond that end up in the last
+ * bucket.
+ */
+class Histogram {
+public:
+	std::vector<double>	bounds;
+	std::vector<unsigned long>	counts;
+	unsigned long	count;
+	double	sum;
+	double	min;
+	double	max;
+	Histogram();
+	void	add(double value);
+	double	mean() const { return (count) ? (sum / count) : 0; }
+	std::string	toString() const;
+};
+
+/**
+ * \brief Process wide counters and histograms of all frames read
+ *
+ * An application can take a snapshot at any time, e.g. to compare the
+ * distribution of patch intervals before and after a change.
+ */
+class Metrics {
+public:
+	unsigned long	frames;
+	unsigned long	failures;
+	unsigned long	bytes;
+	unsigned long	patches;
+	unsigned long	shortpatches;
+	Histogram	readouttime;	// first to last patch
+	Histogram	patchinterval;
+	Histogram	allocationtime;
+	Histogram	demuxtime;
+	Metrics();
+	static Metrics	snapshot();
+	static void	reset();
+};
+
+/**
+ * \brief Start recording spans of the acquisition path
+ *
+ * Register transfers, exposure start, every patch, demultiplexing,
+ * active area extraction and the iterations of the cooler regulator
+ * are recorded as spans tagged with the thread. Each thread records
+ * into a buffer for capacity spans allocated on its first span, spans
+ * beyond that are dropped.
+ */
+void	tracestart(const std::string& filename, unsigned long capacity = 65536);
+
+/**
+ * \brief Stop recording spans and write them in Chrome trace event format
+ */
+void	tracestop();
+
+template<typename Pixel> class Image;
+typedef Image<unsigned short>	ImageBuffer;
 typedef std::shared_ptr<ImageBuffer>	ImageBufferPtr;
+typedef Image<unsigned int>	ImageBuffer32;
+typedef std::shared_ptr<ImageBuffer32>	ImageBuffer32Ptr;
+typedef Image<float>	FloatImage;
+typedef std::shared_ptr<FloatImage>	FloatImagePtr;
 
 /**
  * \brief Image Buffer returned by the camera
  *
- * An image buffer is just a block of memory consisting unsigned short
- * pixel values. It also knows its height and width, and pixels
- * can be accessed using pixel coordinates.
+ * An image buffer is just a block of memory consisting of pixel values.
+ * It also knows its height and width, and pixels can be accessed using
+ * pixel coordinates. The camera delivers unsigned short pixels in an
+ * ImageBuffer, or unsigned int pixels in an ImageBuffer32 if binned
+ * pixels should not saturate. Processing stages can work on FloatImage
+ * buffers. The implementation is instantiated for these pixel types
+ * only.
  */
-class ImageBuffer {
+template<typename Pixel>
+class Image {
 	unsigned int	_width;
 	unsigned int	_height;
 	unsigned int	_npixels;
 	unsigned int	buffersize;
-	unsigned short	*_pixelbuffer;
+	Pixel	*_pixelbuffer;
 public:
+	typedef Pixel	pixel_type;
 	/**
 	 * \brief Get the width of the image
 	 */
@@ -243,19 +373,19 @@ public:
 	 * Preferably, the range checked methods below should be used
 	 * for pixel access.
 	 */
-	unsigned short	*pixelbuffer() const { return _pixelbuffer; }
+	Pixel	*pixelbuffer() const { return _pixelbuffer; }
 private:
-	ImageBuffer(const ImageBuffer& other);
-	ImageBuffer&	operator=(const ImageBuffer& other);
+	Image(const Image& other);
+	Image&	operator=(const Image& other);
 	void	setup();
 public:
-	ImageBuffer(unsigned int width, unsigned int height);
-	ImageBuffer(const ImageSize& size);
-	~ImageBuffer();
-	unsigned short	p(unsigned int x, unsigned int y) const;
-	unsigned short&	p(unsigned int x, unsigned int y);
-	unsigned short	p(const ImagePoint& q) const { return p(q.x(), q.y()); }
-	unsigned short&	p(const ImagePoint& q) { return p(q.x(), q.y()); }
+	Image(unsigned int width, unsigned int height);
+	Image(const ImageSize& size);
+	~Image();
+	Pixel	p(unsigned int x, unsigned int y) const;
+	Pixel&	p(unsigned int x, unsigned int y);
+	Pixel	p(const ImagePoint& q) const { return p(q.x(), q.y()); }
+	Pixel&	p(const ImagePoint& q) { return p(q.x(), q.y()); }
 	const unsigned char&	operator[](unsigned int i) const;
 	unsigned char&	operator[](unsigned int i);
 private:
@@ -267,17 +397,207 @@ public:
 	const ImageSize&	active_size() const { return _active.size; }
 	void	active_origin(const ImagePoint& a) { _active.origin = a; }
 	void	active_size(const ImageSize& s) { _active.size = s; }
-	unsigned short	ap(unsigned int x, unsigned int y) const;
-	unsigned short	ap(const ImagePoint& q) { return ap(q.x(), q.y()); }
+	Pixel	ap(unsigned int x, unsigned int y) const;
+	Pixel	ap(const ImagePoint& q) { return ap(q.x(), q.y()); }
 	ImageSize	image_size() const {
 		return (_active.empty()) ? ImageSize(width(), height())
 			: _active.size;
 	}
-	unsigned short	pixel(unsigned int x, unsigned int y) const;
-	unsigned short	pixel(const ImagePoint& q) {
+	Pixel	pixel(unsigned int x, unsigned int y) const;
+	Pixel	pixel(const ImagePoint& q) {
 		return pixel(q.x(), q.y());
 	}
-	ImageBufferPtr	active_buffer() const;
+	std::shared_ptr<Image>	active_buffer() const;
+private:
+	FrameMetrics	_metrics;
+public:
+	/**
+	 * \brief Metrics of the readout that produced this image
+	 */
+	const FrameMetrics&	metrics() const { return _metrics; }
+	void	metrics(const FrameMetrics& m) { _metrics = m; }
+private:
+	FrameStatisticsPtr	_statistics;
+public:
+	/**
+	 * \brief Statistics of the active area, if they were collected
+	 */
+	FrameStatisticsPtr	statistics() const { return _statistics; }
+	void	statistics(FrameStatisticsPtr s) { _statistics = s; }
+};
+
+/**
+ * \brief Convert pixels to floating point
+ *
+ * The images must have the same size. The conversion uses vector
+ * instructions where the processor has them.
+ */
+void	floatpixels(const ImageBuffer& from, FloatImage& to);
+void	floatpixels(const ImageBuffer32& from, FloatImage& to);
+FloatImagePtr	floatimage(const ImageBuffer& image);
+FloatImagePtr	floatimage(const ImageBuffer32& image);
+
+/**
+ * \brief A row of pixels of an image view
+ *
+ * Rows are contiguous in memory, so they can be processed with plain
+ * pointers or with range based for loops.
+ */
+class ImageRow {
+	unsigned short	*_pixels;
+	unsigned int	_width;
+public:
+	ImageRow(unsigned short *pixels, unsigned int width)
+		: _pixels(pixels), _width(width) { }
+	unsigned short	*begin() const { return _pixels; }
+	unsigned short	*end() const { return _pixels + _width; }
+	unsigned int	size() const { return _width; }
+	unsigned short&	operator[](unsigned int x) const { return _pixels[x]; }
+};
+
+/**
+ * \brief A rectangle of an image buffer, without copying the pixels
+ *
+ * A view shares ownership of the image buffer it refers to, so it stays
+ * valid even if all other references to the image are gone. Rows of
+ * the view are stride pixels apart, the stride is negative if the view
+ * is flipped vertically. Pixel access through the view is not range
+ * checked, the rectangle is checked once when the view is created.
+ */
+class ImageView {
+	ImageBufferPtr	_image;
+	unsigned short	*_origin;
+	ImageSize	_size;
+	long	_stride;
+public:
+	ImageView(ImageBufferPtr image);
+	ImageView(ImageBufferPtr image, const ImageRectangle& rectangle,
+		bool flip = false);
+	static ImageView	active(ImageBufferPtr image);
+	ImageView	view(const ImageRectangle& rectangle,
+				bool flip = false) const;
+	ImageBufferPtr	image() const { return _image; }
+	const ImageSize&	size() const { return _size; }
+	unsigned int	width() const { return _size.width(); }
+	unsigned int	height() const { return _size.height(); }
+	long	stride() const { return _stride; }
+	bool	flipped() const { return _stride < 0; }
+	bool	contiguous() const { return _stride == (long)width(); }
+	/**
+	 * \brief First pixel of row y of the view
+	 */
+	unsigned short	*rowpointer(unsigned int y) const {
+		return _origin + y * _stride;
+	}
+	ImageRow	row(unsigned int y) const {
+		return ImageRow(rowpointer(y), width());
+	}
+	unsigned short&	operator()(unsigned int x, unsigned int y) const {
+		return rowpointer(y)[x];
+	}
+	ImageBufferPtr	copy() const;
+};
+
+/**
+ * \brief Color image with 16 bit channels
+ *
+ * The channels are either stored in three consecutive planes of width
+ * times height pixels in the order red, green, blue, or interleaved
+ * as red, green, blue triples.
+ */
+class ColorImage {
+public:
+	enum Layout { Planar = 0, Interleaved = 1 };
+	enum Color { Red = 0, Green = 1, Blue = 2 };
+private:
+	ImageSize	_size;
+	enum Layout	_layout;
+	unsigned short	*_pixels;
+	// prevent copying
+	ColorImage(const ColorImage& other);
+	ColorImage&	operator=(const ColorImage& other);
+public:
+	ColorImage(const ImageSize& size, enum Layout layout = Planar);
+	~ColorImage();
+	const ImageSize&	size() const { return _size; }
+	unsigned int	width() const { return _size.width(); }
+	unsigned int	height() const { return _size.height(); }
+	unsigned int	npixels() const { return width() * height(); }
+	enum Layout	layout() const { return _layout; }
+	unsigned short	*pixelbuffer() const { return _pixels; }
+	unsigned short	*plane(enum Color color) const;
+	unsigned short	p(unsigned int x, unsigned int y,
+				enum Color color) const;
+private:
+	FrameMetrics	_metrics;
+public:
+	const FrameMetrics&	metrics() const { return _metrics; }
+	void	metrics(const FrameMetrics& m) { _metrics = m; }
+};
+typedef std::shared_ptr<ColorImage>	ColorImagePtr;
+
+class BandRunner;
+
+/**
+ * \brief Conversion of color filter array mosaics to color images
+ *
+ * The pattern names the colors of the top left 2x2 pixels of an image
+ * buffer, like Camera::bayer(). The debayer reads the pixels of a view
+ * directly from the buffer, and determines the pattern at the first
+ * pixel of the view from its position in the buffer. The rows of the
+ * result are computed in parallel bands, with vectorized kernels if
+ * the processor supports them.
+ *
+ * Superpixel combines every 2x2 cell into one color pixel of an image
+ * half the size. Bilinear averages the nearest pixels of each color.
+ * EdgeAware interpolates green along the direction of the smaller
+ * gradient and the other colors from their differences to green,
+ * which avoids most of the color fringes of bilinear interpolation.
+ */
+class Debayer {
+public:
+	enum Method { Superpixel = 0, Bilinear = 1, EdgeAware = 2 };
+private:
+	std::string	_pattern;
+	enum Method	_method;
+	enum ColorImage::Layout	_layout;
+	std::shared_ptr<BandRunner>	_runner;
+public:
+	Debayer(const std::string& pattern, enum Method method = Bilinear,
+		enum ColorImage::Layout layout = ColorImage::Planar);
+	const std::string&	pattern() const { return _pattern; }
+	enum Method	method() const { return _method; }
+	void	method(enum Method method) { _method = method; }
+	enum ColorImage::Layout	layout() const { return _layout; }
+	void	layout(enum ColorImage::Layout layout) { _layout = layout; }
+	unsigned int	threads() const;
+	void	threads(unsigned int threads);
+	ColorImagePtr	operator()(const ImageView& view);
+	ColorImagePtr	operator()(ImageBufferPtr image);
+	static std::string	shifted(const std::string& pattern,
+					unsigned int x, unsigned int y);
+	static std::string	viewpattern(const std::string& pattern,
+					const ImageView& view);
+};
+
+/**
+ * \brief Statistics of the buffer pool of a camera
+ *
+ * Raw data and image buffers are taken from a pool and returned to it
+ * when they are no longer used, so that continuous capture does not
+ * have to allocate frame sized buffers for every image.
+ */
+class BufferPoolStatistics {
+public:
+	unsigned long	hits;		// requests served from the pool
+	unsigned long	misses;		// requests that had to allocate
+	unsigned long	recycled;	// buffers returned to the pool
+	unsigned long	evicted;	// buffers freed because the pool was full
+	unsigned long	outstanding;	// buffers currently handed out
+	unsigned long	available;	// buffers ready for reuse
+	unsigned long	bytes;		// memory held by the available buffers
+	BufferPoolStatistics();
+	std::string	toString() const;
 };
 
 /**
@@ -292,6 +612,166 @@ public:
 	int&	y() { return second; }
 };
 
+/**
+ * \brief Binning of images in software
+ *
+ * Every pixel of the result combines a bin of mode.x() x mode.y() pixels
+ * of a view, either as their sum or as their rounded average. Sums are
+ * accumulated in 32 bits, they only saturate at 65535 if the result has
+ * 16 bit pixels. Pixels at the right and bottom border that do not fill
+ * a complete bin are dropped. Bands of rows are binned in parallel.
+ *
+ * Bayer aware binning only combines pixels of the same color of the 2x2
+ * filter pattern, so a bin covers twice as many pixels of the view in
+ * each direction. The result is again a mosaic, with the pattern
+ * Debayer::viewpattern() of the view.
+ */
+class SoftwareBinning {
+public:
+	enum Combine { Sum = 0, Average = 1 };
+private:
+	BinningMode	_mode;
+	enum Combine	_combine;
+	bool	_bayer;
+	std::shared_ptr<BandRunner>	_runner;
+	template<typename Pixel>
+	void	bin(const ImageView& view, Image<Pixel>& image);
+public:
+	SoftwareBinning(const BinningMode& mode, enum Combine combine = Sum,
+		bool bayer = false);
+	const BinningMode&	mode() const { return _mode; }
+	enum Combine	combine() const { return _combine; }
+	void	combine(enum Combine combine) { _combine = combine; }
+	bool	bayer() const { return _bayer; }
+	void	bayer(bool bayer) { _bayer = bayer; }
+	unsigned int	threads() const;
+	void	threads(unsigned int threads);
+	ImageSize	binnedsize(const ImageSize& size) const;
+	ImageBufferPtr	binned(const ImageView& view);
+	ImageBuffer32Ptr	binned32(const ImageView& view);
+};
+
+/**
+ * \brief Bias, dark and flat field correction of images
+ *
+ * Calibrated pixels are (raw - dark) * invflat. The master dark must
+ * have the exposure time of the images and includes the bias, so the
+ * master bias is only subtracted if there is no dark. The reciprocal
+ * of the flat, with the bias removed and normalized to mean 1, is
+ * computed once when the masters are set, pixels of the flat that are
+ * not positive are left uncorrected. All masters must have the size
+ * of the images to calibrate. Bands of rows are calibrated in parallel
+ * with vectorized kernels.
+ */
+class Calibration {
+	ImageSize	_size;
+	FloatImagePtr	_bias;
+	FloatImagePtr	_dark;
+	FloatImagePtr	_flat;
+	FloatImagePtr	_invflat;
+	std::shared_ptr<BandRunner>	_runner;
+	void	updatesize();
+	const float	*offset() const;
+	template<typename Pixel>
+	void	calibrate(const ImageBuffer& from, Image<Pixel>& to);
+public:
+	Calibration();
+	const ImageSize&	size() const { return _size; }
+	FloatImagePtr	bias() const { return _bias; }
+	void	bias(FloatImagePtr bias);
+	void	bias(const ImageBuffer& bias);
+	FloatImagePtr	dark() const { return _dark; }
+	void	dark(FloatImagePtr dark);
+	void	dark(const ImageBuffer& dark);
+	FloatImagePtr	flat() const { return _flat; }
+	void	flat(FloatImagePtr flat);
+	void	flat(const ImageBuffer& flat);
+	FloatImagePtr	invflat() const { return _invflat; }
+	unsigned int	threads() const;
+	void	threads(unsigned int threads);
+	void	operator()(ImageBuffer& image);
+	ImageBufferPtr	calibrated(const ImageBuffer& image);
+	FloatImagePtr	calibratedfloat(const ImageBuffer& image);
+};
+
+/**
+ * \brief Description of a master dark in a dark library
+ */
+class DarkMaster {
+public:
+	BinningMode	mode;
+	ImageSize	size;
+	double	exposure;	// seconds, 0 for a master bias
+	double	temperature;	// degrees Celsius
+	std::string	filename;
+	DarkMaster();
+	std::string	toString() const;
+};
+
+class darkcache;
+
+/**
+ * \brief Persistent library of master darks
+ *
+ * The masters are stored in a directory, one file per binning mode,
+ * image size, exposure time and temperature, with the pixels as raw
+ * floats behind a small header. Files are memory mapped when a master
+ * is needed, no FITS parsing is involved. Masters with exposure time 0
+ * are master biases.
+ *
+ * A dark for an exposure is either the nearest master, an interpolation
+ * between the masters bracketing the exposure time, or the dark current
+ * of the nearest master scaled to the exposure time and temperature.
+ * Dark current is assumed to be proportional to the exposure time and
+ * to double every doubling() degrees. Methods that cannot be applied
+ * fall back to the next simpler one, down to the nearest master.
+ *
+ * The darks handed out are kept in a cache of the capacity() most
+ * recently used ones, indexed by binning mode, size, exposure time and
+ * the temperature rounded to resolution() degrees. Cycling through a
+ * few exposure settings thus finds the darks in memory. The darks are
+ * shared with the cache and must not be modified. The library can be
+ * used from several threads, the files of the masters are read without
+ * blocking the threads that find their darks in the cache.
+ */
+class DarkLibrary {
+public:
+	enum Method { Nearest, Interpolated, Scaled };
+private:
+	std::string	_directory;
+	std::vector<DarkMaster>	_masters;
+	enum Method	_method;
+	double	_doubling;
+	double	_resolution;
+	unsigned int	_capacity;
+	std::shared_ptr<darkcache>	_cache;
+	void	scan();
+private:
+	// prevent copying
+	DarkLibrary(const DarkLibrary& other);
+	DarkLibrary&	operator=(const DarkLibrary& other);
+public:
+	DarkLibrary(const std::string& directory);
+	const std::string&	directory() const { return _directory; }
+	std::vector<DarkMaster>	masters() const;
+	enum Method	method() const;
+	void	method(enum Method method);
+	double	doubling() const;
+	void	doubling(double doubling);
+	double	resolution() const;
+	void	resolution(double resolution);
+	unsigned int	capacity() const;
+	void	capacity(unsigned int capacity);
+	unsigned long	hits() const;
+	unsigned long	misses() const;
+	void	add(const BinningMode& mode, double exposure,
+			double temperature, const FloatImage& dark);
+	void	add(const BinningMode& mode, double exposure,
+			double temperature, const ImageBuffer& dark);
+	FloatImagePtr	dark(const BinningMode& mode, const ImageSize& size,
+				double exposure, double temperature);
+};
+
 /**
  * \brief Camera class
  *
@@ -314,7 +794,18 @@ protected:
 	std::string	_bayer;
 	void	bayer(const std::string& b) { _bayer = b; }
 public:
+	/**
+	 * \brief Color filter pattern of the images in the current mode
+	 *
+	 * The pattern names the colors of the top left 2x2 pixels of the
+	 * images returned by getImage(), it is empty if the images have
+	 * no color information.
+	 */
 	const std::string&	bayer() const { return _bayer; }
+	/**
+	 * \brief Color filter pattern of the images from getActiveImage()
+	 */
+	virtual std::string	activebayer() const = 0;
 protected:
 	double	_exposuretime;
 public:
@@ -323,8 +814,99 @@ public:
 	virtual void	startExposure() = 0;
 	virtual void	cancelExposure() = 0;
 	virtual ImageBufferPtr	getImage() = 0;
+	/**
+	 * \brief Get only the active area of the image
+	 *
+	 * The result is the same as active_buffer() of the image returned
+	 * by getImage(), but cameras may produce it directly during
+	 * demultiplexing, without the full sensor image.
+	 */
+	virtual ImageBufferPtr	getActiveImage() = 0;
+	/**
+	 * \brief Get an image with 32 bit pixels
+	 *
+	 * In binned modes, the pixels are the plain sums of the binned
+	 * pixels, without the saturation at 65535 of getImage().
+	 */
+	virtual ImageBuffer32Ptr	getImage32() = 0;
+	virtual ImageBuffer32Ptr	getActiveImage32() = 0;
 	enum DownloadSpeed { Low = 0, High = 1 };
 	virtual void	downloadSpeed(enum DownloadSpeed speed) = 0;
+protected:
+	unsigned int	_queuedepth;
+public:
+	/**
+	 * \brief Number of bulk transfers kept in flight during readout
+	 */
+	unsigned int	queuedepth() const { return _queuedepth; }
+	void	queuedepth(unsigned int depth);
+protected:
+	bool	_pipelined;
+public:
+	/**
+	 * \brief Whether demultiplexing overlaps with the download
+	 *
+	 * In pipelined mode, lines of the image are demultiplexed as soon
+	 * as they have arrived, while later patches are still in flight.
+	 */
+	bool	pipelined() const { return _pipelined; }
+	void	pipelined(bool p) { _pipelined = p; }
+protected:
+	unsigned int	_poolcapacity;
+public:
+	/**
+	 * \brief Number of unused buffers of each kind kept for reuse
+	 *
+	 * To capture continuously without allocations, the capacity must
+	 * cover the images the application holds at the same time.
+	 */
+	unsigned int	poolcapacity() const { return _poolcapacity; }
+	void	poolcapacity(unsigned int capacity) { _poolcapacity = capacity; }
+	virtual BufferPoolStatistics	poolstatistics() const = 0;
+	/**
+	 * \brief Memory used for the raw data of an image
+	 *
+	 * HugePageMemory is aligned to and advised for 2 MB pages, which
+	 * reduces TLB misses during download and demultiplexing.
+	 * DMAMemory is mapped from the USB driver, so that the kernel
+	 * does not have to copy the data, and falls back to huge pages
+	 * where the kernel does not support it.
+	 */
+	enum FrameMemory { HeapMemory = 0, HugePageMemory = 1, DMAMemory = 2 };
+protected:
+	enum FrameMemory	_framememory;
+	bool	_lockmemory;
+public:
+	enum FrameMemory	framememory() const { return _framememory; }
+	void	framememory(enum FrameMemory memory) { _framememory = memory; }
+	/**
+	 * \brief Whether huge page memory should be locked into RAM
+	 */
+	bool	lockmemory() const { return _lockmemory; }
+	void	lockmemory(bool lock) { _lockmemory = lock; }
+protected:
+	unsigned int	_demuxthreads;
+public:
+	/**
+	 * \brief Number of threads demultiplexing an image
+	 *
+	 * With more than one thread, the raw lines are split into bands
+	 * of about equal size, each converted by a thread of a pool owned
+	 * by the camera.
+	 */
+	unsigned int	demuxthreads() const { return _demuxthreads; }
+	void	demuxthreads(unsigned int threads);
+protected:
+	bool	_statistics;
+public:
+	/**
+	 * \brief Whether to collect FrameStatistics during demultiplexing
+	 *
+	 * The statistics are updated while the demultiplexed pixels are
+	 * still in the cache, each demux thread keeps its own histogram.
+	 */
+	bool	statistics() const { return _statistics; }
+	void	statistics(bool s) { _statistics = s; }
 private:
 	Camera(const Camera& other);
 	Camera&	operator=(const Camera& other);
@@ -355,9 +937,106 @@ typedef std::shared_ptr<Device>	DevicePtr;
 
 /**
  * \brief Function to create a new device
+ *
+ * This opens the first device with matching vendor and product id.
+ * To address one of several identical cameras, use getDevice() with
+ * a DeviceInfo from listDevices() instead.
  */
 DevicePtr	getDevice(unsigned short idVendor, unsigned short idProduct);
 
+/**
+ * \brief Description of a supported device attached to the host
+ *
+ * The bus number and the path of port numbers from the root hub to the
+ * device identify the device as long as it is not plugged into a
+ * different port. The port number alone is not enough, devices behind
+ * different hubs of the same bus may have the same port number. The
+ * location is written as bus-p1.p2.p3, like the kernel names USB
+ * devices. The serial number is only available if the device could be
+ * opened during enumeration, otherwise it is empty.
+ */
+class DeviceInfo {
+public:
+	unsigned short	idVendor;
+	unsigned short	idProduct;
+	int	bus;
+	std::vector<unsigned char>	ports;
+	int	address;
+	std::string	serial;
+	DeviceInfo() : idVendor(0), idProduct(0), bus(0), address(0) { }
+	std::string	location() const;
+	void	location(const std::string& location);
+	std::string	toString() const;
+};
+
+/**
+ * \brief List all supported QHY devices attached to the host
+ */
+std::vector<DeviceInfo>	listDevices();
+
+/**
+ * \brief Open a specific device found by listDevices()
+ *
+ * The device is located by bus and port path, if the info contains
+ * a serial number, it must match as well.
+ */
+DevicePtr	getDevice(const DeviceInfo& info);
+
+/**
+ * \brief Capture images on several devices concurrently
+ *
+ * Each device added gets its own thread, which starts an exposure and
+ * reads out the image. As the devices share nothing but the USB event
+ * thread, the aggregate throughput scales with the number of cameras
+ * and USB root hubs. The cameras must be fully configured before
+ * start() is called, and must not be touched until wait() returns.
+ */
+class ParallelCapture {
+	class Job {
+	public:
+		DevicePtr	device;
+		std::thread	thread;
+		ImageBufferPtr	image;
+		std::exception_ptr	error;
+		Job(DevicePtr d) : device(d) { }
+		void	main();
+	};
+	std::vector<std::shared_ptr<Job> >	jobs;
+	static void	job_main(void *arg);
+private:
+	ParallelCapture(const ParallelCapture& other);
+	ParallelCapture&	operator=(const ParallelCapture& other);
+public:
+	ParallelCapture() { }
+	~ParallelCapture();
+	void	add(DevicePtr device);
+	void	start();
+	std::vector<ImageBufferPtr>	wait();
+};
+
+/**
+ * \brief Function to create a device that records its USB traffic
+ *
+ * All control and bulk transfers of the device, including the DC201
+ * endpoints, are written to a binary trace file that can be replayed
+ * with getReplayDevice(). Records are buffered in memory and written
+ * by a background thread, so recording does not change the timing of
+ * the transfers noticeably.
+ */
+DevicePtr	getRecordingDevice(unsigned short idVendor,
+			unsigned short idProduct, const std::string& tracefile);
+
+/**
+ * \brief Function to create a device replaying recorded USB traffic
+ *
+ * The device behaves like the camera the trace was recorded from, which
+ * allows to exercise the library without a camera. In real-time mode,
+ * transfers take as long as they did during the recording, otherwise
+ * they complete immediately.
+ */
+DevicePtr	getReplayDevice(const std::string& tracefile,
+			bool realtime = false);
+
 } // namespace qhy
 
 #endif /* qhy_qhylib_h */
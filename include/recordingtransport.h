@@ -0,0 +1,105 @@
+/*
+ * recordingtransport.h -- recording of USB traffic into a trace file
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_recordingtransport_h
+#define qhy_recordingtransport_h
+
+#include <transport.h>
+#include <usbtrace.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace qhy {
+
+/**
+ * \brief Writer for USB trace files
+ *
+ * Records are copied into a preallocated ring buffer on the thread
+ * performing the transfer, and written to the trace file by a background
+ * thread. The transferring thread thus never waits for the file system.
+ * If the ring is full, the record is dropped rather than stalling the
+ * transfer, the number of dropped records is logged when the trace is
+ * closed.
+ */
+class TraceRecorder {
+	FILE	*_file;
+	unsigned char	*_ring;
+	unsigned long	_capacity;
+	std::atomic<unsigned long>	_head;
+	std::atomic<unsigned long>	_tail;
+	unsigned long	_dropped;
+	std::mutex	_producer;
+
+	// flush thread resources
+	std::mutex	_mutex;
+	std::condition_variable	_cond;
+	bool	_stop;
+	std::thread	_thread;
+	std::chrono::steady_clock::time_point	_start;
+	void	copyin(unsigned long position, const void *data,
+			unsigned long length);
+	void	flush();
+private:
+	// prevent copying
+	TraceRecorder(const TraceRecorder& other);
+	TraceRecorder&	operator=(const TraceRecorder& other);
+public:
+	TraceRecorder(const std::string& filename,
+		const usbtrace_header& header, unsigned long capacity);
+	~TraceRecorder();
+	uint64_t	now() const;
+	void	record(const usbtrace_record& record,
+			const unsigned char *payload);
+	unsigned long	dropped() const { return _dropped; }
+	void	main();
+};
+
+/**
+ * \brief Transport recording all traffic of another transport
+ *
+ * The recording transport passes all transfers on to the transport
+ * it wraps, and writes every request and response to a trace file
+ * that can later be replayed with a ReplayTransport.
+ */
+class RecordingTransport : public Transport {
+	Transport	*_transport;
+	TraceRecorder	*_recorder;
+public:
+	RecordingTransport(Transport *transport, const std::string& filename,
+		unsigned long capacity = 64 * 1024 * 1024);
+	virtual ~RecordingTransport();
+	virtual unsigned short	idVendor() const {
+		return _transport->idVendor();
+	}
+	virtual unsigned short	idProduct() const {
+		return _transport->idProduct();
+	}
+	virtual unsigned char	dataendpoint() const {
+		return _transport->dataendpoint();
+	}
+	virtual int	controltransfer(uint8_t bmRequestType, uint8_t bRequest,
+				uint16_t wValue, uint16_t wIndex,
+				unsigned char *data, uint16_t wLength,
+				unsigned int timeout);
+	virtual int	bulktransfer(unsigned char ep, unsigned char *data,
+				int length, unsigned int timeout);
+	virtual BulkRequest	*bulkrequest(unsigned char ep);
+	virtual unsigned char	*dmaalloc(unsigned long length) {
+		return _transport->dmaalloc(length);
+	}
+	virtual void	dmafree(unsigned char *data, unsigned long length) {
+		_transport->dmafree(data, length);
+	}
+	TraceRecorder&	recorder() { return *_recorder; }
+};
+
+} // namespace qhy
+
+#endif /* qhy_recordingtransport_h */
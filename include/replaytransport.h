@@ -0,0 +1,92 @@
+/*
+ * replaytransport.h -- USB transport replaying a recorded trace
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_replaytransport_h
+#define qhy_replaytransport_h
+
+#include <transport.h>
+#include <usbtrace.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace qhy {
+
+/**
+ * \brief Transport replaying recorded USB traffic from a trace file
+ *
+ * The replay transport answers every transfer with the next recorded
+ * response for the same endpoint (and request, for control transfers).
+ * Transfers on different endpoints are replayed independently, so that
+ * e.g. the cooler thread and the image readout may interleave differently
+ * than during the recording. When all records of an endpoint have been
+ * used, replay starts over with the first one, so a short trace can
+ * drive an arbitrarily long load test.
+ *
+ * In real-time mode, each transfer completes no earlier than it did
+ * during the recording, otherwise the transport runs at full speed.
+ */
+class ReplayTransport : public Transport {
+	bool	_realtime;
+	usbtrace_header	header;
+	std::vector<unsigned char>	trace;
+public:
+	/**
+	 * \brief A recorded transfer and its pacing information
+	 */
+	class Record {
+	public:
+		usbtrace_record	record;
+		const unsigned char	*payload;
+		std::chrono::nanoseconds	service;
+	};
+	/**
+	 * \brief A transfer scheduled for replay
+	 */
+	class Replay {
+	public:
+		const Record	*record;
+		std::chrono::steady_clock::time_point	due;
+	};
+private:
+	/**
+	 * \brief Records and replay state of a single endpoint
+	 */
+	class Stream {
+	public:
+		std::vector<Record>	records;
+		unsigned int	position;
+		std::chrono::steady_clock::time_point	busyuntil;
+		Stream() : position(0) { }
+	};
+	std::map<unsigned int, Stream>	streams;
+	std::mutex	_mutex;
+	static unsigned int	key(uint8_t type, uint8_t endpoint,
+					uint8_t bRequest);
+	void	load(const std::string& filename);
+public:
+	ReplayTransport(const std::string& filename, bool realtime = false);
+	virtual ~ReplayTransport();
+	virtual unsigned short	idVendor() const { return header.idVendor; }
+	virtual unsigned short	idProduct() const { return header.idProduct; }
+	virtual unsigned char	dataendpoint() const {
+		return header.dataendpoint;
+	}
+	Replay	next(uint8_t type, uint8_t endpoint, uint8_t bRequest);
+	int	complete(const Replay& replay, unsigned char *data, int length);
+	virtual int	controltransfer(uint8_t bmRequestType, uint8_t bRequest,
+				uint16_t wValue, uint16_t wIndex,
+				unsigned char *data, uint16_t wLength,
+				unsigned int timeout);
+	virtual int	bulktransfer(unsigned char ep, unsigned char *data,
+				int length, unsigned int timeout);
+	virtual BulkRequest	*bulkrequest(unsigned char ep);
+};
+
+} // namespace qhy
+
+#endif /* qhy_replaytransport_h */
@@ -0,0 +1,81 @@
+/*
+ * statistics.h -- pixel statistics collected during demultiplexing,
+ *                 not installed
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_statistics_h
+#define qhy_statistics_h
+
+#include <qhylib.h>
+#include <vector>
+
+namespace qhy {
+
+/**
+ * \brief Partial statistics of the pixels of one band of an image
+ *
+ * The only work per pixel is the increment of its histogram bin, all
+ * other statistics are derived from the histogram once the partial
+ * statistics of all bands have been merged. Pixels of 32 bit images
+ * that do not fit into the histogram are summed up separately. As all
+ * sums are integer, the result does not depend on how the image was
+ * split into bands.
+ *
+ * Pixels at the saturation() value or above are saturated. For 16 bit
+ * pixels this is 65535, 32 bit pixels of binned modes are sums of raw
+ * words that each saturate, so they only saturate at a multiple of it.
+ *
+ * Even and odd pixels go to two separate histograms, which are only
+ * added when the result is computed. In images with many equal pixels,
+ * e.g. saturated ones, this halves the chains of increments of the
+ * same bin, which the processor cannot overlap.
+ */
+class PixelStatistics {
+	std::vector<unsigned int>	_histogram;
+	unsigned long	_large;		// pixels above 65535
+	unsigned long long	_largesum;
+	double	_largesquares;
+	unsigned int	_largemin;
+	unsigned int	_largemax;
+	unsigned long	_largesaturated;
+	unsigned int	_saturation;
+public:
+	PixelStatistics();
+	void	reset();
+	unsigned int	saturation() const { return _saturation; }
+	void	saturation(unsigned int saturation) { _saturation = saturation; }
+	/**
+	 * \brief Add a row of pixels
+	 */
+	void	add(const unsigned short *pixels, unsigned int n) {
+		unsigned int	*even = &_histogram[0];
+		unsigned int	*odd = even + 65536;
+		unsigned int	i = 0;
+		for (; i + 2 <= n; i += 2) {
+			even[pixels[i]]++;
+			odd[pixels[i + 1]]++;
+		}
+		if (i < n) {
+			even[pixels[i]]++;
+		}
+	}
+	void	add(const unsigned int *pixels, unsigned int n) {
+		unsigned int	*h = &_histogram[0];
+		for (unsigned int i = 0; i < n; i++) {
+			if (pixels[i] > 65535) {
+				addlarge(pixels[i]);
+			} else {
+				h[pixels[i] + ((i & 1) << 16)]++;
+			}
+		}
+	}
+	void	merge(const PixelStatistics& other);
+	FrameStatisticsPtr	result() const;
+private:
+	void	addlarge(unsigned int pixel);
+};
+
+} // namespace qhy
+
+#endif /* qhy_statistics_h */
@@ -0,0 +1,84 @@
+/*
+ * threadpool.h -- worker threads for parallel image processing
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_threadpool_h
+#define qhy_threadpool_h
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+namespace qhy {
+
+/**
+ * \brief Interface for work that can be split into independent parts
+ */
+class ParallelWork {
+public:
+	virtual ~ParallelWork() { }
+	virtual void	run(unsigned int part) = 0;
+};
+
+class parallelbatch;
+
+class ThreadPool;
+typedef std::shared_ptr<ThreadPool>	ThreadPoolPtr;
+
+/**
+ * \brief A fixed set of worker threads owned by the library
+ *
+ * The pool is used to split work on an image into independent parts.
+ * A pool of size n consists of n - 1 worker threads, the thread calling
+ * parallel() processes one of the parts itself. The queue of parts only
+ * grows if more parts are submitted than ever before, so processing
+ * work in parallel does not allocate memory in the steady state.
+ */
+class ThreadPool {
+	std::vector<std::thread>	_threads;
+	std::mutex	_mutex;
+	std::condition_variable	_cond;
+	// parts waiting for a worker, _tasks[_next] is the next one
+	typedef std::pair<parallelbatch *, unsigned int>	task;
+	std::vector<task>	_tasks;
+	unsigned int	_next;
+	bool	_stop;
+private:
+	// prevent copying
+	ThreadPool(const ThreadPool& other);
+	ThreadPool&	operator=(const ThreadPool& other);
+public:
+	ThreadPool(unsigned int threads);
+	~ThreadPool();
+	unsigned int	size() const { return _threads.size() + 1; }
+	void	main();
+	void	parallel(unsigned int parts, ParallelWork& work);
+};
+
+/**
+ * \brief Runs the bands of rows of a processing stage on its own pool
+ *
+ * Each processing stage splits an image into at most threads() bands
+ * of rows, but never into more bands than there are rows. The pool is
+ * only started when more than one band is run, and started again if
+ * the number of threads has changed since.
+ */
+class BandRunner {
+	std::string	_stage;
+	unsigned int	_threads;
+	ThreadPoolPtr	_pool;
+public:
+	BandRunner(const std::string& stage);
+	unsigned int	threads() const { return _threads; }
+	void	threads(unsigned int threads);
+	unsigned int	bands(unsigned int rows) const;
+	void	run(unsigned int bands, ParallelWork& work);
+};
+
+} // namespace qhy
+
+#endif /* qhy_threadpool_h */
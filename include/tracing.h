@@ -0,0 +1,46 @@
+/*
+ * tracing.h -- spans for the Chrome trace event format, not installed
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_tracing_h
+#define qhy_tracing_h
+
+#include <atomic>
+#include <stdint.h>
+
+namespace qhy {
+
+extern std::atomic<bool>	tracing;
+
+uint64_t	tracenow();
+void	tracespan(const char *name, uint64_t start, uint64_t end, long arg);
+
+/**
+ * \brief Span covering the lifetime of the object or until end()
+ *
+ * The name must be a string constant, only the pointer is kept. When
+ * tracing is off, a span costs a single test of an atomic flag.
+ */
+class TraceSpan {
+	const char	*_name;
+	long	_arg;
+	uint64_t	_start;
+	bool	_active;
+public:
+	TraceSpan(const char *name, long arg = -1) : _name(name), _arg(arg) {
+		_active = tracing.load(std::memory_order_relaxed);
+		_start = (_active) ? tracenow() : 0;
+	}
+	~TraceSpan() { end(); }
+	void	end() {
+		if (_active) {
+			tracespan(_name, _start, tracenow(), _arg);
+			_active = false;
+		}
+	}
+};
+
+} // namespace qhy
+
+#endif /* qhy_tracing_h */
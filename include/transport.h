@@ -0,0 +1,94 @@
+/*
+ * transport.h -- abstraction of the USB transport underneath a device
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_transport_h
+#define qhy_transport_h
+
+#include <stdint.h>
+
+namespace qhy {
+
+/**
+ * \brief Asynchronous bulk transfer
+ *
+ * A BulkRequest is created by a transport for a particular endpoint and
+ * can be submitted repeatedly. Errors are reported as libusb error codes,
+ * independently of the transport actually used.
+ */
+class BulkRequest {
+protected:
+	unsigned char	_endpoint;
+	unsigned char	*_data;
+	int	_length;
+	int	_transferred;
+	int	_status;
+	bool	_completed;
+public:
+	/**
+	 * \brief The endpoint this request transfers data on
+	 */
+	unsigned char	endpoint() const { return _endpoint; }
+	/**
+	 * \brief The buffer of the last submission
+	 */
+	unsigned char	*data() const { return _data; }
+	/**
+	 * \brief Number of bytes actually transferred
+	 */
+	int	transferred() const { return _transferred; }
+	/**
+	 * \brief Status of the transfer: 0 or a libusb error code
+	 */
+	int	status() const { return _status; }
+	/**
+	 * \brief Whether the transfer has completed (or was never submitted)
+	 */
+	bool	completed() const { return _completed; }
+private:
+	// prevent copying
+	BulkRequest(const BulkRequest& other);
+	BulkRequest&	operator=(const BulkRequest& other);
+public:
+	BulkRequest(unsigned char endpoint);
+	virtual ~BulkRequest();
+	virtual void	submit(unsigned char *data, int length,
+				unsigned int timeout) = 0;
+	virtual void	cancel() = 0;
+	virtual void	wait() = 0;
+};
+
+/**
+ * \brief USB transport interface
+ *
+ * The PDevice class performs all communication with the camera through
+ * a transport. The standard transport talks to the camera via libusb,
+ * but other transports can e.g. replay recorded traffic, which allows
+ * to exercise the library without a camera.
+ */
+class Transport {
+private:
+	// prevent copying
+	Transport(const Transport& other);
+	Transport&	operator=(const Transport& other);
+public:
+	Transport();
+	virtual ~Transport();
+	virtual unsigned short	idVendor() const = 0;
+	virtual unsigned short	idProduct() const = 0;
+	virtual unsigned char	dataendpoint() const = 0;
+	virtual int	controltransfer(uint8_t bmRequestType, uint8_t bRequest,
+				uint16_t wValue, uint16_t wIndex,
+				unsigned char *data, uint16_t wLength,
+				unsigned int timeout) = 0;
+	virtual int	bulktransfer(unsigned char ep, unsigned char *data,
+				int length, unsigned int timeout) = 0;
+	virtual BulkRequest	*bulkrequest(unsigned char ep) = 0;
+	virtual unsigned char	*dmaalloc(unsigned long length);
+	virtual void	dmafree(unsigned char *data, unsigned long length);
+};
+
+} // namespace qhy
+
+#endif /* qhy_transport_h */
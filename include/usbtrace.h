@@ -0,0 +1,58 @@
+/*
+ * usbtrace.h -- binary format of USB traffic traces
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_usbtrace_h
+#define qhy_usbtrace_h
+
+#include <stdint.h>
+
+namespace qhy {
+
+/**
+ * \brief Header of a USB trace file
+ *
+ * A trace file starts with this header, followed by any number of
+ * records. All values are stored in host byte order.
+ */
+struct usbtrace_header {
+	char	magic[8];	// "QHYTRACE"
+	uint32_t	version;
+	uint16_t	idVendor;
+	uint16_t	idProduct;
+	uint8_t	dataendpoint;
+	uint8_t	reserved[7];
+};
+
+#define USBTRACE_MAGIC		"QHYTRACE"
+#define USBTRACE_VERSION	1
+
+#define USBTRACE_CONTROL	1
+#define USBTRACE_BULK		2
+
+/**
+ * \brief Record of a single USB transfer
+ *
+ * Each record is followed by length bytes of payload, which is the data
+ * sent to the device for OUT transfers and the data received for IN
+ * transfers. Timestamps are in nanoseconds of the monotonic clock,
+ * relative to the start of the trace.
+ */
+struct usbtrace_record {
+	uint64_t	timestamp;	// start of the transfer
+	uint64_t	duration;	// time until the transfer completed
+	int32_t		status;		// 0 or libusb error code
+	uint32_t	requested;	// number of bytes requested
+	uint32_t	length;		// number of payload bytes
+	uint16_t	wValue;		// control transfers only
+	uint16_t	wIndex;		// control transfers only
+	uint8_t		type;		// USBTRACE_CONTROL or USBTRACE_BULK
+	uint8_t		endpoint;	// endpoint or bmRequestType
+	uint8_t		bRequest;	// control transfers only
+	uint8_t		reserved[5];
+};
+
+} // namespace qhy
+
+#endif /* qhy_usbtrace_h */
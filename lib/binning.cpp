@@ -0,0 +1,206 @@
+/*
+ * binning.cpp -- binning of images in software
+ *
+ * The rows of a bin are first added to a row of 32 bit sums with the
+ * vectorized accumulation kernel, then neighbouring sums are combined
+ * into the binned pixels. Bayer aware binning works the same way, but
+ * steps over every other row and column, so that only pixels of the
+ * same color end up in the same bin.
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <threadpool.h>
+#include <tracing.h>
+#include <demux.h>
+#include <stdexcept>
+#include <limits>
+#include <vector>
+#include <cstring>
+
+namespace qhy {
+
+/**
+ * \brief Geometry of the bins of one direction
+ *
+ * Pixel i of the result combines the pixels first(i) + step * k of the
+ * view for k = 0, ..., size - 1.
+ */
+class binaxis {
+public:
+	unsigned int	size;
+	unsigned int	step;
+	binaxis(unsigned int s, bool bayer) : size(s), step(bayer ? 2 : 1) { }
+	unsigned int	binned(unsigned int n) const {
+		return step * (n / (step * size));
+	}
+	unsigned int	first(unsigned int i) const {
+		return (i / step) * step * size + (i % step);
+	}
+};
+
+/**
+ * \brief Compute a row of binned pixels from the sums of the rows of a bin
+ *
+ * The bins of a row are processed in groups of step bins, which cover
+ * step * size consecutive sums.
+ *
+ * \param divisor	number of pixels in a bin for averages, 1 for sums
+ */
+template<typename Pixel>
+static void	binrow(Pixel *row, unsigned int width, const unsigned int *sums,
+			const binaxis& x, unsigned int divisor) {
+	const unsigned int	maxpixel = std::numeric_limits<Pixel>::max();
+	const unsigned int	half = divisor / 2;
+	const unsigned int	span = x.step * x.size;
+	for (unsigned int i = 0; i < width; i += x.step, sums += span) {
+		for (unsigned int p = 0; p < x.step; p++) {
+			unsigned int	sum = 0;
+			for (unsigned int k = p; k < span; k += x.step) {
+				sum += sums[k];
+			}
+			if (divisor > 1) {
+				sum = (sum + half) / divisor;
+			}
+			row[i + p] = (sum > maxpixel) ? maxpixel : sum;
+		}
+	}
+}
+
+/**
+ * \brief Work item binning a band of rows of the result
+ */
+template<typename Pixel>
+class binningwork : public ParallelWork {
+	const ImageView&	_view;
+	Image<Pixel>&	_image;
+	binaxis	_x;
+	binaxis	_y;
+	unsigned int	_divisor;
+	unsigned int	_bands;
+	accumulate16_kernel	_accumulate;
+public:
+	binningwork(const ImageView& view, Image<Pixel>& image,
+		const binaxis& x, const binaxis& y, unsigned int divisor,
+		unsigned int bands)
+		: _view(view), _image(image), _x(x), _y(y),
+		  _divisor(divisor), _bands(bands),
+		  _accumulate(accumulate16_select()) { }
+	virtual void	run(unsigned int band);
+};
+
+/**
+ * \brief Compute one of the bands of rows
+ *
+ * Only the columns of the view that end up in a bin are accumulated.
+ */
+template<typename Pixel>
+void	binningwork<Pixel>::run(unsigned int band) {
+	unsigned int	w = _image.width();
+	unsigned int	h = _image.height();
+	unsigned int	first = (h * band) / _bands;
+	unsigned int	last = (h * (band + 1)) / _bands;
+	TraceSpan	span("binningband", band);
+	unsigned int	columns = (w / _x.step) * _x.step * _x.size;
+	std::vector<unsigned int>	sums(columns);
+	for (unsigned int y = first; y < last; y++) {
+		memset(&sums[0], 0, columns * sizeof(unsigned int));
+		for (unsigned int k = 0; k < _y.size; k++) {
+			const unsigned short	*from
+				= _view.rowpointer(_y.first(y) + k * _y.step);
+			if (_accumulate) {
+				_accumulate(&sums[0], from, columns);
+			} else {
+				for (unsigned int i = 0; i < columns; i++) {
+					sums[i] += from[i];
+				}
+			}
+		}
+		binrow(_image.pixelbuffer() + y * (unsigned long)w, w,
+			&sums[0], _x, _divisor);
+	}
+}
+
+/**
+ * \brief Create a software binning for a binning mode
+ *
+ * The bins must not contain more than 65536 pixels, so that their sums
+ * fit into 32 bits.
+ */
+SoftwareBinning::SoftwareBinning(const BinningMode& mode,
+	enum Combine combine, bool bayer)
+	: _mode(mode), _combine(combine), _bayer(bayer),
+	  _runner(new BandRunner("binning")) {
+	if ((mode.x() < 1) || (mode.y() < 1)) {
+		throw std::range_error("bad binning mode");
+	}
+	if ((unsigned long)mode.x() * mode.y() > 65536) {
+		throw std::range_error("binning mode too large");
+	}
+}
+
+/**
+ * \brief The number of threads computing bands of rows
+ */
+unsigned int	SoftwareBinning::threads() const {
+	return _runner->threads();
+}
+
+void	SoftwareBinning::threads(unsigned int threads) {
+	_runner->threads(threads);
+}
+
+/**
+ * \brief Size of the binned image of a view of some size
+ */
+ImageSize	SoftwareBinning::binnedsize(const ImageSize& size) const {
+	binaxis	x(_mode.x(), _bayer);
+	binaxis	y(_mode.y(), _bayer);
+	return ImageSize(x.binned(size.width()), y.binned(size.height()));
+}
+
+/**
+ * \brief Bin the pixels of a view into an image of the binned size
+ */
+template<typename Pixel>
+void	SoftwareBinning::bin(const ImageView& view, Image<Pixel>& image) {
+	TraceSpan	span("binning");
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "binning %u x %u image %dx%d%s",
+		view.width(), view.height(), _mode.x(), _mode.y(),
+		(_bayer) ? " by color" : "");
+	binaxis	x(_mode.x(), _bayer);
+	binaxis	y(_mode.y(), _bayer);
+	unsigned int	divisor = (_combine == Average)
+					? _mode.x() * _mode.y() : 1;
+	unsigned int	bands = _runner->bands(image.height());
+	binningwork<Pixel>	work(view, image, x, y, divisor, bands);
+	_runner->run(bands, work);
+}
+
+/**
+ * \brief Bin a view into an image with 16 bit pixels
+ *
+ * Sums larger than 65535 saturate.
+ */
+ImageBufferPtr	SoftwareBinning::binned(const ImageView& view) {
+	ImageBufferPtr	image(new ImageBuffer(binnedsize(view.size())));
+	image->metrics(view.image()->metrics());
+	bin(view, *image);
+	return image;
+}
+
+/**
+ * \brief Bin a view into an image with 32 bit pixels
+ */
+ImageBuffer32Ptr	SoftwareBinning::binned32(const ImageView& view) {
+	ImageBuffer32Ptr	image(new ImageBuffer32(binnedsize(view.size())));
+	image->metrics(view.image()->metrics());
+	bin(view, *image);
+	return image;
+}
+
+} // namespace qhy
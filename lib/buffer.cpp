@@ -17,16 +17,32 @@ namespace qhy {
 /**
  * \brief Create a buffer of a given name
  */
-Buffer::Buffer(unsigned long l) : _length(l) {
+Buffer::Buffer(unsigned long l) : _length(l), _allocator(NULL), _cookie(0) {
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "allocated %d bytes", l);
 	_data = new unsigned char[l];
 }
 
+/**
+ * \brief Create a buffer with memory from an allocator
+ *
+ * The allocator must outlive the buffer.
+ */
+Buffer::Buffer(unsigned long l, BufferAllocator *allocator) : _length(l),
+	_allocator(allocator), _cookie(0) {
+	_data = _allocator->allocate(l, _cookie);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "allocated %lu bytes, kind %d",
+		l, _cookie);
+}
+
 /**
  * \brief Destroy a buffer
  */
 Buffer::~Buffer() {
-	delete[] _data;
+	if (_allocator) {
+		_allocator->release(_data, _length, _cookie);
+	} else {
+		delete[] _data;
+	}
 }
 
 /**
@@ -66,6 +82,7 @@ unsigned char&	Buffer::operator[](unsigned int i) {
  */
 BufferPointer::BufferPointer(Buffer& buffer) : _buffer(buffer) {
 	_offset = 0;
+	_reserved = 0;
 }
 
 /**
@@ -78,10 +95,11 @@ void	BufferPointer::append(unsigned char *newdata, unsigned long datalength) {
 	if ((datalength + _offset) > _buffer.length()) {
 		throw std::runtime_error("buffer too small");
 	}
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "append %lu bytes at offset %lu",
-		datalength, _offset);
 	memcpy(_buffer.data() + _offset, newdata, datalength);
 	_offset += datalength;
+	if (_reserved < _offset) {
+		_reserved = _offset;
+	}
 }
 
 /**
@@ -98,4 +116,43 @@ void	BufferPointer::append(Buffer& buffer, unsigned long datalength) {
 	append(buffer.data(), datalength);
 }
 
+/**
+ * \brief Reserve a region of the buffer to receive data in place
+ *
+ * Regions are handed out consecutively after the regions reserved
+ * previously, so that several regions can be filled concurrently.
+ * \param datalength	the maximum number of bytes that will be written
+ *			to the region
+ * \return		pointer to the start of the reserved region
+ */
+unsigned char	*BufferPointer::reserve(unsigned long datalength) {
+	if ((datalength + _reserved) > _buffer.length()) {
+		throw std::runtime_error("buffer too small");
+	}
+	unsigned char	*result = _buffer.data() + _reserved;
+	_reserved += datalength;
+	return result;
+}
+
+/**
+ * \brief Account for data received in a reserved region
+ *
+ * Regions have to be committed in the order they were reserved. If a
+ * previous region received less data than reserved, the data is moved
+ * down so that the buffer contents remain contiguous. In the normal case
+ * the data already is at the current offset, and nothing is copied.
+ * \param data		the start of the region as returned by reserve()
+ * \param datalength	the number of bytes actually received
+ */
+void	BufferPointer::commit(unsigned char *data, unsigned long datalength) {
+	if ((datalength + _offset) > _buffer.length()) {
+		throw std::runtime_error("buffer too small");
+	}
+	unsigned char	*target = _buffer.data() + _offset;
+	if (data != target) {
+		memmove(target, data, datalength);
+	}
+	_offset += datalength;
+}
+
 } // namespace qhy
@@ -0,0 +1,317 @@
+/*
+ * bufferpool.cpp -- recycling of raw data and image buffers
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <bufferpool.h>
+#include <qhydebug.h>
+#include <cstdio>
+#include <new>
+
+namespace qhy {
+
+/**
+ * \brief Create empty statistics
+ */
+BufferPoolStatistics::BufferPoolStatistics() : hits(0), misses(0),
+	recycled(0), evicted(0), outstanding(0), available(0), bytes(0) {
+}
+
+/**
+ * \brief Convert the pool statistics to a string
+ */
+std::string	BufferPoolStatistics::toString() const {
+	char	buffer[256];
+	snprintf(buffer, sizeof(buffer),
+		"%lu hits, %lu misses, %lu recycled, %lu evicted, "
+		"%lu outstanding, %lu available (%lu bytes)",
+		hits, misses, recycled, evicted, outstanding, available, bytes);
+	return std::string(buffer);
+}
+
+/**
+ * \brief Cache for the control blocks of pooled image pointers
+ *
+ * All control blocks created by the pool have the same size, so a
+ * simple free list suffices.
+ */
+class blockcache {
+	std::mutex	_mutex;
+	size_t	_blocksize;
+	std::vector<void *>	_blocks;
+	static const unsigned int	maxblocks = 64;
+public:
+	blockcache() : _blocksize(0) {
+		_blocks.reserve(maxblocks);
+	}
+	~blockcache() {
+		for (unsigned int i = 0; i < _blocks.size(); i++) {
+			::operator delete(_blocks[i]);
+		}
+	}
+	void	*allocate(size_t size) {
+		{
+			std::unique_lock<std::mutex>	lock(_mutex);
+			if (0 == _blocksize) {
+				_blocksize = size;
+			}
+			if ((size == _blocksize) && (_blocks.size() > 0)) {
+				void	*block = _blocks.back();
+				_blocks.pop_back();
+				return block;
+			}
+		}
+		return ::operator new(size);
+	}
+	void	deallocate(void *block, size_t size) {
+		{
+			std::unique_lock<std::mutex>	lock(_mutex);
+			if ((size == _blocksize) && (_blocks.size() < maxblocks)) {
+				_blocks.push_back(block);
+				return;
+			}
+		}
+		::operator delete(block);
+	}
+};
+
+/**
+ * \brief Allocator for the control blocks of pooled image pointers
+ *
+ * The allocator keeps the block cache alive, because the control block
+ * of the last image pointer is deallocated after the deleter, and with
+ * it possibly the pool, has been destroyed.
+ */
+template<typename T>
+class blockallocator {
+public:
+	typedef T	value_type;
+	std::shared_ptr<blockcache>	cache;
+	blockallocator(std::shared_ptr<blockcache> c) : cache(c) { }
+	template<typename U>
+	blockallocator(const blockallocator<U>& other) : cache(other.cache) { }
+	T	*allocate(size_t n) {
+		return (T *)cache->allocate(n * sizeof(T));
+	}
+	void	deallocate(T *p, size_t n) {
+		cache->deallocate(p, n * sizeof(T));
+	}
+	template<typename U>
+	bool	operator==(const blockallocator<U>& other) const {
+		return cache == other.cache;
+	}
+	template<typename U>
+	bool	operator!=(const blockallocator<U>& other) const {
+		return cache != other.cache;
+	}
+};
+
+/**
+ * \brief Deleter returning image buffers to their pool
+ */
+class imagerecycler {
+	BufferPoolPtr	_pool;
+public:
+	imagerecycler(BufferPoolPtr pool) : _pool(pool) { }
+	void	operator()(ImageBuffer *image) const {
+		_pool->recycle(image);
+	}
+};
+
+/**
+ * \brief Create an empty pool
+ */
+BufferPool::BufferPool(unsigned int capacity) : _capacity(0),
+	_blocks(new blockcache()) {
+	this->capacity(capacity);
+}
+
+/**
+ * \brief Free all unused buffers
+ *
+ * Buffers still handed out keep the pool alive, so there are none
+ * when the pool is destroyed.
+ */
+BufferPool::~BufferPool() {
+	for (unsigned int i = 0; i < _raw.size(); i++) {
+		delete _raw[i];
+	}
+	for (unsigned int i = 0; i < _images.size(); i++) {
+		delete _images[i];
+	}
+}
+
+/**
+ * \brief Free the oldest unused buffers beyond the capacity
+ *
+ * Must be called with the mutex held.
+ */
+void	BufferPool::trim() {
+	while (_raw.size() > _capacity) {
+		_statistics.bytes -= _raw.front()->length();
+		delete _raw.front();
+		_raw.erase(_raw.begin());
+		_statistics.evicted++;
+	}
+	while (_images.size() > _capacity) {
+		_statistics.bytes -= _images.front()->size();
+		delete _images.front();
+		_images.erase(_images.begin());
+		_statistics.evicted++;
+	}
+	_statistics.available = _raw.size() + _images.size();
+}
+
+/**
+ * \brief Change the number of unused buffers kept of each kind
+ */
+void	BufferPool::capacity(unsigned int capacity) {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	if (capacity == _capacity) {
+		return;
+	}
+	_capacity = capacity;
+	_raw.reserve(_capacity + 1);
+	_images.reserve(_capacity + 1);
+	trim();
+}
+
+/**
+ * \brief Get a raw data buffer of a given length
+ *
+ * The buffer must be returned with release().
+ * \param allocator	the allocator for the memory of the buffer, NULL for
+ *			the heap, it must outlive the buffers in the pool
+ */
+Buffer	*BufferPool::rawbuffer(unsigned long length,
+		BufferAllocator *allocator) {
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		for (unsigned int i = _raw.size(); i > 0; i--) {
+			Buffer	*buffer = _raw[i - 1];
+			if ((buffer->length() == length)
+				&& (buffer->allocator() == allocator)) {
+				_raw.erase(_raw.begin() + (i - 1));
+				_statistics.bytes -= length;
+				_statistics.available--;
+				_statistics.outstanding++;
+				_statistics.hits++;
+				return buffer;
+			}
+		}
+		_statistics.misses++;
+		_statistics.outstanding++;
+	}
+	try {
+		if (allocator) {
+			return new Buffer(length, allocator);
+		}
+		return new Buffer(length);
+	} catch (...) {
+		std::unique_lock<std::mutex>	lock(_mutex);
+		_statistics.outstanding--;
+		throw;
+	}
+}
+
+/**
+ * \brief Return a raw data buffer to the pool
+ */
+void	BufferPool::release(Buffer *buffer) {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	_raw.push_back(buffer);
+	_statistics.bytes += buffer->length();
+	_statistics.outstanding--;
+	_statistics.recycled++;
+	trim();
+}
+
+/**
+ * \brief Free all unused raw data buffers
+ *
+ * This is needed when the memory of the buffers has to be allocated
+ * differently, or when their allocator goes away.
+ */
+void	BufferPool::flushraw() {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	for (unsigned int i = 0; i < _raw.size(); i++) {
+		_statistics.bytes -= _raw[i]->length();
+		delete _raw[i];
+		_statistics.evicted++;
+	}
+	_raw.clear();
+	_statistics.available = _images.size();
+}
+
+/**
+ * \brief Get an image buffer of a given size
+ *
+ * The buffer returns to the pool when the last pointer to it is gone.
+ * Recycled buffers come without active area, metrics and statistics,
+ * like a newly allocated buffer, but the pixel values are undefined.
+ */
+ImageBufferPtr	BufferPool::imagebuffer(const ImageSize& size) {
+	ImageBuffer	*image = NULL;
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		for (unsigned int i = _images.size(); i > 0; i--) {
+			ImageBuffer	*candidate = _images[i - 1];
+			if ((candidate->width() == (unsigned int)size.width())
+				&& (candidate->height()
+					== (unsigned int)size.height())) {
+				_images.erase(_images.begin() + (i - 1));
+				_statistics.bytes -= candidate->size();
+				_statistics.available--;
+				_statistics.hits++;
+				image = candidate;
+				break;
+			}
+		}
+		if (NULL == image) {
+			_statistics.misses++;
+		}
+		_statistics.outstanding++;
+	}
+	if (NULL == image) {
+		try {
+			image = new ImageBuffer(size);
+		} catch (...) {
+			std::unique_lock<std::mutex>	lock(_mutex);
+			_statistics.outstanding--;
+			throw;
+		}
+	} else {
+		image->active(ImageRectangle());
+		image->metrics(FrameMetrics());
+		image->statistics(FrameStatisticsPtr());
+	}
+	// if the control block cannot be allocated, the shared pointer
+	// hands the image to the deleter, so it is never lost
+	return ImageBufferPtr(image, imagerecycler(shared_from_this()),
+		blockallocator<ImageBuffer>(_blocks));
+}
+
+/**
+ * \brief Return an image buffer to the pool
+ */
+void	BufferPool::recycle(ImageBuffer *image) {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	_images.push_back(image);
+	_statistics.bytes += image->size();
+	_statistics.outstanding--;
+	_statistics.recycled++;
+	trim();
+}
+
+/**
+ * \brief Get a snapshot of the pool statistics
+ */
+BufferPoolStatistics	BufferPool::statistics() const {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	return _statistics;
+}
+
+} // namespace qhy
@@ -0,0 +1,263 @@
+/*
+ * calibration.cpp -- bias, dark and flat field correction
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <threadpool.h>
+#include <tracing.h>
+#include <demux.h>
+#include <stdexcept>
+
+namespace qhy {
+
+/**
+ * \brief Calibrate pixels to 16 bits
+ *
+ * The kernels also handle the scalar case, so that the clamping and
+ * rounding are defined in a single place.
+ */
+static void	calibratepixels(unsigned short *to, const unsigned short *from,
+			const float *offset, const float *gain,
+			unsigned long n) {
+	calibrate16_select(offset, gain)(to, from, offset, gain, n);
+}
+
+/**
+ * \brief Calibrate pixels to floating point
+ */
+static void	calibratepixels(float *to, const unsigned short *from,
+			const float *offset, const float *gain,
+			unsigned long n) {
+	calibratefloat_select(offset, gain)(to, from, offset, gain, n);
+}
+
+/**
+ * \brief Work item calibrating a band of rows
+ *
+ * Offset and gain are NULL if there is no master providing them.
+ */
+template<typename Pixel>
+class calibrationwork : public ParallelWork {
+	const ImageBuffer&	_from;
+	Image<Pixel>&	_to;
+	const float	*_offset;
+	const float	*_gain;
+	unsigned int	_bands;
+public:
+	calibrationwork(const ImageBuffer& from, Image<Pixel>& to,
+		const float *offset, const float *gain, unsigned int bands)
+		: _from(from), _to(to), _offset(offset), _gain(gain),
+		  _bands(bands) { }
+	virtual void	run(unsigned int band) {
+		unsigned int	h = _from.height();
+		unsigned long	w = _from.width();
+		unsigned long	first = w * ((h * band) / _bands);
+		unsigned long	last = w * ((h * (band + 1)) / _bands);
+		TraceSpan	span("calibrationband", band);
+		calibratepixels(_to.pixelbuffer() + first,
+			_from.pixelbuffer() + first,
+			(_offset) ? _offset + first : NULL,
+			(_gain) ? _gain + first : NULL, last - first);
+	}
+};
+
+/**
+ * \brief Reciprocal of the flat, normalized to mean 1
+ *
+ * \return	the reciprocal flat, or NULL if there is no flat
+ */
+static FloatImagePtr	reciprocal(FloatImagePtr flat, FloatImagePtr bias) {
+	if (!flat) {
+		return FloatImagePtr();
+	}
+	unsigned int	n = flat->npixels();
+	FloatImagePtr	result(new FloatImage(flat->width(), flat->height()));
+	float	*d = result->pixelbuffer();
+	double	sum = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		d[i] = flat->pixelbuffer()[i]
+			- ((bias) ? bias->pixelbuffer()[i] : 0.f);
+		sum += d[i];
+	}
+	double	mean = (n) ? (sum / n) : 0;
+	if (mean <= 0) {
+		throw std::runtime_error("flat frame has no signal");
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		d[i] = (d[i] > 0) ? (mean / d[i]) : 1.f;
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "flat frame mean %f", mean);
+	return result;
+}
+
+/**
+ * \brief Create a calibration without any master frames
+ */
+Calibration::Calibration() : _size(0, 0),
+	_runner(new BandRunner("calibration")) {
+}
+
+/**
+ * \brief Check that a new master frame matches the other masters
+ *
+ * \param replaced	the master the new one replaces, it does not count
+ */
+static void	checkmaster(FloatImagePtr master, FloatImagePtr replaced,
+			FloatImagePtr a, FloatImagePtr b) {
+	if (!master) {
+		return;
+	}
+	FloatImagePtr	others[2] = { a, b };
+	for (unsigned int i = 0; i < 2; i++) {
+		if ((!others[i]) || (others[i] == replaced)) {
+			continue;
+		}
+		if ((others[i]->width() != master->width())
+			|| (others[i]->height() != master->height())) {
+			throw std::range_error("master frame sizes do not match");
+		}
+	}
+}
+
+/**
+ * \brief Update the size from the masters, it is empty without masters
+ */
+void	Calibration::updatesize() {
+	FloatImagePtr	masters[3] = { _bias, _dark, _flat };
+	_size = ImageSize(0, 0);
+	for (unsigned int i = 0; i < 3; i++) {
+		if (masters[i]) {
+			_size = ImageSize(masters[i]->width(),
+					masters[i]->height());
+			return;
+		}
+	}
+}
+
+/**
+ * \brief Set the master bias, or remove it with a NULL pointer
+ *
+ * The bias is also subtracted from the flat.
+ */
+void	Calibration::bias(FloatImagePtr bias) {
+	checkmaster(bias, _bias, _dark, _flat);
+	_invflat = reciprocal(_flat, bias);
+	_bias = bias;
+	updatesize();
+}
+
+void	Calibration::bias(const ImageBuffer& bias) {
+	this->bias(floatimage(bias));
+}
+
+/**
+ * \brief Set the master dark, or remove it with a NULL pointer
+ *
+ * Setting a dark does not recompute anything, so darks can be swapped
+ * for every image.
+ */
+void	Calibration::dark(FloatImagePtr dark) {
+	checkmaster(dark, _dark, _bias, _flat);
+	_dark = dark;
+	updatesize();
+}
+
+void	Calibration::dark(const ImageBuffer& dark) {
+	this->dark(floatimage(dark));
+}
+
+/**
+ * \brief Set the master flat, or remove it with a NULL pointer
+ */
+void	Calibration::flat(FloatImagePtr flat) {
+	checkmaster(flat, _flat, _bias, _dark);
+	_invflat = reciprocal(flat, _bias);
+	_flat = flat;
+	updatesize();
+}
+
+void	Calibration::flat(const ImageBuffer& flat) {
+	this->flat(floatimage(flat));
+}
+
+/**
+ * \brief The number of threads computing bands of rows
+ */
+unsigned int	Calibration::threads() const {
+	return _runner->threads();
+}
+
+void	Calibration::threads(unsigned int threads) {
+	_runner->threads(threads);
+}
+
+/**
+ * \brief The values subtracted from the pixels
+ */
+const float	*Calibration::offset() const {
+	if (_dark) {
+		return _dark->pixelbuffer();
+	}
+	if (_bias) {
+		return _bias->pixelbuffer();
+	}
+	return NULL;
+}
+
+/**
+ * \brief Calibrate an image into an image of the same size
+ */
+template<typename Pixel>
+void	Calibration::calibrate(const ImageBuffer& from, Image<Pixel>& to) {
+	TraceSpan	span("calibration");
+	if (_size.empty()) {
+		throw std::logic_error("no master frames for calibration");
+	}
+	if (((int)from.width() != _size.width())
+		|| ((int)from.height() != _size.height())) {
+		throw std::range_error("image size does not match masters");
+	}
+	const float	*g = (_invflat) ? _invflat->pixelbuffer() : NULL;
+	unsigned int	bands = _runner->bands(from.height());
+	calibrationwork<Pixel>	work(from, to, offset(), g, bands);
+	_runner->run(bands, work);
+}
+
+/**
+ * \brief Calibrate an image in place
+ *
+ * The statistics of the image no longer apply, so they are removed.
+ */
+void	Calibration::operator()(ImageBuffer& image) {
+	calibrate(image, image);
+	image.statistics(FrameStatisticsPtr());
+}
+
+/**
+ * \brief Calibrate an image into a new image with 16 bit pixels
+ */
+ImageBufferPtr	Calibration::calibrated(const ImageBuffer& image) {
+	ImageBufferPtr	result(new ImageBuffer(image.width(), image.height()));
+	calibrate(image, *result);
+	result->active(image.active());
+	result->metrics(image.metrics());
+	return result;
+}
+
+/**
+ * \brief Calibrate an image into a new floating point image
+ */
+FloatImagePtr	Calibration::calibratedfloat(const ImageBuffer& image) {
+	FloatImagePtr	result(new FloatImage(image.width(), image.height()));
+	calibrate(image, *result);
+	result->active(image.active());
+	result->metrics(image.metrics());
+	return result;
+}
+
+} // namespace qhy
@@ -4,13 +4,17 @@
  * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
  */
 #include <qhylib.h>
+#include <stdexcept>
 
 namespace qhy {
 
 /**
  * \brief Create a camera object
  */
-Camera::Camera() : size(0, 0), _mode(1, 1), _exposuretime(0) {
+Camera::Camera() : size(0, 0), _mode(1, 1), _exposuretime(0),
+	_queuedepth(8), _pipelined(false), _poolcapacity(4),
+	_framememory(HeapMemory), _lockmemory(false), _demuxthreads(1),
+	_statistics(false) {
 }
 
 /**
@@ -19,4 +23,28 @@ Camera::Camera() : size(0, 0), _mode(1, 1), _exposuretime(0) {
 Camera::~Camera() {
 }
 
+/**
+ * \brief Set the number of bulk transfers kept in flight
+ *
+ * A deeper queue keeps the USB link busy even if the host is slow to
+ * process completed patches, at the price of one patch buffer per
+ * queued transfer.
+ */
+void	Camera::queuedepth(unsigned int depth) {
+	if (depth < 1) {
+		throw std::range_error("queue depth must be at least 1");
+	}
+	_queuedepth = depth;
+}
+
+/**
+ * \brief Set the number of threads used for demultiplexing
+ */
+void	Camera::demuxthreads(unsigned int threads) {
+	if (threads < 1) {
+		throw std::range_error("need at least one demux thread");
+	}
+	_demuxthreads = threads;
+}
+
 } // namespace qhy
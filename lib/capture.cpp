@@ -0,0 +1,100 @@
+/*
+ * capture.cpp -- capture images on several devices concurrently
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <qhylib.h>
+#include <qhydebug.h>
+
+namespace qhy {
+
+/**
+ * \brief main function for the capture threads
+ */
+void	ParallelCapture::job_main(void *arg) {
+	Job	*job = (Job *)arg;
+	job->main();
+}
+
+/**
+ * \brief Expose and read out one image
+ *
+ * Exceptions are kept, so that wait() can rethrow them in the thread
+ * that started the capture.
+ */
+void	ParallelCapture::Job::main() {
+	try {
+		Camera&	camera = device->camera();
+		camera.startExposure();
+		image = camera.getImage();
+	} catch (const std::exception& x) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "capture failed: %s", x.what());
+		error = std::current_exception();
+	} catch (...) {
+		error = std::current_exception();
+	}
+}
+
+/**
+ * \brief Destroy the capture, waiting for threads still running
+ */
+ParallelCapture::~ParallelCapture() {
+	for (unsigned int i = 0; i < jobs.size(); i++) {
+		if (jobs[i]->thread.joinable()) {
+			jobs[i]->thread.join();
+		}
+	}
+}
+
+/**
+ * \brief Add a device to the capture
+ */
+void	ParallelCapture::add(DevicePtr device) {
+	jobs.push_back(std::shared_ptr<Job>(new Job(device)));
+}
+
+/**
+ * \brief Start exposure and readout on all devices
+ */
+void	ParallelCapture::start() {
+	for (unsigned int i = 0; i < jobs.size(); i++) {
+		if (jobs[i]->thread.joinable()) {
+			throw std::runtime_error("capture already running");
+		}
+		jobs[i]->image.reset();
+		jobs[i]->error = std::exception_ptr();
+		jobs[i]->thread = std::thread(job_main, jobs[i].get());
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "capture started on %d devices",
+		(int)jobs.size());
+}
+
+/**
+ * \brief Wait for all devices to deliver their image
+ *
+ * The images are returned in the order the devices were added. If any
+ * of the captures failed, the first failure is rethrown once all threads
+ * have ended.
+ */
+std::vector<ImageBufferPtr>	ParallelCapture::wait() {
+	std::vector<ImageBufferPtr>	images;
+	std::exception_ptr	error;
+	for (unsigned int i = 0; i < jobs.size(); i++) {
+		if (jobs[i]->thread.joinable()) {
+			jobs[i]->thread.join();
+		}
+		if (jobs[i]->error && !error) {
+			error = jobs[i]->error;
+		}
+		images.push_back(jobs[i]->image);
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	return images;
+}
+
+} // namespace qhy
@@ -0,0 +1,62 @@
+/*
+ * colorimage.cpp -- color images produced by debayering
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <stdexcept>
+
+namespace qhy {
+
+/**
+ * \brief Create a color image
+ */
+ColorImage::ColorImage(const ImageSize& size, enum Layout layout)
+	: _size(size), _layout(layout) {
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "allocating color image %d x %d",
+		size.width(), size.height());
+	_pixels = new unsigned short[3 * npixels()];
+}
+
+/**
+ * \brief Destroy a color image
+ */
+ColorImage::~ColorImage() {
+	delete[] _pixels;
+}
+
+/**
+ * \brief Get the pixels of one color of a planar image
+ */
+unsigned short	*ColorImage::plane(enum Color color) const {
+	if (_layout != Planar) {
+		throw std::logic_error("color image is not planar");
+	}
+	return _pixels + color * npixels();
+}
+
+/**
+ * \brief Access one color of a pixel
+ *
+ * If range checking is enabled, this method throws a std::range_error
+ * exception if the pixel coordinates are outside the image.
+ */
+unsigned short	ColorImage::p(unsigned int x, unsigned int y,
+	enum Color color) const {
+#if ENABLE_RANGECHECK
+	if (!((x < width()) && (y < height()))) {
+		throw std::range_error("pixel coordinates outside image");
+	}
+#endif /* ENABLE_RANGECHECK */
+	unsigned long	offset = x + (unsigned long)width() * y;
+	if (_layout == Planar) {
+		return _pixels[color * npixels() + offset];
+	}
+	return _pixels[3 * offset + color];
+}
+
+} // namespace qhy
@@ -0,0 +1,657 @@
+/*
+ * darklibrary.cpp -- persistent library of master darks
+ *
+ * Each master is a file in the library directory consisting of a
+ * darkheader followed by the pixels as floats in host byte order. The
+ * directory is scanned once when the library is opened, only the
+ * headers are read. The pixels are memory mapped and copied into an
+ * image when a master is needed for a dark that is not in the cache.
+ * This happens without holding the lock of the library, the dark is
+ * derived from a snapshot of the masters and parameters.
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif /* HAVE_SYS_MMAN_H */
+
+namespace qhy {
+
+static const char	darkmagic[8] = { 'Q', 'H', 'Y', 'D', 'A', 'R', 'K', '1' };
+static const char	darksuffix[] = ".dark";
+
+/**
+ * \brief Header of a master dark file
+ */
+struct darkheader {
+	char	magic[8];
+	unsigned int	width;
+	unsigned int	height;
+	int	binx;
+	int	biny;
+	double	exposure;
+	double	temperature;
+};
+
+/**
+ * \brief Length of a master dark file including the header
+ */
+static unsigned long	darklength(const ImageSize& size) {
+	return sizeof(darkheader) + size.length() * sizeof(float);
+}
+
+/**
+ * \brief Create an empty description of a master dark
+ */
+DarkMaster::DarkMaster() : mode(1, 1), size(0, 0), exposure(0),
+	temperature(0) {
+}
+
+/**
+ * \brief Human readable description of a master dark
+ */
+std::string	DarkMaster::toString() const {
+	char	buffer[256];
+	snprintf(buffer, sizeof(buffer), "%s: %dx%d, %d x %d, %.3fs, %.1fC",
+		filename.c_str(), mode.x(), mode.y(), size.width(),
+		size.height(), exposure, temperature);
+	return std::string(buffer);
+}
+
+/**
+ * \brief The darks handed out most recently, and the lock of the library
+ *
+ * The mutex protects the masters and parameters of the library as well
+ * as the cache. The generation counts the flushes, a dark derived while
+ * the lock was released is only cached if the masters and parameters
+ * it was derived from are still current.
+ */
+class darkcache {
+public:
+	typedef std::pair<std::string, FloatImagePtr>	entry;
+	typedef std::unordered_map<std::string,
+		std::list<entry>::iterator>	entrymap;
+	std::mutex	mutex;
+	std::list<entry>	recent;		// most recently used first
+	entrymap	entries;
+	unsigned long	hits;
+	unsigned long	misses;
+	unsigned long	generation;
+	darkcache() : hits(0), misses(0), generation(0) { }
+	FloatImagePtr	find(const std::string& key);
+	FloatImagePtr	insert(const std::string& key, FloatImagePtr dark,
+				unsigned int capacity);
+	void	flush();
+	void	trim(unsigned int capacity);
+};
+
+/**
+ * \brief Find a dark in the cache and make it the most recently used
+ *
+ * \return	the dark, or NULL if it is not in the cache
+ */
+FloatImagePtr	darkcache::find(const std::string& key) {
+	entrymap::iterator	i = entries.find(key);
+	if (i == entries.end()) {
+		return FloatImagePtr();
+	}
+	recent.splice(recent.begin(), recent, i->second);
+	return i->second->second;
+}
+
+/**
+ * \brief Add a dark to the cache
+ *
+ * If another thread has added a dark with the same key in the meantime,
+ * that dark is kept, so that all callers share the same one.
+ *
+ * \return	the dark in the cache
+ */
+FloatImagePtr	darkcache::insert(const std::string& key, FloatImagePtr dark,
+			unsigned int capacity) {
+	FloatImagePtr	cached = find(key);
+	if (cached) {
+		return cached;
+	}
+	recent.push_front(entry(key, dark));
+	entries[key] = recent.begin();
+	trim(capacity);
+	return dark;
+}
+
+/**
+ * \brief Forget all cached darks
+ */
+void	darkcache::flush() {
+	entries.clear();
+	recent.clear();
+	generation++;
+}
+
+/**
+ * \brief Drop the least recently used darks beyond the capacity
+ */
+void	darkcache::trim(unsigned int capacity) {
+	while (recent.size() > capacity) {
+		entries.erase(recent.back().first);
+		recent.pop_back();
+	}
+}
+
+/**
+ * \brief Snapshot of the masters and parameters to derive a dark from
+ */
+class darksource {
+	std::string	_directory;
+	std::vector<DarkMaster>	_masters;
+	double	_doubling;
+public:
+	darksource(const std::string& directory,
+		const std::vector<DarkMaster>& masters, double doubling)
+		: _directory(directory), _masters(masters),
+		  _doubling(doubling) { }
+	FloatImagePtr	load(const DarkMaster& master) const;
+	const DarkMaster	*nearest(const BinningMode& mode,
+				const ImageSize& size, double exposure,
+				double temperature, double minexposure,
+				double maxexposure) const;
+	FloatImagePtr	interpolated(const BinningMode& mode,
+				const ImageSize& size, double exposure,
+				double temperature) const;
+	FloatImagePtr	scaled(const BinningMode& mode, const ImageSize& size,
+				double exposure, double temperature) const;
+};
+
+/**
+ * \brief Open a dark library, creating the directory if necessary
+ */
+DarkLibrary::DarkLibrary(const std::string& directory)
+	: _directory(directory), _method(Scaled), _doubling(6.0),
+	  _resolution(0.5), _capacity(8), _cache(new darkcache()) {
+	if ((mkdir(directory.c_str(), 0777) < 0) && (errno != EEXIST)) {
+		throw std::runtime_error(std::string("cannot create dark "
+			"library ") + directory + ": " + strerror(errno));
+	}
+	scan();
+}
+
+/**
+ * \brief Read the headers of all master dark files of the directory
+ *
+ * Files that are not valid master darks are ignored.
+ */
+void	DarkLibrary::scan() {
+	DIR	*dir = opendir(_directory.c_str());
+	if (NULL == dir) {
+		throw std::runtime_error(std::string("cannot open dark "
+			"library ") + _directory + ": " + strerror(errno));
+	}
+	size_t	suffixlength = strlen(darksuffix);
+	struct dirent	*entry;
+	while (NULL != (entry = readdir(dir))) {
+		std::string	name(entry->d_name);
+		if ((name.size() <= suffixlength) || (name.compare(
+			name.size() - suffixlength, suffixlength, darksuffix))) {
+			continue;
+		}
+		std::string	path = _directory + "/" + name;
+		int	fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			continue;
+		}
+		darkheader	header;
+		struct stat	sb;
+		bool	valid = (fstat(fd, &sb) == 0)
+			&& (read(fd, &header, sizeof(header))
+				== (ssize_t)sizeof(header))
+			&& (0 == memcmp(header.magic, darkmagic,
+				sizeof(darkmagic)))
+			&& ((unsigned long)sb.st_size == darklength(
+				ImageSize(header.width, header.height)));
+		close(fd);
+		if (!valid) {
+			qhydebug(LOG_ERR, DEBUG_LOG, 0,
+				"ignoring bad dark file %s", path.c_str());
+			continue;
+		}
+		DarkMaster	master;
+		master.mode = BinningMode(header.binx, header.biny);
+		master.size = ImageSize(header.width, header.height);
+		master.exposure = header.exposure;
+		master.temperature = header.temperature;
+		master.filename = name;
+		_masters.push_back(master);
+		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "master dark %s",
+			master.toString().c_str());
+	}
+	closedir(dir);
+}
+
+/**
+ * \brief Read the pixels of a master dark
+ */
+FloatImagePtr	darksource::load(const DarkMaster& master) const {
+	std::string	path = _directory + "/" + master.filename;
+	int	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("cannot open dark ")
+			+ path + ": " + strerror(errno));
+	}
+	// a file that is shorter than expected would fault when mapped
+	unsigned long	length = darklength(master.size);
+	struct stat	sb;
+	if ((fstat(fd, &sb) < 0) || ((unsigned long)sb.st_size != length)) {
+		close(fd);
+		throw std::runtime_error(std::string("dark file has changed: ")
+			+ path);
+	}
+	FloatImagePtr	image(new FloatImage(master.size));
+#ifdef HAVE_SYS_MMAN_H
+	void	*data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == data) {
+		throw std::runtime_error(std::string("cannot map dark ")
+			+ path + ": " + strerror(errno));
+	}
+	memcpy(image->pixelbuffer(), (const char *)data + sizeof(darkheader),
+		image->size());
+	munmap(data, length);
+#else /* HAVE_SYS_MMAN_H */
+	ssize_t	bytes = pread(fd, image->pixelbuffer(), image->size(),
+				sizeof(darkheader));
+	close(fd);
+	if (bytes != (ssize_t)image->size()) {
+		throw std::runtime_error(std::string("cannot read dark ")
+			+ path);
+	}
+#endif /* HAVE_SYS_MMAN_H */
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "loaded master dark %s",
+		master.toString().c_str());
+	return image;
+}
+
+/**
+ * \brief Distance of a master from an exposure
+ *
+ * Both terms estimate the logarithm of the ratio of the dark currents,
+ * 1 means a factor of two. The offset keeps master biases at a finite
+ * distance.
+ */
+static double	distance(const DarkMaster& master, double exposure,
+			double temperature, double doubling) {
+	return fabs(log2((exposure + 0.001) / (master.exposure + 0.001)))
+		+ fabs(temperature - master.temperature) / doubling;
+}
+
+/**
+ * \brief Find the master closest to an exposure
+ *
+ * Only masters with an exposure time between minexposure and
+ * maxexposure are considered.
+ *
+ * \return	the nearest master, or NULL if there is none
+ */
+const DarkMaster	*darksource::nearest(const BinningMode& mode,
+				const ImageSize& size, double exposure,
+				double temperature, double minexposure,
+				double maxexposure) const {
+	const DarkMaster	*result = NULL;
+	double	best = 0;
+	std::vector<DarkMaster>::const_iterator	i;
+	for (i = _masters.begin(); i != _masters.end(); i++) {
+		if ((i->mode != mode) || (i->size != size)
+			|| (i->exposure < minexposure)
+			|| (i->exposure > maxexposure)) {
+			continue;
+		}
+		double	d = distance(*i, exposure, temperature, _doubling);
+		if ((NULL == result) || (d < best)) {
+			result = &*i;
+			best = d;
+		}
+	}
+	return result;
+}
+
+/**
+ * \brief Dark current of a master scaled to an exposure, plus the bias
+ *
+ * Falls back to the nearest master if there is no master bias or no
+ * master dark with a positive exposure time.
+ */
+FloatImagePtr	darksource::scaled(const BinningMode& mode,
+			const ImageSize& size, double exposure,
+			double temperature) const {
+	const DarkMaster	*bias = nearest(mode, size, 0, temperature, 0, 0);
+	const DarkMaster	*master = nearest(mode, size, exposure,
+		temperature, std::numeric_limits<double>::min(), HUGE_VAL);
+	if ((exposure <= 0) || (NULL == bias) || (NULL == master)) {
+		return load(*nearest(mode, size, exposure, temperature, 0,
+			HUGE_VAL));
+	}
+	float	factor = (exposure / master->exposure)
+		* pow(2., (temperature - master->temperature) / _doubling);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "scaling dark current by %f",
+		factor);
+	FloatImagePtr	result = load(*master);
+	FloatImagePtr	offset = load(*bias);
+	float	*d = result->pixelbuffer();
+	const float	*b = offset->pixelbuffer();
+	for (unsigned int i = 0; i < result->npixels(); i++) {
+		d[i] = b[i] + (d[i] - b[i]) * factor;
+	}
+	return result;
+}
+
+/**
+ * \brief Linear interpolation between the masters bracketing an exposure
+ *
+ * Of all masters with shorter and longer exposure times, the nearest
+ * ones are used, so the masters should have been taken at about the
+ * same temperature. Exposures outside the range of the masters are
+ * scaled.
+ */
+FloatImagePtr	darksource::interpolated(const BinningMode& mode,
+			const ImageSize& size, double exposure,
+			double temperature) const {
+	const DarkMaster	*lower = nearest(mode, size, exposure,
+					temperature, 0, exposure);
+	const DarkMaster	*upper = nearest(mode, size, exposure,
+					temperature, exposure, HUGE_VAL);
+	if ((NULL == lower) || (NULL == upper)) {
+		return scaled(mode, size, exposure, temperature);
+	}
+	if (lower->exposure == exposure) {
+		return load(*lower);
+	}
+	if (upper->exposure == exposure) {
+		return load(*upper);
+	}
+	float	w = (exposure - lower->exposure)
+			/ (upper->exposure - lower->exposure);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "interpolating darks %s and %s, "
+		"weight %f", lower->filename.c_str(), upper->filename.c_str(),
+		w);
+	FloatImagePtr	result = load(*lower);
+	FloatImagePtr	other = load(*upper);
+	float	*d = result->pixelbuffer();
+	const float	*u = other->pixelbuffer();
+	for (unsigned int i = 0; i < result->npixels(); i++) {
+		d[i] = d[i] + (u[i] - d[i]) * w;
+	}
+	return result;
+}
+
+/**
+ * \brief Get a copy of the descriptions of all masters
+ */
+std::vector<DarkMaster>	DarkLibrary::masters() const {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	return _masters;
+}
+
+/**
+ * \brief The method to derive darks from the masters
+ */
+DarkLibrary::Method	DarkLibrary::method() const {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	return _method;
+}
+
+void	DarkLibrary::method(enum Method method) {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	if (method != _method) {
+		_method = method;
+		_cache->flush();
+	}
+}
+
+/**
+ * \brief The temperature difference that doubles the dark current
+ */
+double	DarkLibrary::doubling() const {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	return _doubling;
+}
+
+void	DarkLibrary::doubling(double doubling) {
+	if (doubling <= 0) {
+		throw std::range_error("doubling temperature must be positive");
+	}
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	_doubling = doubling;
+	_cache->flush();
+}
+
+/**
+ * \brief The resolution in degrees of the temperatures of darks
+ */
+double	DarkLibrary::resolution() const {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	return _resolution;
+}
+
+void	DarkLibrary::resolution(double resolution) {
+	if (resolution <= 0) {
+		throw std::range_error("temperature resolution must be "
+			"positive");
+	}
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	_resolution = resolution;
+	_cache->flush();
+}
+
+/**
+ * \brief The number of darks kept in memory
+ */
+unsigned int	DarkLibrary::capacity() const {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	return _capacity;
+}
+
+void	DarkLibrary::capacity(unsigned int capacity) {
+	if (capacity < 1) {
+		throw std::range_error("dark cache needs a capacity");
+	}
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	_capacity = capacity;
+	_cache->trim(_capacity);
+}
+
+/**
+ * \brief Number of darks found in the cache
+ */
+unsigned long	DarkLibrary::hits() const {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	return _cache->hits;
+}
+
+/**
+ * \brief Number of darks that had to be derived from the masters
+ */
+unsigned long	DarkLibrary::misses() const {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	return _cache->misses;
+}
+
+/**
+ * \brief Write all of a block of data to a file
+ */
+static bool	writeall(int fd, const void *data, unsigned long length) {
+	const char	*p = (const char *)data;
+	while (length > 0) {
+		ssize_t	bytes = write(fd, p, length);
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += bytes;
+		length -= bytes;
+	}
+	return true;
+}
+
+/**
+ * \brief Number of temporary files written by this process
+ */
+static std::atomic<unsigned long>	temporaries(0);
+
+/**
+ * \brief Add a master dark to the library
+ *
+ * The master replaces a master with the same binning mode and size,
+ * the same exposure time to the millisecond and the same temperature
+ * to a tenth of a degree. The file is written under a temporary name
+ * and then renamed, so other processes never see a partial master.
+ * The temporary name is unique to the call, so the file is written
+ * without holding the lock, which is only needed to update the list
+ * of masters and to flush the cache.
+ */
+void	DarkLibrary::add(const BinningMode& mode, double exposure,
+		double temperature, const FloatImage& dark) {
+	if (exposure < 0) {
+		throw std::range_error("negative exposure time");
+	}
+	DarkMaster	master;
+	master.mode = mode;
+	master.size = ImageSize(dark.width(), dark.height());
+	master.exposure = exposure;
+	master.temperature = temperature;
+	char	name[128];
+	snprintf(name, sizeof(name), "dark-%dx%d-%dx%d-%.3fs%+.1fC%s",
+		mode.x(), mode.y(), master.size.width(), master.size.height(),
+		exposure, temperature, darksuffix);
+	master.filename = name;
+
+	darkheader	header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, darkmagic, sizeof(darkmagic));
+	header.width = dark.width();
+	header.height = dark.height();
+	header.binx = mode.x();
+	header.biny = mode.y();
+	header.exposure = exposure;
+	header.temperature = temperature;
+
+	std::string	path = _directory + "/" + master.filename;
+	char	suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%d.%lu.tmp", (int)getpid(),
+		temporaries++);
+	std::string	temporary = path + suffix;
+	int	fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("cannot create dark ")
+			+ temporary + ": " + strerror(errno));
+	}
+	bool	written = writeall(fd, &header, sizeof(header))
+			&& writeall(fd, dark.pixelbuffer(), dark.size());
+	if ((close(fd) < 0) || (!written)
+		|| (rename(temporary.c_str(), path.c_str()) < 0)) {
+		int	e = errno;
+		unlink(temporary.c_str());
+		throw std::runtime_error(std::string("cannot write dark ")
+			+ path + ": " + strerror(e));
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "added master dark %s",
+		master.toString().c_str());
+
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	std::vector<DarkMaster>::iterator	i;
+	for (i = _masters.begin(); i != _masters.end(); i++) {
+		if (i->filename == master.filename) {
+			break;
+		}
+	}
+	if (i != _masters.end()) {
+		*i = master;
+	} else {
+		_masters.push_back(master);
+	}
+	// darks derived from the other masters may have changed
+	_cache->flush();
+}
+
+void	DarkLibrary::add(const BinningMode& mode, double exposure,
+		double temperature, const ImageBuffer& dark) {
+	add(mode, exposure, temperature, *floatimage(dark));
+}
+
+/**
+ * \brief Get the dark for an exposure
+ *
+ * The temperature is rounded to the resolution before the dark is
+ * derived, so that all exposures with the same key get the same dark.
+ * A dark in the cache is found with a single hash lookup. Otherwise
+ * the dark is derived from a snapshot of the masters with the lock
+ * released, and only cached if the library has not changed meanwhile.
+ */
+FloatImagePtr	DarkLibrary::dark(const BinningMode& mode, const ImageSize& size,
+			double exposure, double temperature) {
+	std::unique_lock<std::mutex>	lock(_cache->mutex);
+	temperature = _resolution * round(temperature / _resolution);
+	char	key[128];
+	snprintf(key, sizeof(key), "%dx%d %dx%d %.6f %.3f", mode.x(),
+		mode.y(), size.width(), size.height(), exposure, temperature);
+	FloatImagePtr	result = _cache->find(key);
+	if (result) {
+		_cache->hits++;
+		return result;
+	}
+	_cache->misses++;
+	darksource	source(_directory, _masters, _doubling);
+	enum Method	method = _method;
+	unsigned long	generation = _cache->generation;
+	lock.unlock();
+
+	if (NULL == source.nearest(mode, size, exposure, temperature, 0,
+		HUGE_VAL)) {
+		throw std::runtime_error("no master dark for this binning "
+			"mode and image size");
+	}
+	switch (method) {
+	case Nearest:
+		result = source.load(*source.nearest(mode, size, exposure,
+			temperature, 0, HUGE_VAL));
+		break;
+	case Interpolated:
+		result = source.interpolated(mode, size, exposure,
+			temperature);
+		break;
+	case Scaled:
+		result = source.scaled(mode, size, exposure, temperature);
+		break;
+	}
+
+	lock.lock();
+	if (generation != _cache->generation) {
+		return result;
+	}
+	return _cache->insert(key, result, _capacity);
+}
+
+} // namespace qhy
@@ -0,0 +1,766 @@
+/*
+ * debayer.cpp -- conversion of color filter array mosaics
+ *
+ * The kernels compute one row of the color image from the neighbouring
+ * rows of the mosaic. The missing colors of a pixel are taken from one
+ * of a few candidates: the pixel itself, or the average of its
+ * horizontal, vertical, diagonal or all four direct neighbours. Which
+ * candidate gives which color only depends on the parity of the column
+ * within a row, so the vectorized kernels compute all candidates for
+ * eight pixels and blend them with a fixed even/odd mask. Averages round
+ * up like the pavgw instruction, which makes the scalar and the vector
+ * kernels bit identical. Pixels outside the image are mirrored at the
+ * border, which preserves the colors of the pattern.
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <threadpool.h>
+#include <tracing.h>
+#include <demux.h>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DEBAYER_X86	1
+#include <immintrin.h>
+#else
+#define DEBAYER_X86	0
+#endif
+
+namespace qhy {
+
+// colors, in the same order as ColorImage::Color
+#define RED	0
+#define GREEN	1
+#define BLUE	2
+
+// candidates for the colors of a pixel
+#define CANDIDATE_CENTER	0
+#define CANDIDATE_HORIZONTAL	1
+#define CANDIDATE_VERTICAL	2
+#define CANDIDATE_DIAGONAL	3
+#define CANDIDATE_CROSS		4
+
+/**
+ * \brief Colors of the pixels of a row and where to take the others from
+ */
+class rowphase {
+public:
+	unsigned char	color[2];	// color of even and odd pixels
+	unsigned char	select[2][3];	// candidate for each color
+	void	setup(unsigned char even, unsigned char odd);
+	unsigned int	greenparity() const {
+		return (color[0] == GREEN) ? 0 : 1;
+	}
+};
+
+/**
+ * \brief Set up the candidates for a row of the mosaic
+ *
+ * Red and blue pixels get green from the four direct neighbours and the
+ * other color from the diagonal ones. Green pixels get the color of
+ * their row from the horizontal, the third color from the vertical
+ * neighbours.
+ */
+void	rowphase::setup(unsigned char even, unsigned char odd) {
+	color[0] = even;
+	color[1] = odd;
+	for (unsigned int p = 0; p < 2; p++) {
+		unsigned char	c = color[p];
+		if (c == GREEN) {
+			unsigned char	other = color[1 - p];
+			select[p][GREEN] = CANDIDATE_CENTER;
+			select[p][other] = CANDIDATE_HORIZONTAL;
+			select[p][BLUE - other] = CANDIDATE_VERTICAL;
+		} else {
+			select[p][c] = CANDIDATE_CENTER;
+			select[p][GREEN] = CANDIDATE_CROSS;
+			select[p][BLUE - c] = CANDIDATE_DIAGONAL;
+		}
+	}
+}
+
+/**
+ * \brief A color filter pattern at the first pixel of an image
+ */
+class cfapattern {
+public:
+	rowphase	rows[2];
+	// positions of the colors in the 2x2 cell
+	unsigned int	red, blue, green1, green2;
+	cfapattern(const std::string& pattern);
+};
+
+/**
+ * \brief Check the pattern and set up the rows
+ */
+cfapattern::cfapattern(const std::string& pattern) {
+	if ((pattern != "RGGB") && (pattern != "BGGR") && (pattern != "GRBG")
+		&& (pattern != "GBRG")) {
+		throw std::runtime_error("unknown bayer pattern '"
+			+ pattern + "'");
+	}
+	unsigned char	colors[4];
+	bool	first = true;
+	for (unsigned int i = 0; i < 4; i++) {
+		switch (pattern[i]) {
+		case 'R':
+			colors[i] = RED;
+			red = i;
+			break;
+		case 'B':
+			colors[i] = BLUE;
+			blue = i;
+			break;
+		default:
+			colors[i] = GREEN;
+			if (first) {
+				green1 = i;
+				first = false;
+			} else {
+				green2 = i;
+			}
+			break;
+		}
+	}
+	rows[0].setup(colors[0], colors[1]);
+	rows[1].setup(colors[2], colors[3]);
+}
+
+/**
+ * \brief Mirror a coordinate at the borders of the range 0 to n - 1
+ */
+static inline unsigned int	mirror(int i, unsigned int n) {
+	if (i < 0) {
+		return -i;
+	}
+	if (i >= (int)n) {
+		return 2 * n - 2 - i;
+	}
+	return i;
+}
+
+static inline unsigned short	average(unsigned int a, unsigned int b) {
+	return (a + b + 1) >> 1;
+}
+
+static inline unsigned short	absdiff(unsigned short a, unsigned short b) {
+	return (a > b) ? a - b : b - a;
+}
+
+static inline unsigned short	satadd(unsigned int a, unsigned int b) {
+	unsigned int	s = a + b;
+	return (s > 65535) ? 65535 : s;
+}
+
+/**
+ * \brief Add the difference of a color to green to a green value
+ */
+static inline unsigned short	colordiff(int g, int x, int xg) {
+	int	v = g + x - xg;
+	return (v < 0) ? 0 : ((v > 65535) ? 65535 : v);
+}
+
+/**
+ * \brief Neighbourhood of a row of the mosaic
+ *
+ * up2 and down2 are only needed for the gradients of the edge aware
+ * method, gup, gmid and gdown are rows of its green plane.
+ */
+class rowinput {
+public:
+	const unsigned short	*up2, *up, *mid, *down, *down2;
+	const unsigned short	*gup, *gmid, *gdown;
+	unsigned int	width;
+	const rowphase	*phase;
+};
+
+/**
+ * \brief Bilinear interpolation of the pixels x0 to x1 of a row
+ */
+static void	bilinear_pixels(const rowinput& in, unsigned short **out,
+			unsigned int x0, unsigned int x1) {
+	unsigned int	w = in.width;
+	for (unsigned int x = x0; x < x1; x++) {
+		unsigned int	l = mirror((int)x - 1, w);
+		unsigned int	r = mirror((int)x + 1, w);
+		unsigned short	candidate[5];
+		candidate[CANDIDATE_CENTER] = in.mid[x];
+		candidate[CANDIDATE_HORIZONTAL] = average(in.mid[l], in.mid[r]);
+		candidate[CANDIDATE_VERTICAL] = average(in.up[x], in.down[x]);
+		candidate[CANDIDATE_DIAGONAL] = average(
+			average(in.up[l], in.up[r]),
+			average(in.down[l], in.down[r]));
+		candidate[CANDIDATE_CROSS] = average(
+			candidate[CANDIDATE_HORIZONTAL],
+			candidate[CANDIDATE_VERTICAL]);
+		const unsigned char	*s = in.phase->select[x & 1];
+		out[RED][x] = candidate[s[RED]];
+		out[GREEN][x] = candidate[s[GREEN]];
+		out[BLUE][x] = candidate[s[BLUE]];
+	}
+}
+
+/**
+ * \brief Green at the pixels x0 to x1 of a row, along the smaller gradient
+ *
+ * The gradients combine the difference of the neighbours with the
+ * curvature of the color of the pixel itself.
+ */
+static void	green_pixels(const rowinput& in, unsigned short *g,
+			unsigned int x0, unsigned int x1) {
+	unsigned int	w = in.width;
+	for (unsigned int x = x0; x < x1; x++) {
+		if (in.phase->color[x & 1] == GREEN) {
+			g[x] = in.mid[x];
+			continue;
+		}
+		unsigned int	l = mirror((int)x - 1, w);
+		unsigned int	r = mirror((int)x + 1, w);
+		unsigned int	ll = mirror((int)x - 2, w);
+		unsigned int	rr = mirror((int)x + 2, w);
+		unsigned short	h = average(in.mid[l], in.mid[r]);
+		unsigned short	v = average(in.up[x], in.down[x]);
+		unsigned short	dh = satadd(absdiff(in.mid[l], in.mid[r]),
+			absdiff(in.mid[x], average(in.mid[ll], in.mid[rr])));
+		unsigned short	dv = satadd(absdiff(in.up[x], in.down[x]),
+			absdiff(in.mid[x], average(in.up2[x], in.down2[x])));
+		g[x] = (dh < dv) ? h : ((dv < dh) ? v : average(h, v));
+	}
+}
+
+/**
+ * \brief Red and blue at the pixels x0 to x1 from their difference to green
+ */
+static void	colors_pixels(const rowinput& in, unsigned short **out,
+			unsigned int x0, unsigned int x1) {
+	unsigned int	w = in.width;
+	for (unsigned int x = x0; x < x1; x++) {
+		unsigned int	l = mirror((int)x - 1, w);
+		unsigned int	r = mirror((int)x + 1, w);
+		unsigned short	g = in.gmid[x];
+		unsigned short	candidate[4];
+		candidate[CANDIDATE_CENTER] = in.mid[x];
+		candidate[CANDIDATE_HORIZONTAL] = colordiff(g,
+			average(in.mid[l], in.mid[r]),
+			average(in.gmid[l], in.gmid[r]));
+		candidate[CANDIDATE_VERTICAL] = colordiff(g,
+			average(in.up[x], in.down[x]),
+			average(in.gup[x], in.gdown[x]));
+		candidate[CANDIDATE_DIAGONAL] = colordiff(g,
+			average(average(in.up[l], in.up[r]),
+				average(in.down[l], in.down[r])),
+			average(average(in.gup[l], in.gup[r]),
+				average(in.gdown[l], in.gdown[r])));
+		const unsigned char	*s = in.phase->select[x & 1];
+		out[RED][x] = candidate[s[RED]];
+		out[BLUE][x] = candidate[s[BLUE]];
+	}
+}
+
+/**
+ * \brief Combine the 2x2 cells i0 to i1 of two rows into color pixels
+ */
+static void	superpixel_pixels(const unsigned short *row0,
+			const unsigned short *row1, unsigned short **out,
+			const cfapattern& pattern, unsigned int i0,
+			unsigned int i1) {
+	for (unsigned int i = i0; i < i1; i++) {
+		unsigned short	cell[4] = { row0[2 * i], row0[2 * i + 1],
+					row1[2 * i], row1[2 * i + 1] };
+		out[RED][i] = cell[pattern.red];
+		out[GREEN][i] = average(cell[pattern.green1],
+					cell[pattern.green2]);
+		out[BLUE][i] = cell[pattern.blue];
+	}
+}
+
+#if DEBAYER_X86
+
+/*
+ * The vector kernels start at the even pixel 2, so that the first lane
+ * is always even and pixels 1 and 2 to the left are inside the image.
+ * They stop where pixels 2 to the right of the vector would be outside,
+ * and return the first pixel the scalar code has to convert.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i	load_sse2(const unsigned short *p) {
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+/**
+ * \brief Take the even lanes from even, the odd lanes from odd
+ */
+__attribute__((target("sse2")))
+static inline __m128i	blend_sse2(__m128i even, __m128i odd, __m128i evenmask) {
+	return _mm_or_si128(_mm_and_si128(evenmask, even),
+		_mm_andnot_si128(evenmask, odd));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i	absdiff_sse2(__m128i a, __m128i b) {
+	return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+/**
+ * \brief Clamped g + x - xg, computed in 32 bit lanes
+ *
+ * SSE2 has no unsigned saturating pack, so the values are biased into
+ * the range of the signed pack and the bias is removed afterwards.
+ */
+__attribute__((target("sse2")))
+static inline __m128i	colordiff_sse2(__m128i g, __m128i x, __m128i xg) {
+	const __m128i	zero = _mm_setzero_si128();
+	const __m128i	bias = _mm_set1_epi32(32768);
+	__m128i	lo = _mm_sub_epi32(_mm_add_epi32(_mm_unpacklo_epi16(g, zero),
+			_mm_unpacklo_epi16(x, zero)),
+		_mm_add_epi32(_mm_unpacklo_epi16(xg, zero), bias));
+	__m128i	hi = _mm_sub_epi32(_mm_add_epi32(_mm_unpackhi_epi16(g, zero),
+			_mm_unpackhi_epi16(x, zero)),
+		_mm_add_epi32(_mm_unpackhi_epi16(xg, zero), bias));
+	return _mm_xor_si128(_mm_packs_epi32(lo, hi),
+		_mm_set1_epi16((short)0x8000));
+}
+
+/**
+ * \brief SSE2 bilinear interpolation, 8 pixels per iteration
+ */
+__attribute__((target("sse2")))
+static unsigned int	bilinear_sse2(const rowinput& in, unsigned short **out) {
+	const __m128i	evenmask = _mm_set1_epi32(0xffff);
+	const unsigned char	*se = in.phase->select[0];
+	const unsigned char	*so = in.phase->select[1];
+	unsigned int	x = 2;
+	for (; x + 10 <= in.width; x += 8) {
+		__m128i	candidate[5];
+		candidate[CANDIDATE_CENTER] = load_sse2(in.mid + x);
+		candidate[CANDIDATE_HORIZONTAL] = _mm_avg_epu16(
+			load_sse2(in.mid + x - 1), load_sse2(in.mid + x + 1));
+		candidate[CANDIDATE_VERTICAL] = _mm_avg_epu16(
+			load_sse2(in.up + x), load_sse2(in.down + x));
+		candidate[CANDIDATE_DIAGONAL] = _mm_avg_epu16(
+			_mm_avg_epu16(load_sse2(in.up + x - 1),
+				load_sse2(in.up + x + 1)),
+			_mm_avg_epu16(load_sse2(in.down + x - 1),
+				load_sse2(in.down + x + 1)));
+		candidate[CANDIDATE_CROSS] = _mm_avg_epu16(
+			candidate[CANDIDATE_HORIZONTAL],
+			candidate[CANDIDATE_VERTICAL]);
+		for (unsigned int c = RED; c <= BLUE; c++) {
+			_mm_storeu_si128((__m128i *)(out[c] + x),
+				blend_sse2(candidate[se[c]], candidate[so[c]],
+					evenmask));
+		}
+	}
+	return x;
+}
+
+/**
+ * \brief SSE2 green interpolation along the smaller gradient
+ */
+__attribute__((target("sse2")))
+static unsigned int	green_sse2(const rowinput& in, unsigned short *g) {
+	const __m128i	zero = _mm_setzero_si128();
+	const __m128i	greenmask = (in.phase->greenparity() == 0)
+				? _mm_set1_epi32(0xffff)
+				: _mm_set1_epi32(0xffff0000);
+	unsigned int	x = 2;
+	for (; x + 10 <= in.width; x += 8) {
+		__m128i	c = load_sse2(in.mid + x);
+		__m128i	ml = load_sse2(in.mid + x - 1);
+		__m128i	mr = load_sse2(in.mid + x + 1);
+		__m128i	u = load_sse2(in.up + x);
+		__m128i	d = load_sse2(in.down + x);
+		__m128i	h = _mm_avg_epu16(ml, mr);
+		__m128i	v = _mm_avg_epu16(u, d);
+		__m128i	dh = _mm_adds_epu16(absdiff_sse2(ml, mr),
+			absdiff_sse2(c, _mm_avg_epu16(load_sse2(in.mid + x - 2),
+				load_sse2(in.mid + x + 2))));
+		__m128i	dv = _mm_adds_epu16(absdiff_sse2(u, d),
+			absdiff_sse2(c, _mm_avg_epu16(load_sse2(in.up2 + x),
+				load_sse2(in.down2 + x))));
+		// dv <= dh, and dh <= dv
+		__m128i	vfirst = _mm_cmpeq_epi16(_mm_subs_epu16(dv, dh), zero);
+		__m128i	hfirst = _mm_cmpeq_epi16(_mm_subs_epu16(dh, dv), zero);
+		__m128i	vertical = _mm_or_si128(_mm_andnot_si128(hfirst, v),
+			_mm_and_si128(hfirst, _mm_avg_epu16(h, v)));
+		__m128i	green = _mm_or_si128(_mm_andnot_si128(vfirst, h),
+			_mm_and_si128(vfirst, vertical));
+		_mm_storeu_si128((__m128i *)(g + x),
+			blend_sse2(c, green, greenmask));
+	}
+	return x;
+}
+
+/**
+ * \brief SSE2 red and blue from their difference to green
+ */
+__attribute__((target("sse2")))
+static unsigned int	colors_sse2(const rowinput& in, unsigned short **out) {
+	const __m128i	evenmask = _mm_set1_epi32(0xffff);
+	const unsigned char	*se = in.phase->select[0];
+	const unsigned char	*so = in.phase->select[1];
+	unsigned int	x = 2;
+	for (; x + 10 <= in.width; x += 8) {
+		__m128i	g = load_sse2(in.gmid + x);
+		__m128i	candidate[4];
+		candidate[CANDIDATE_CENTER] = load_sse2(in.mid + x);
+		candidate[CANDIDATE_HORIZONTAL] = colordiff_sse2(g,
+			_mm_avg_epu16(load_sse2(in.mid + x - 1),
+				load_sse2(in.mid + x + 1)),
+			_mm_avg_epu16(load_sse2(in.gmid + x - 1),
+				load_sse2(in.gmid + x + 1)));
+		candidate[CANDIDATE_VERTICAL] = colordiff_sse2(g,
+			_mm_avg_epu16(load_sse2(in.up + x),
+				load_sse2(in.down + x)),
+			_mm_avg_epu16(load_sse2(in.gup + x),
+				load_sse2(in.gdown + x)));
+		candidate[CANDIDATE_DIAGONAL] = colordiff_sse2(g,
+			_mm_avg_epu16(_mm_avg_epu16(load_sse2(in.up + x - 1),
+					load_sse2(in.up + x + 1)),
+				_mm_avg_epu16(load_sse2(in.down + x - 1),
+					load_sse2(in.down + x + 1))),
+			_mm_avg_epu16(_mm_avg_epu16(load_sse2(in.gup + x - 1),
+					load_sse2(in.gup + x + 1)),
+				_mm_avg_epu16(load_sse2(in.gdown + x - 1),
+					load_sse2(in.gdown + x + 1))));
+		_mm_storeu_si128((__m128i *)(out[RED] + x),
+			blend_sse2(candidate[se[RED]], candidate[so[RED]],
+				evenmask));
+		_mm_storeu_si128((__m128i *)(out[BLUE] + x),
+			blend_sse2(candidate[se[BLUE]], candidate[so[BLUE]],
+				evenmask));
+	}
+	return x;
+}
+
+/**
+ * \brief Separate the even and the odd words of two vectors
+ */
+__attribute__((target("sse2")))
+static inline void	deinterleave_sse2(__m128i a, __m128i b, __m128i& even,
+				__m128i& odd) {
+	a = _mm_shufflelo_epi16(a, _MM_SHUFFLE(3, 1, 2, 0));
+	a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 1, 2, 0));
+	a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+	b = _mm_shufflelo_epi16(b, _MM_SHUFFLE(3, 1, 2, 0));
+	b = _mm_shufflehi_epi16(b, _MM_SHUFFLE(3, 1, 2, 0));
+	b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+	even = _mm_unpacklo_epi64(a, b);
+	odd = _mm_unpackhi_epi64(a, b);
+}
+
+/**
+ * \brief SSE2 superpixels, 8 cells per iteration
+ */
+__attribute__((target("sse2")))
+static unsigned int	superpixel_sse2(const unsigned short *row0,
+			const unsigned short *row1, unsigned short **out,
+			const cfapattern& pattern, unsigned int cells) {
+	unsigned int	i = 0;
+	for (; i + 8 <= cells; i += 8) {
+		__m128i	cell[4];
+		deinterleave_sse2(load_sse2(row0 + 2 * i),
+			load_sse2(row0 + 2 * i + 8), cell[0], cell[1]);
+		deinterleave_sse2(load_sse2(row1 + 2 * i),
+			load_sse2(row1 + 2 * i + 8), cell[2], cell[3]);
+		_mm_storeu_si128((__m128i *)(out[RED] + i), cell[pattern.red]);
+		_mm_storeu_si128((__m128i *)(out[GREEN] + i),
+			_mm_avg_epu16(cell[pattern.green1],
+				cell[pattern.green2]));
+		_mm_storeu_si128((__m128i *)(out[BLUE] + i), cell[pattern.blue]);
+	}
+	return i;
+}
+
+#endif /* DEBAYER_X86 */
+
+/**
+ * \brief Whether the vectorized kernels can be used
+ *
+ * The kernels follow the instruction set limit of the demultiplexing
+ * code, so that both can be compared against the scalar code.
+ */
+static bool	debayer_vector() {
+#if DEBAYER_X86
+	return demux_level() >= DEMUX_SSE2;
+#else
+	return false;
+#endif /* DEBAYER_X86 */
+}
+
+static void	bilinear_row(const rowinput& in, unsigned short **out,
+			bool vector) {
+	unsigned int	x = 0;
+#if DEBAYER_X86
+	if (vector) {
+		bilinear_pixels(in, out, 0, 2);
+		x = bilinear_sse2(in, out);
+	}
+#endif /* DEBAYER_X86 */
+	bilinear_pixels(in, out, x, in.width);
+}
+
+static void	green_row(const rowinput& in, unsigned short *g, bool vector) {
+	unsigned int	x = 0;
+#if DEBAYER_X86
+	if (vector) {
+		green_pixels(in, g, 0, 2);
+		x = green_sse2(in, g);
+	}
+#endif /* DEBAYER_X86 */
+	green_pixels(in, g, x, in.width);
+}
+
+static void	colors_row(const rowinput& in, unsigned short **out,
+			bool vector) {
+	unsigned int	x = 0;
+#if DEBAYER_X86
+	if (vector) {
+		colors_pixels(in, out, 0, 2);
+		x = colors_sse2(in, out);
+	}
+#endif /* DEBAYER_X86 */
+	colors_pixels(in, out, x, in.width);
+}
+
+static void	superpixel_row(const unsigned short *row0,
+			const unsigned short *row1, unsigned short **out,
+			const cfapattern& pattern, unsigned int cells,
+			bool vector) {
+	unsigned int	i = 0;
+#if DEBAYER_X86
+	if (vector) {
+		i = superpixel_sse2(row0, row1, out, pattern, cells);
+	}
+#endif /* DEBAYER_X86 */
+	superpixel_pixels(row0, row1, out, pattern, i, cells);
+}
+
+/**
+ * \brief Interleave three color rows into red, green, blue triples
+ */
+static void	interleave(unsigned short *to, unsigned short **from,
+			unsigned int width) {
+	for (unsigned int x = 0; x < width; x++) {
+		to[3 * x] = from[RED][x];
+		to[3 * x + 1] = from[GREEN][x];
+		to[3 * x + 2] = from[BLUE][x];
+	}
+}
+
+/**
+ * \brief Work item debayering a band of rows
+ *
+ * The edge aware method needs two passes, as the colors depend on
+ * the green values of the neighbouring rows.
+ */
+class debayerwork : public ParallelWork {
+	const ImageView&	_view;
+	ColorImage&	_image;
+	const cfapattern&	_pattern;
+	enum Debayer::Method	_method;
+	unsigned short	*_green;
+	unsigned int	_bands;
+	bool	_vector;
+	bool	_greenpass;
+	const unsigned short	*mosaic(int y) const {
+		return _view.rowpointer(mirror(y, _view.height()));
+	}
+	const unsigned short	*green(int y) const {
+		return _green + mirror(y, _view.height())
+			* (unsigned long)_view.width();
+	}
+	void	row(unsigned int y, unsigned short **out);
+public:
+	debayerwork(const ImageView& view, ColorImage& image,
+		const cfapattern& pattern, enum Debayer::Method method,
+		unsigned short *green, unsigned int bands)
+		: _view(view), _image(image), _pattern(pattern),
+		  _method(method), _green(green), _bands(bands),
+		  _vector(debayer_vector()), _greenpass(false) { }
+	void	greenpass(bool g) { _greenpass = g; }
+	virtual void	run(unsigned int band);
+};
+
+/**
+ * \brief Compute one row of the color image
+ *
+ * \param out	the rows of the three colors to write
+ */
+void	debayerwork::row(unsigned int y, unsigned short **out) {
+	if (_method == Debayer::Superpixel) {
+		superpixel_row(mosaic(2 * y), mosaic(2 * y + 1), out, _pattern,
+			_image.width(), _vector);
+		return;
+	}
+	rowinput	in;
+	in.up2 = mosaic((int)y - 2);
+	in.up = mosaic((int)y - 1);
+	in.mid = mosaic(y);
+	in.down = mosaic(y + 1);
+	in.down2 = mosaic(y + 2);
+	in.width = _view.width();
+	in.phase = &_pattern.rows[y & 1];
+	if (_method == Debayer::Bilinear) {
+		bilinear_row(in, out, _vector);
+		return;
+	}
+	if (_greenpass) {
+		green_row(in, out[GREEN], _vector);
+		return;
+	}
+	in.gup = green((int)y - 1);
+	in.gmid = green(y);
+	in.gdown = green(y + 1);
+	colors_row(in, out, _vector);
+}
+
+/**
+ * \brief Compute one of the bands of rows
+ *
+ * Interleaved images are computed as rows of three planes first.
+ */
+void	debayerwork::run(unsigned int band) {
+	unsigned int	w = _image.width();
+	unsigned int	h = _image.height();
+	unsigned int	first = (h * band) / _bands;
+	unsigned int	last = (h * (band + 1)) / _bands;
+	TraceSpan	span("debayerband", band);
+	bool	planar = (_image.layout() == ColorImage::Planar);
+	std::vector<unsigned short>	scratch;
+	if (!planar) {
+		scratch.resize(3 * w);
+	}
+	for (unsigned int y = first; y < last; y++) {
+		unsigned long	offset = y * (unsigned long)w;
+		unsigned short	*out[3];
+		for (unsigned int c = RED; c <= BLUE; c++) {
+			out[c] = (planar) ? _image.plane((ColorImage::Color)c)
+					+ offset : &scratch[c * w];
+		}
+		if (_green) {
+			out[GREEN] = _green + offset;
+		}
+		row(y, out);
+		if ((!planar) && (!_greenpass)) {
+			interleave(_image.pixelbuffer() + 3 * offset, out, w);
+		}
+	}
+}
+
+/**
+ * \brief Create a debayer for a color filter pattern
+ */
+Debayer::Debayer(const std::string& pattern, enum Method method,
+	enum ColorImage::Layout layout)
+	: _pattern(pattern), _method(method), _layout(layout),
+	  _runner(new BandRunner("debayer")) {
+	// check the pattern
+	cfapattern	p(pattern);
+}
+
+/**
+ * \brief The number of threads computing bands of rows
+ */
+unsigned int	Debayer::threads() const {
+	return _runner->threads();
+}
+
+void	Debayer::threads(unsigned int threads) {
+	_runner->threads(threads);
+}
+
+/**
+ * \brief The pattern starting at pixel (x,y) of an image with a pattern
+ */
+std::string	Debayer::shifted(const std::string& pattern, unsigned int x,
+			unsigned int y) {
+	if (pattern.size() != 4) {
+		throw std::runtime_error("bad bayer pattern");
+	}
+	std::string	result(pattern);
+	for (unsigned int j = 0; j < 2; j++) {
+		for (unsigned int i = 0; i < 2; i++) {
+			result[i + 2 * j] = pattern[((i + x) & 1)
+						+ 2 * ((j + y) & 1)];
+		}
+	}
+	return result;
+}
+
+/**
+ * \brief The pattern at the first pixel of a view
+ *
+ * The pattern follows from the position of the first pixel in the image
+ * buffer. Flipping the view does not change the parity of the rows, so
+ * only the position matters.
+ */
+std::string	Debayer::viewpattern(const std::string& pattern,
+			const ImageView& view) {
+	unsigned long	offset = view.rowpointer(0)
+				- view.image()->pixelbuffer();
+	return shifted(pattern, offset % view.image()->width(),
+		offset / view.image()->width());
+}
+
+/**
+ * \brief Convert the mosaic of a view to a color image
+ */
+ColorImagePtr	Debayer::operator()(const ImageView& view) {
+	TraceSpan	span("debayer");
+	if ((view.width() < 4) || (view.height() < 4)) {
+		throw std::range_error("image too small to debayer");
+	}
+	std::string	p = viewpattern(_pattern, view);
+	cfapattern	pattern(p);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "debayer %u x %u image, pattern %s",
+		view.width(), view.height(), p.c_str());
+
+	ImageSize	size = view.size();
+	if (_method == Superpixel) {
+		size = ImageSize(view.width() / 2, view.height() / 2);
+	}
+	ColorImagePtr	image(new ColorImage(size, _layout));
+	image->metrics(view.image()->metrics());
+
+	// the edge aware method keeps the green plane of interleaved
+	// images in a separate buffer
+	std::vector<unsigned short>	greenbuffer;
+	unsigned short	*green = NULL;
+	if (_method == EdgeAware) {
+		if (_layout == ColorImage::Planar) {
+			green = image->plane(ColorImage::Green);
+		} else {
+			greenbuffer.resize(image->npixels());
+			green = &greenbuffer[0];
+		}
+	}
+
+	unsigned int	bands = _runner->bands(size.height());
+	debayerwork	work(view, *image, pattern, _method, green, bands);
+	if (_method == EdgeAware) {
+		work.greenpass(true);
+		_runner->run(bands, work);
+		work.greenpass(false);
+	}
+	_runner->run(bands, work);
+	return image;
+}
+
+/**
+ * \brief Convert the active area of an image to a color image
+ *
+ * The active area is read in place, in the orientation of ap().
+ */
+ColorImagePtr	Debayer::operator()(ImageBufferPtr image) {
+	return (*this)(ImageView::active(image));
+}
+
+} // namespace qhy
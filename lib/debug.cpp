@@ -4,12 +4,12 @@
 // (c) 2007 Prof Dr Andreas Mueller, Hochschule Rapperswil
 // $Id: debug.cpp,v 1.3 2008/12/05 18:08:25 afm Exp $
 //
-#include <qhydebug.h>
-
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <qhydebug.h>
+
 #include <cerrno>
 #include <cstdarg>
 #include <cstring>
@@ -27,7 +27,12 @@
 #include <sys/time.h>
 #endif /* HAVE_SYS_TIME_H */
 
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 int	qhydebuglevel = LOG_ERR;
 
@@ -35,7 +40,7 @@ int	qhydebugtimeprecision = 0;
 
 int	qhydebugthreads = 0;
 
-extern "C" void	qhydebug(int loglevel, const char *file, int line,
+extern "C" void	(qhydebug)(int loglevel, const char *file, int line,
 	int flags, const char *format, ...) {
 	va_list ap;
 	if (loglevel > qhydebuglevel) { return; }
@@ -46,39 +51,56 @@ extern "C" void	qhydebug(int loglevel, const char *file, int line,
 
 #define	MSGSIZE	1024
 
-extern "C" void qhyvdebug(int loglevel, const char *file, int line,
-	int flags, const char *format, va_list ap) {
-	//time_t		t;
-	struct tm	*tmp;
-	char	msgbuffer[MSGSIZE], prefix[MSGSIZE],
-		msgbuffer2[MSGSIZE], tstp[MSGSIZE],
-		threadid[20];
+/*
+ * Log records
+ *
+ * A log record contains everything needed to produce a log line. Only
+ * the message itself is formatted by the thread logging it, the time
+ * stamp, the prefix and the output are left to whoever prints the record.
+ * The message is kept short so that a ring of records stays small,
+ * longer messages are truncated.
+ */
+#define	LOGMSGSIZE	256
+
+struct logrecord {
+	struct timeval	tv;
+	unsigned long	thread;
+	const char	*file;
+	int	line;
+	int	loglevel;
+	int	flags;
 	int	localerrno;
+	char	message[LOGMSGSIZE];
+};
 
-	if (loglevel > qhydebuglevel) { return; }
+/**
+ * \brief format a log record and write it to a file
+ */
+static void	writerecord(FILE *out, const logrecord& record) {
+	struct tm	tmbuf;
+	char	msgbuffer[MSGSIZE], prefix[MSGSIZE], tstp[MSGSIZE],
+		threadid[20];
 
 	// message content
-	localerrno = errno;
-	vsnprintf(msgbuffer2, sizeof(msgbuffer2), format, ap);
-	if (flags & DEBUG_ERRNO) {
+	if (record.flags & DEBUG_ERRNO) {
 		snprintf(msgbuffer, sizeof(msgbuffer), "%s: %s (%d)",
-			msgbuffer2, strerror(localerrno), localerrno);
+			record.message, strerror(record.localerrno),
+			record.localerrno);
 	} else {
-		strcpy(msgbuffer, msgbuffer2);
+		strcpy(msgbuffer, record.message);
 	}
 
 	// get time
-	struct timeval	tv;
-	gettimeofday(&tv, NULL);
-	tmp = localtime(&tv.tv_sec);
-	size_t	bytes = strftime(tstp, sizeof(tstp), "%b %e %H:%M:%S", tmp);
+	time_t	t = record.tv.tv_sec;
+	localtime_r(&t, &tmbuf);
+	size_t	bytes = strftime(tstp, sizeof(tstp), "%b %e %H:%M:%S", &tmbuf);
 
 	// high resolution time
 	if (qhydebugtimeprecision > 0) {
 		if (qhydebugtimeprecision > 6) {
 			qhydebugtimeprecision = 6;
 		}
-		unsigned int	u = tv.tv_usec;
+		unsigned int	u = record.tv.tv_usec;
 		int	p = 6 - qhydebugtimeprecision;
 		while (p--) { u /= 10; }
 		snprintf(tstp + bytes, sizeof(tstp) - bytes, ".%0*u",
@@ -88,20 +110,292 @@ extern "C" void qhyvdebug(int loglevel, const char *file, int line,
 	// find the current thread id if necessary
 	if (qhydebugthreads) {
 		snprintf(threadid, sizeof(threadid), "/%04lx",
-			((unsigned long)pthread_self()) % 0x10000);
+			record.thread % 0x10000);
 	} else {
 		threadid[0] = '\0';
 	}
 
 	// get prefix
-	if (flags & DEBUG_NOFILELINE) {
+	if (record.flags & DEBUG_NOFILELINE) {
 		snprintf(prefix, sizeof(prefix), "%s %s[%d%s]:",
 			tstp, "astro", getpid(), threadid);
 	} else {
 		snprintf(prefix, sizeof(prefix), "%s %s[%d%s] %s:%03d:",
-			tstp, "astro", getpid(), threadid, file, line);
+			tstp, "astro", getpid(), threadid, record.file,
+			record.line);
 	}
 
 	// format log message
-	fprintf(stderr, "%s %s\n", prefix, msgbuffer);
+	fprintf(out, "%s %s\n", prefix, msgbuffer);
+}
+
+/*
+ * Asynchronous logging
+ *
+ * Every thread that logs gets its own ring of log records, with the
+ * thread as the only producer and the log thread as the only consumer.
+ * Adding a record thus needs neither a lock nor a system call except
+ * for the time stamp. If a ring is full, records are dropped and
+ * counted rather than blocking the thread, which may be in the middle
+ * of an image download.
+ */
+#define	LOGRINGSIZE	256
+
+class logring {
+public:
+	std::atomic<unsigned long>	head;
+	std::atomic<unsigned long>	tail;
+	std::atomic<unsigned long>	dropped;
+	std::atomic<bool>	orphaned;
+	logrecord	records[LOGRINGSIZE];
+	logring() : head(0), tail(0), dropped(0), orphaned(false) { }
+};
+
+/**
+ * \brief The log thread and the rings it drains
+ *
+ * Rings are only freed by the log thread once their thread has ended
+ * and all records have been written.
+ */
+class asynclogger {
+	std::mutex	_mutex;
+	std::condition_variable	_cond;
+	std::list<logring *>	_rings;
+	std::thread	_thread;
+	FILE	*_out;
+	bool	_stop;
+	unsigned long	_dropped;
+	void	drain();
+public:
+	asynclogger() : _out(NULL), _stop(false), _dropped(0) { }
+	~asynclogger();
+	bool	start(const char *logfile);
+	void	stop();
+	void	main();
+	void	add(logring *ring);
+	void	wakeup() { _cond.notify_one(); }
+};
+
+static asynclogger	logger;
+static std::atomic<bool>	logasync(false);
+
+/**
+ * \brief owner of the ring of a thread, marks the ring orphaned on exit
+ */
+class logringholder {
+public:
+	logring	*ring;
+	logringholder() : ring(NULL) { }
+	~logringholder() {
+		if (ring) {
+			ring->orphaned.store(true, std::memory_order_release);
+		}
+	}
+};
+
+static thread_local logringholder	threadring;
+
+/**
+ * \brief register a ring with the log thread
+ */
+void	asynclogger::add(logring *ring) {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	_rings.push_back(ring);
+}
+
+/**
+ * \brief write all records in all rings, free rings of ended threads
+ *
+ * The output is written without holding the lock, so that a thread
+ * registering its ring never waits for the file. Only the log thread
+ * removes rings, so the rings of the snapshot stay valid.
+ */
+void	asynclogger::drain() {
+	std::vector<logring *>	rings;
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		rings.assign(_rings.begin(), _rings.end());
+	}
+	std::vector<logring *>	orphans;
+	for (unsigned int i = 0; i < rings.size(); i++) {
+		logring	*ring = rings[i];
+		bool	orphaned = ring->orphaned.load(std::memory_order_acquire);
+		unsigned long	head = ring->head.load(std::memory_order_acquire);
+		unsigned long	tail = ring->tail.load(std::memory_order_relaxed);
+		while (tail < head) {
+			writerecord(_out, ring->records[tail % LOGRINGSIZE]);
+			tail++;
+		}
+		ring->tail.store(tail, std::memory_order_release);
+		unsigned long	dropped = ring->dropped.exchange(0);
+		if (dropped) {
+			_dropped += dropped;
+			fprintf(_out, "%lu log messages dropped\n", dropped);
+		}
+		if (orphaned) {
+			orphans.push_back(ring);
+		}
+	}
+	fflush(_out);
+	if (orphans.empty()) {
+		return;
+	}
+	std::unique_lock<std::mutex>	lock(_mutex);
+	for (unsigned int i = 0; i < orphans.size(); i++) {
+		_rings.remove(orphans[i]);
+		delete orphans[i];
+	}
+}
+
+/**
+ * \brief main method of the log thread
+ */
+void	asynclogger::main() {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	while (!_stop) {
+		_cond.wait_for(lock, std::chrono::milliseconds(50));
+		lock.unlock();
+		drain();
+		lock.lock();
+	}
+}
+
+static void	logger_main(void *arg) {
+	asynclogger	*l = (asynclogger *)arg;
+	l->main();
+}
+
+/**
+ * \brief start the log thread
+ */
+bool	asynclogger::start(const char *logfile) {
+	if (logfile) {
+		_out = fopen(logfile, "a");
+		if (NULL == _out) {
+			return false;
+		}
+	} else {
+		_out = stderr;
+	}
+	_stop = false;
+	try {
+		_thread = std::thread(logger_main, this);
+	} catch (...) {
+		if (_out != stderr) {
+			fclose(_out);
+		}
+		return false;
+	}
+	return true;
+}
+
+/**
+ * \brief stop the log thread, writing all pending records
+ */
+void	asynclogger::stop() {
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		_stop = true;
+	}
+	_cond.notify_all();
+	_thread.join();
+	drain();
+	if (_out != stderr) {
+		fclose(_out);
+	}
+	_out = NULL;
+}
+
+/**
+ * \brief make sure pending messages are written when the program ends
+ */
+asynclogger::~asynclogger() {
+	if (_thread.joinable()) {
+		logasync = false;
+		stop();
+	}
+}
+
+/**
+ * \brief start asynchronous logging
+ *
+ * From now on, log messages are only queued by the threads logging them
+ * and written by a background thread, to the file if logfile is not NULL
+ * or to stderr otherwise.
+ * \return 0 on success, -1 if the log file cannot be opened
+ */
+extern "C" int	qhydebugstart(const char *logfile) {
+	if (logasync) {
+		return 0;
+	}
+	if (!logger.start(logfile)) {
+		return -1;
+	}
+	logasync = true;
+	return 0;
+}
+
+/**
+ * \brief stop asynchronous logging and write all queued messages
+ */
+extern "C" void	qhydebugstop() {
+	if (!logasync) {
+		return;
+	}
+	logasync = false;
+	logger.stop();
+}
+
+/**
+ * \brief queue a record in the ring of the calling thread
+ */
+static void	queuerecord(int loglevel, const char *file, int line,
+	int flags, const char *format, va_list ap) {
+	logring	*ring = threadring.ring;
+	if (NULL == ring) {
+		ring = new logring();
+		threadring.ring = ring;
+		logger.add(ring);
+	}
+	unsigned long	head = ring->head.load(std::memory_order_relaxed);
+	unsigned long	tail = ring->tail.load(std::memory_order_acquire);
+	if (head - tail >= LOGRINGSIZE) {
+		ring->dropped++;
+		return;
+	}
+	logrecord&	record = ring->records[head % LOGRINGSIZE];
+	record.localerrno = errno;
+	gettimeofday(&record.tv, NULL);
+	record.thread = (unsigned long)pthread_self();
+	record.file = file;
+	record.line = line;
+	record.loglevel = loglevel;
+	record.flags = flags;
+	vsnprintf(record.message, sizeof(record.message), format, ap);
+	ring->head.store(head + 1, std::memory_order_release);
+	if (2 * (head + 1 - tail) > LOGRINGSIZE) {
+		logger.wakeup();
+	}
+}
+
+extern "C" void qhyvdebug(int loglevel, const char *file, int line,
+	int flags, const char *format, va_list ap) {
+	if (loglevel > qhydebuglevel) { return; }
+
+	// in asynchronous mode, the log thread does the rest
+	if (logasync) {
+		queuerecord(loglevel, file, line, flags, format, ap);
+		return;
+	}
+
+	logrecord	record;
+	record.localerrno = errno;
+	gettimeofday(&record.tv, NULL);
+	record.thread = (unsigned long)pthread_self();
+	record.file = file;
+	record.line = line;
+	record.loglevel = loglevel;
+	record.flags = flags;
+	vsnprintf(record.message, sizeof(record.message), format, ap);
+	writerecord(stderr, record);
 }
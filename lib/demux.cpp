@@ -0,0 +1,1079 @@
+/*
+ * demux.cpp -- vectorized demultiplexing and conversion kernels
+ *
+ * The QHY8PRO sends its pixels as big endian 16 bit words, interleaving
+ * two image rows in groups of four words w0 w1 w2 w3. The first row
+ * gets w2 and w3 of every group, the second row w0 and w1, but shifted
+ * left by one pixel. This is how the demultiplexing code of the SDK
+ * works, and the kernels reproduce it exactly: the last pixel of the
+ * first row is w0 of the first group, and the last pixel of the second
+ * row is never written.
+ *
+ * In the binned modes, the camera only bins in one direction, the
+ * remaining binning adds two (2x2) or four (4x4) consecutive words
+ * with saturation at 65535. As saturating additions of nonnegative
+ * values can be nested without changing the result, the kernels add
+ * neighbouring words pairwise with the saturating 16 bit instructions.
+ * The kernels for 32 bit pixels widen the words before adding them,
+ * so that they need no saturation.
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <demux.h>
+#include <qhydebug.h>
+#include <mutex>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DEMUX_X86	1
+#include <immintrin.h>
+#else
+#define DEMUX_X86	0
+#endif
+
+namespace qhy {
+
+/**
+ * \brief Scalar calibration of a pixel
+ *
+ * This is the only scalar calibration code, it is used for the tails
+ * of the vectorized kernels and by the scalar kernels below.
+ * The variants without offset or without gain skip the subtraction or
+ * the multiplication, which gives the same result as subtracting 0 or
+ * multiplying by 1.
+ */
+template<bool Offset, bool Gain>
+static inline float	calibrate_pixel(const unsigned short *from,
+				const float *offset, const float *gain,
+				unsigned long i) {
+	float	v = from[i];
+	if (Offset) {
+		v -= offset[i];
+	}
+	if (Gain) {
+		v *= gain[i];
+	}
+	return v;
+}
+
+/**
+ * \brief Scalar calibration of a pixel to 16 bits
+ *
+ * lrintf() rounds like the conversion instructions of the kernels in
+ * the default rounding mode.
+ */
+template<bool Offset, bool Gain>
+static inline unsigned short	calibrate16_pixel(const unsigned short *from,
+					const float *offset, const float *gain,
+					unsigned long i) {
+	float	v = calibrate_pixel<Offset, Gain>(from, offset, gain, i);
+	v = (v < 0.f) ? 0.f : ((v > 65535.f) ? 65535.f : v);
+	return lrintf(v);
+}
+
+/**
+ * \brief Scalar calibration to 16 bit pixels
+ */
+template<bool Offset, bool Gain>
+static void	calibrate16_scalar(unsigned short *to, const unsigned short *from,
+			const float *offset, const float *gain,
+			unsigned long n) {
+	for (unsigned long i = 0; i < n; i++) {
+		to[i] = calibrate16_pixel<Offset, Gain>(from, offset, gain, i);
+	}
+}
+
+/**
+ * \brief Scalar calibration to floating point pixels
+ */
+template<bool Offset, bool Gain>
+static void	calibratefloat_scalar(float *to, const unsigned short *from,
+			const float *offset, const float *gain,
+			unsigned long n) {
+	for (unsigned long i = 0; i < n; i++) {
+		to[i] = calibrate_pixel<Offset, Gain>(from, offset, gain, i);
+	}
+}
+
+#if DEMUX_X86
+
+/**
+ * \brief Big endian word at a byte position
+ */
+static inline unsigned short	word(const unsigned char *p) {
+	return (p[0] << 8) | p[1];
+}
+
+/**
+ * \brief Convert the groups from firstgroup on, the tail of every kernel
+ */
+static inline void	demux11_groups(unsigned short *rowa, unsigned short *rowb,
+				const unsigned char *raw, unsigned int firstgroup,
+				unsigned int groups) {
+	for (unsigned int g = firstgroup; g < groups; g++) {
+		const unsigned char	*r = raw + 8 * g;
+		rowa[2 * g] = word(r + 4);
+		rowa[2 * g + 1] = word(r + 6);
+		rowb[2 * g - 1] = word(r);
+		rowb[2 * g] = word(r + 2);
+	}
+}
+
+/**
+ * \brief SSE2 kernel, swaps bytes with shifts, 4 groups per iteration
+ */
+__attribute__((target("sse2")))
+static void	demux11_sse2(unsigned short *rows, const unsigned char *raw,
+			unsigned int width) {
+	unsigned short	*rowa = rows;
+	unsigned short	*rowb = rows + width;
+	unsigned int	groups = width / 2;
+	unsigned int	g = 0;
+	for (; g + 4 <= groups; g += 4) {
+		const __m128i	*r = (const __m128i *)(raw + 8 * g);
+		__m128i	v1 = _mm_loadu_si128(r);
+		__m128i	v2 = _mm_loadu_si128(r + 1);
+		v1 = _mm_or_si128(_mm_slli_epi16(v1, 8), _mm_srli_epi16(v1, 8));
+		v2 = _mm_or_si128(_mm_slli_epi16(v2, 8), _mm_srli_epi16(v2, 8));
+		// move the w2 w3 pairs to the low half, w0 w1 to the high
+		v1 = _mm_shuffle_epi32(v1, _MM_SHUFFLE(2, 0, 3, 1));
+		v2 = _mm_shuffle_epi32(v2, _MM_SHUFFLE(2, 0, 3, 1));
+		_mm_storeu_si128((__m128i *)(rowa + 2 * g),
+			_mm_unpacklo_epi64(v1, v2));
+		_mm_storeu_si128((__m128i *)(rowb + 2 * g - 1),
+			_mm_unpackhi_epi64(v1, v2));
+	}
+	demux11_groups(rowa, rowb, raw, g, groups);
+	rowa[width - 1] = word(raw);
+}
+
+/**
+ * \brief SSSE3 kernel, swaps and reorders bytes with a single shuffle
+ */
+__attribute__((target("ssse3")))
+static void	demux11_ssse3(unsigned short *rows, const unsigned char *raw,
+			unsigned int width) {
+	unsigned short	*rowa = rows;
+	unsigned short	*rowb = rows + width;
+	unsigned int	groups = width / 2;
+	const __m128i	mask = _mm_setr_epi8(5, 4, 7, 6, 13, 12, 15, 14,
+				1, 0, 3, 2, 9, 8, 11, 10);
+	unsigned int	g = 0;
+	for (; g + 4 <= groups; g += 4) {
+		const __m128i	*r = (const __m128i *)(raw + 8 * g);
+		__m128i	v1 = _mm_shuffle_epi8(_mm_loadu_si128(r), mask);
+		__m128i	v2 = _mm_shuffle_epi8(_mm_loadu_si128(r + 1), mask);
+		_mm_storeu_si128((__m128i *)(rowa + 2 * g),
+			_mm_unpacklo_epi64(v1, v2));
+		_mm_storeu_si128((__m128i *)(rowb + 2 * g - 1),
+			_mm_unpackhi_epi64(v1, v2));
+	}
+	demux11_groups(rowa, rowb, raw, g, groups);
+	rowa[width - 1] = word(raw);
+}
+
+/**
+ * \brief AVX2 kernel, 8 groups per iteration
+ *
+ * The shuffle works within 128 bit lanes, so the 64 bit halves have
+ * to be put back in order after unpacking.
+ */
+__attribute__((target("avx2")))
+static void	demux11_avx2(unsigned short *rows, const unsigned char *raw,
+			unsigned int width) {
+	unsigned short	*rowa = rows;
+	unsigned short	*rowb = rows + width;
+	unsigned int	groups = width / 2;
+	const __m256i	mask = _mm256_setr_epi8(5, 4, 7, 6, 13, 12, 15, 14,
+				1, 0, 3, 2, 9, 8, 11, 10,
+				5, 4, 7, 6, 13, 12, 15, 14,
+				1, 0, 3, 2, 9, 8, 11, 10);
+	unsigned int	g = 0;
+	for (; g + 8 <= groups; g += 8) {
+		const __m256i	*r = (const __m256i *)(raw + 8 * g);
+		__m256i	v1 = _mm256_shuffle_epi8(_mm256_loadu_si256(r), mask);
+		__m256i	v2 = _mm256_shuffle_epi8(_mm256_loadu_si256(r + 1),
+				mask);
+		__m256i	a = _mm256_permute4x64_epi64(
+				_mm256_unpacklo_epi64(v1, v2),
+				_MM_SHUFFLE(3, 1, 2, 0));
+		__m256i	b = _mm256_permute4x64_epi64(
+				_mm256_unpackhi_epi64(v1, v2),
+				_MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *)(rowa + 2 * g), a);
+		_mm256_storeu_si256((__m256i *)(rowb + 2 * g - 1), b);
+	}
+	demux11_groups(rowa, rowb, raw, g, groups);
+	rowa[width - 1] = word(raw);
+}
+
+/**
+ * \brief Binned pixels from firstpixel on, the tail of the binning kernels
+ *
+ * \param words	number of raw words added for each pixel
+ */
+static inline void	demuxbinned_pixels(unsigned short *row,
+				const unsigned char *raw, unsigned int words,
+				unsigned int firstpixel, unsigned int width) {
+	for (unsigned int j = firstpixel; j < width; j++) {
+		unsigned long	binpixel = 0;
+		for (unsigned int i = 0; i < words; i++) {
+			binpixel += word(raw + 2 * (words * j + i));
+		}
+		row[j] = (binpixel > 65535) ? 65535 : binpixel;
+	}
+}
+
+/**
+ * \brief Saturated sums of neighbouring words of two vectors, SSE2
+ *
+ * The sum ends up in the low word of each 32 bit lane, sign extending
+ * it makes the signed saturating pack keep its bit pattern.
+ */
+__attribute__((target("sse2")))
+static inline __m128i	pairsum_sse2(__m128i v1, __m128i v2) {
+	v1 = _mm_adds_epu16(v1, _mm_srli_epi32(v1, 16));
+	v2 = _mm_adds_epu16(v2, _mm_srli_epi32(v2, 16));
+	v1 = _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16);
+	v2 = _mm_srai_epi32(_mm_slli_epi32(v2, 16), 16);
+	return _mm_packs_epi32(v1, v2);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i	swap_sse2(__m128i v) {
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+/**
+ * \brief SSE2 kernel for 2x2 binned images, 8 pixels per iteration
+ */
+__attribute__((target("sse2")))
+static void	demux22_sse2(unsigned short *row, const unsigned char *raw,
+			unsigned int width) {
+	unsigned int	j = 0;
+	for (; j + 8 <= width; j += 8) {
+		const __m128i	*r = (const __m128i *)(raw + 4 * j);
+		__m128i	v1 = swap_sse2(_mm_loadu_si128(r));
+		__m128i	v2 = swap_sse2(_mm_loadu_si128(r + 1));
+		_mm_storeu_si128((__m128i *)(row + j), pairsum_sse2(v1, v2));
+	}
+	demuxbinned_pixels(row, raw, 2, j, width);
+}
+
+/**
+ * \brief SSE2 kernel for 4x4 binned images, 8 pixels per iteration
+ */
+__attribute__((target("sse2")))
+static void	demux44_sse2(unsigned short *row, const unsigned char *raw,
+			unsigned int width) {
+	unsigned int	j = 0;
+	for (; j + 8 <= width; j += 8) {
+		const __m128i	*r = (const __m128i *)(raw + 8 * j);
+		__m128i	p1 = pairsum_sse2(swap_sse2(_mm_loadu_si128(r)),
+				swap_sse2(_mm_loadu_si128(r + 1)));
+		__m128i	p2 = pairsum_sse2(swap_sse2(_mm_loadu_si128(r + 2)),
+				swap_sse2(_mm_loadu_si128(r + 3)));
+		_mm_storeu_si128((__m128i *)(row + j), pairsum_sse2(p1, p2));
+	}
+	demuxbinned_pixels(row, raw, 4, j, width);
+}
+
+/**
+ * \brief Saturated sums of neighbouring words of two vectors, SSSE3
+ *
+ * The mask collects the even words in the low half and the odd words
+ * in the high half of each vector, swapping the bytes if needed.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i	pairsum_ssse3(__m128i v1, __m128i v2, __m128i mask) {
+	v1 = _mm_shuffle_epi8(v1, mask);
+	v2 = _mm_shuffle_epi8(v2, mask);
+	return _mm_adds_epu16(_mm_unpacklo_epi64(v1, v2),
+		_mm_unpackhi_epi64(v1, v2));
+}
+
+/**
+ * \brief SSSE3 kernel for 2x2 binned images, 8 pixels per iteration
+ */
+__attribute__((target("ssse3")))
+static void	demux22_ssse3(unsigned short *row, const unsigned char *raw,
+			unsigned int width) {
+	const __m128i	swapmask = _mm_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12,
+				3, 2, 7, 6, 11, 10, 15, 14);
+	unsigned int	j = 0;
+	for (; j + 8 <= width; j += 8) {
+		const __m128i	*r = (const __m128i *)(raw + 4 * j);
+		_mm_storeu_si128((__m128i *)(row + j),
+			pairsum_ssse3(_mm_loadu_si128(r),
+				_mm_loadu_si128(r + 1), swapmask));
+	}
+	demuxbinned_pixels(row, raw, 2, j, width);
+}
+
+/**
+ * \brief SSSE3 kernel for 4x4 binned images, 8 pixels per iteration
+ */
+__attribute__((target("ssse3")))
+static void	demux44_ssse3(unsigned short *row, const unsigned char *raw,
+			unsigned int width) {
+	const __m128i	swapmask = _mm_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12,
+				3, 2, 7, 6, 11, 10, 15, 14);
+	const __m128i	mask = _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
+				2, 3, 6, 7, 10, 11, 14, 15);
+	unsigned int	j = 0;
+	for (; j + 8 <= width; j += 8) {
+		const __m128i	*r = (const __m128i *)(raw + 8 * j);
+		__m128i	p1 = pairsum_ssse3(_mm_loadu_si128(r),
+				_mm_loadu_si128(r + 1), swapmask);
+		__m128i	p2 = pairsum_ssse3(_mm_loadu_si128(r + 2),
+				_mm_loadu_si128(r + 3), swapmask);
+		_mm_storeu_si128((__m128i *)(row + j),
+			pairsum_ssse3(p1, p2, mask));
+	}
+	demuxbinned_pixels(row, raw, 4, j, width);
+}
+
+/**
+ * \brief Saturated sums of neighbouring words of two vectors, AVX2
+ */
+__attribute__((target("avx2")))
+static inline __m256i	pairsum_avx2(__m256i v1, __m256i v2, __m256i mask) {
+	v1 = _mm256_shuffle_epi8(v1, mask);
+	v2 = _mm256_shuffle_epi8(v2, mask);
+	__m256i	even = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(v1, v2),
+			_MM_SHUFFLE(3, 1, 2, 0));
+	__m256i	odd = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(v1, v2),
+			_MM_SHUFFLE(3, 1, 2, 0));
+	return _mm256_adds_epu16(even, odd);
+}
+
+/**
+ * \brief AVX2 kernel for 2x2 binned images, 16 pixels per iteration
+ */
+__attribute__((target("avx2")))
+static void	demux22_avx2(unsigned short *row, const unsigned char *raw,
+			unsigned int width) {
+	const __m256i	swapmask = _mm256_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12,
+				3, 2, 7, 6, 11, 10, 15, 14,
+				1, 0, 5, 4, 9, 8, 13, 12,
+				3, 2, 7, 6, 11, 10, 15, 14);
+	unsigned int	j = 0;
+	for (; j + 16 <= width; j += 16) {
+		const __m256i	*r = (const __m256i *)(raw + 4 * j);
+		_mm256_storeu_si256((__m256i *)(row + j),
+			pairsum_avx2(_mm256_loadu_si256(r),
+				_mm256_loadu_si256(r + 1), swapmask));
+	}
+	demuxbinned_pixels(row, raw, 2, j, width);
+}
+
+/**
+ * \brief AVX2 kernel for 4x4 binned images, 16 pixels per iteration
+ */
+__attribute__((target("avx2")))
+static void	demux44_avx2(unsigned short *row, const unsigned char *raw,
+			unsigned int width) {
+	const __m256i	swapmask = _mm256_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12,
+				3, 2, 7, 6, 11, 10, 15, 14,
+				1, 0, 5, 4, 9, 8, 13, 12,
+				3, 2, 7, 6, 11, 10, 15, 14);
+	const __m256i	mask = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
+				2, 3, 6, 7, 10, 11, 14, 15,
+				0, 1, 4, 5, 8, 9, 12, 13,
+				2, 3, 6, 7, 10, 11, 14, 15);
+	unsigned int	j = 0;
+	for (; j + 16 <= width; j += 16) {
+		const __m256i	*r = (const __m256i *)(raw + 8 * j);
+		__m256i	p1 = pairsum_avx2(_mm256_loadu_si256(r),
+				_mm256_loadu_si256(r + 1), swapmask);
+		__m256i	p2 = pairsum_avx2(_mm256_loadu_si256(r + 2),
+				_mm256_loadu_si256(r + 3), swapmask);
+		_mm256_storeu_si256((__m256i *)(row + j),
+			pairsum_avx2(p1, p2, mask));
+	}
+	demuxbinned_pixels(row, raw, 4, j, width);
+}
+
+/**
+ * \brief Convert binned pixels from firstpixel on to 32 bit pixels
+ */
+static inline void	demuxwide_pixels(unsigned int *row,
+				const unsigned char *raw, unsigned int words,
+				unsigned int firstpixel, unsigned int width) {
+	for (unsigned int j = firstpixel; j < width; j++) {
+		unsigned int	binpixel = 0;
+		for (unsigned int i = 0; i < words; i++) {
+			binpixel += word(raw + 2 * (words * j + i));
+		}
+		row[j] = binpixel;
+	}
+}
+
+/**
+ * \brief Sums of neighbouring words in each 32 bit lane, SSE2
+ */
+__attribute__((target("sse2")))
+static inline __m128i	widesum_sse2(__m128i v) {
+	return _mm_add_epi32(_mm_and_si128(v, _mm_set1_epi32(0xffff)),
+		_mm_srli_epi32(v, 16));
+}
+
+/**
+ * \brief SSE2 kernel for 2x2 binned 32 bit images, 8 pixels per iteration
+ */
+__attribute__((target("sse2")))
+static void	demux22wide_sse2(unsigned int *row, const unsigned char *raw,
+			unsigned int width) {
+	unsigned int	j = 0;
+	for (; j + 8 <= width; j += 8) {
+		const __m128i	*r = (const __m128i *)(raw + 4 * j);
+		_mm_storeu_si128((__m128i *)(row + j),
+			widesum_sse2(swap_sse2(_mm_loadu_si128(r))));
+		_mm_storeu_si128((__m128i *)(row + j + 4),
+			widesum_sse2(swap_sse2(_mm_loadu_si128(r + 1))));
+	}
+	demuxwide_pixels(row, raw, 2, j, width);
+}
+
+/**
+ * \brief SSE2 kernel for 4x4 binned 32 bit images, 8 pixels per iteration
+ *
+ * The pair sums of two vectors are added after separating the even and
+ * odd lanes with a floating point shuffle.
+ */
+__attribute__((target("sse2")))
+static void	demux44wide_sse2(unsigned int *row, const unsigned char *raw,
+			unsigned int width) {
+	unsigned int	j = 0;
+	for (; j + 8 <= width; j += 8) {
+		const __m128i	*r = (const __m128i *)(raw + 8 * j);
+		for (unsigned int k = 0; k < 2; k++) {
+			__m128	a = _mm_castsi128_ps(widesum_sse2(
+					swap_sse2(_mm_loadu_si128(r + 2 * k))));
+			__m128	b = _mm_castsi128_ps(widesum_sse2(
+					swap_sse2(_mm_loadu_si128(r + 2 * k + 1))));
+			__m128i	even = _mm_castps_si128(_mm_shuffle_ps(a, b,
+					_MM_SHUFFLE(2, 0, 2, 0)));
+			__m128i	odd = _mm_castps_si128(_mm_shuffle_ps(a, b,
+					_MM_SHUFFLE(3, 1, 3, 1)));
+			_mm_storeu_si128((__m128i *)(row + j + 4 * k),
+				_mm_add_epi32(even, odd));
+		}
+	}
+	demuxwide_pixels(row, raw, 4, j, width);
+}
+
+/**
+ * \brief Byte swapped sums of neighbouring words in 32 bit lanes, AVX2
+ */
+__attribute__((target("avx2")))
+static inline __m256i	widesum_avx2(__m256i v, __m256i swapmask) {
+	v = _mm256_shuffle_epi8(v, swapmask);
+	return _mm256_add_epi32(_mm256_and_si256(v, _mm256_set1_epi32(0xffff)),
+		_mm256_srli_epi32(v, 16));
+}
+
+/**
+ * \brief AVX2 kernel for 2x2 binned 32 bit images, 16 pixels per iteration
+ */
+__attribute__((target("avx2")))
+static void	demux22wide_avx2(unsigned int *row, const unsigned char *raw,
+			unsigned int width) {
+	const __m256i	swapmask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+				9, 8, 11, 10, 13, 12, 15, 14,
+				1, 0, 3, 2, 5, 4, 7, 6,
+				9, 8, 11, 10, 13, 12, 15, 14);
+	unsigned int	j = 0;
+	for (; j + 16 <= width; j += 16) {
+		const __m256i	*r = (const __m256i *)(raw + 4 * j);
+		_mm256_storeu_si256((__m256i *)(row + j),
+			widesum_avx2(_mm256_loadu_si256(r), swapmask));
+		_mm256_storeu_si256((__m256i *)(row + j + 8),
+			widesum_avx2(_mm256_loadu_si256(r + 1), swapmask));
+	}
+	demuxwide_pixels(row, raw, 2, j, width);
+}
+
+/**
+ * \brief AVX2 kernel for 4x4 binned 32 bit images, 16 pixels per iteration
+ *
+ * The horizontal add leaves the pixels of the two vectors interleaved
+ * in blocks of two, the permutation restores their order.
+ */
+__attribute__((target("avx2")))
+static void	demux44wide_avx2(unsigned int *row, const unsigned char *raw,
+			unsigned int width) {
+	const __m256i	swapmask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+				9, 8, 11, 10, 13, 12, 15, 14,
+				1, 0, 3, 2, 5, 4, 7, 6,
+				9, 8, 11, 10, 13, 12, 15, 14);
+	unsigned int	j = 0;
+	for (; j + 16 <= width; j += 16) {
+		const __m256i	*r = (const __m256i *)(raw + 8 * j);
+		for (unsigned int k = 0; k < 2; k++) {
+			__m256i	a = widesum_avx2(_mm256_loadu_si256(r + 2 * k),
+					swapmask);
+			__m256i	b = widesum_avx2(_mm256_loadu_si256(r + 2 * k + 1),
+					swapmask);
+			_mm256_storeu_si256((__m256i *)(row + j + 8 * k),
+				_mm256_permute4x64_epi64(_mm256_hadd_epi32(a, b),
+					_MM_SHUFFLE(3, 1, 2, 0)));
+		}
+	}
+	demuxwide_pixels(row, raw, 4, j, width);
+}
+
+/**
+ * \brief SSE2 conversion of unsigned short pixels to float
+ */
+__attribute__((target("sse2")))
+static void	tofloat16_sse2(float *to, const unsigned short *from,
+			unsigned long n) {
+	const __m128i	zero = _mm_setzero_si128();
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i	v = _mm_loadu_si128((const __m128i *)(from + i));
+		_mm_storeu_ps(to + i,
+			_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+		_mm_storeu_ps(to + i + 4,
+			_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+	}
+	for (; i < n; i++) {
+		to[i] = from[i];
+	}
+}
+
+/**
+ * \brief AVX2 conversion of unsigned short pixels to float
+ */
+__attribute__((target("avx2")))
+static void	tofloat16_avx2(float *to, const unsigned short *from,
+			unsigned long n) {
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i	v = _mm_loadu_si128((const __m128i *)(from + i));
+		_mm256_storeu_ps(to + i,
+			_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)));
+	}
+	for (; i < n; i++) {
+		to[i] = from[i];
+	}
+}
+
+/**
+ * \brief SSE2 conversion of unsigned int pixels to float
+ *
+ * The processor only converts signed integers, so the two halves of
+ * each pixel are converted separately. Both conversions and the
+ * multiplication are exact, so the addition rounds only once and the
+ * result is the same as that of a scalar conversion.
+ */
+__attribute__((target("sse2")))
+static void	tofloat32_sse2(float *to, const unsigned int *from,
+			unsigned long n) {
+	const __m128i	low = _mm_set1_epi32(0xffff);
+	const __m128	scale = _mm_set1_ps(65536.f);
+	unsigned long	i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i	v = _mm_loadu_si128((const __m128i *)(from + i));
+		__m128	h = _mm_cvtepi32_ps(_mm_srli_epi32(v, 16));
+		__m128	l = _mm_cvtepi32_ps(_mm_and_si128(v, low));
+		_mm_storeu_ps(to + i, _mm_add_ps(_mm_mul_ps(h, scale), l));
+	}
+	for (; i < n; i++) {
+		to[i] = from[i];
+	}
+}
+
+/**
+ * \brief AVX2 conversion of unsigned int pixels to float
+ */
+__attribute__((target("avx2")))
+static void	tofloat32_avx2(float *to, const unsigned int *from,
+			unsigned long n) {
+	const __m256i	low = _mm256_set1_epi32(0xffff);
+	const __m256	scale = _mm256_set1_ps(65536.f);
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i	v = _mm256_loadu_si256((const __m256i *)(from + i));
+		__m256	h = _mm256_cvtepi32_ps(_mm256_srli_epi32(v, 16));
+		__m256	l = _mm256_cvtepi32_ps(_mm256_and_si256(v, low));
+		_mm256_storeu_ps(to + i, _mm256_add_ps(_mm256_mul_ps(h, scale), l));
+	}
+	for (; i < n; i++) {
+		to[i] = from[i];
+	}
+}
+
+/**
+ * \brief SSE2 addition of unsigned short pixels to 32 bit sums
+ */
+__attribute__((target("sse2")))
+static void	accumulate16_sse2(unsigned int *sums, const unsigned short *from,
+			unsigned long n) {
+	const __m128i	zero = _mm_setzero_si128();
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i	v = _mm_loadu_si128((const __m128i *)(from + i));
+		__m128i	*s = (__m128i *)(sums + i);
+		_mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s),
+			_mm_unpacklo_epi16(v, zero)));
+		_mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1),
+			_mm_unpackhi_epi16(v, zero)));
+	}
+	for (; i < n; i++) {
+		sums[i] += from[i];
+	}
+}
+
+/**
+ * \brief AVX2 addition of unsigned short pixels to 32 bit sums
+ */
+__attribute__((target("avx2")))
+static void	accumulate16_avx2(unsigned int *sums, const unsigned short *from,
+			unsigned long n) {
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i	v = _mm_loadu_si128((const __m128i *)(from + i));
+		__m256i	*s = (__m256i *)(sums + i);
+		_mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s),
+			_mm256_cvtepu16_epi32(v)));
+	}
+	for (; i < n; i++) {
+		sums[i] += from[i];
+	}
+}
+
+/**
+ * \brief Clamp, round and pack 8 calibrated pixels with SSE2
+ *
+ * SSE2 can only pack to signed 16 bit values, so the values are moved
+ * into the signed range before packing and back afterwards.
+ */
+__attribute__((target("sse2")))
+static inline __m128i	calibrate16_pack_sse2(__m128 lo, __m128 hi) {
+	const __m128	zero = _mm_setzero_ps();
+	const __m128	top = _mm_set1_ps(65535.f);
+	const __m128i	bias = _mm_set1_epi32(32768);
+	__m128i	l = _mm_sub_epi32(_mm_cvtps_epi32(
+			_mm_min_ps(_mm_max_ps(lo, zero), top)), bias);
+	__m128i	h = _mm_sub_epi32(_mm_cvtps_epi32(
+			_mm_min_ps(_mm_max_ps(hi, zero), top)), bias);
+	return _mm_xor_si128(_mm_packs_epi32(l, h), _mm_set1_epi16(-32768));
+}
+
+/**
+ * \brief SSE2 calibration of 8 pixels
+ */
+template<bool Offset, bool Gain>
+__attribute__((target("sse2")))
+static inline void	calibrate_sse2(__m128& lo, __m128& hi,
+				const unsigned short *from, const float *offset,
+				const float *gain) {
+	const __m128i	zero = _mm_setzero_si128();
+	__m128i	v = _mm_loadu_si128((const __m128i *)from);
+	lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+	hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+	if (Offset) {
+		lo = _mm_sub_ps(lo, _mm_loadu_ps(offset));
+		hi = _mm_sub_ps(hi, _mm_loadu_ps(offset + 4));
+	}
+	if (Gain) {
+		lo = _mm_mul_ps(lo, _mm_loadu_ps(gain));
+		hi = _mm_mul_ps(hi, _mm_loadu_ps(gain + 4));
+	}
+}
+
+/**
+ * \brief SSE2 calibration to 16 bit pixels
+ */
+template<bool Offset, bool Gain>
+__attribute__((target("sse2")))
+static void	calibrate16_sse2(unsigned short *to, const unsigned short *from,
+			const float *offset, const float *gain,
+			unsigned long n) {
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128	lo, hi;
+		calibrate_sse2<Offset, Gain>(lo, hi, from + i,
+			(Offset) ? offset + i : NULL, (Gain) ? gain + i : NULL);
+		_mm_storeu_si128((__m128i *)(to + i),
+			calibrate16_pack_sse2(lo, hi));
+	}
+	for (; i < n; i++) {
+		to[i] = calibrate16_pixel<Offset, Gain>(from, offset, gain, i);
+	}
+}
+
+/**
+ * \brief SSE2 calibration to floating point pixels
+ */
+template<bool Offset, bool Gain>
+__attribute__((target("sse2")))
+static void	calibratefloat_sse2(float *to, const unsigned short *from,
+			const float *offset, const float *gain,
+			unsigned long n) {
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128	lo, hi;
+		calibrate_sse2<Offset, Gain>(lo, hi, from + i,
+			(Offset) ? offset + i : NULL, (Gain) ? gain + i : NULL);
+		_mm_storeu_ps(to + i, lo);
+		_mm_storeu_ps(to + i + 4, hi);
+	}
+	for (; i < n; i++) {
+		to[i] = calibrate_pixel<Offset, Gain>(from, offset, gain, i);
+	}
+}
+
+/**
+ * \brief AVX2 calibration of 8 pixels
+ */
+template<bool Offset, bool Gain>
+__attribute__((target("avx2")))
+static inline __m256	calibrate_avx2(const unsigned short *from,
+				const float *offset, const float *gain) {
+	__m128i	v = _mm_loadu_si128((const __m128i *)from);
+	__m256	p = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v));
+	if (Offset) {
+		p = _mm256_sub_ps(p, _mm256_loadu_ps(offset));
+	}
+	if (Gain) {
+		p = _mm256_mul_ps(p, _mm256_loadu_ps(gain));
+	}
+	return p;
+}
+
+/**
+ * \brief AVX2 calibration to 16 bit pixels
+ */
+template<bool Offset, bool Gain>
+__attribute__((target("avx2")))
+static void	calibrate16_avx2(unsigned short *to, const unsigned short *from,
+			const float *offset, const float *gain,
+			unsigned long n) {
+	const __m256	zero = _mm256_setzero_ps();
+	const __m256	top = _mm256_set1_ps(65535.f);
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256	v = calibrate_avx2<Offset, Gain>(from + i,
+				(Offset) ? offset + i : NULL,
+				(Gain) ? gain + i : NULL);
+		__m256i	p = _mm256_cvtps_epi32(
+				_mm256_min_ps(_mm256_max_ps(v, zero), top));
+		_mm_storeu_si128((__m128i *)(to + i),
+			_mm_packus_epi32(_mm256_castsi256_si128(p),
+				_mm256_extracti128_si256(p, 1)));
+	}
+	for (; i < n; i++) {
+		to[i] = calibrate16_pixel<Offset, Gain>(from, offset, gain, i);
+	}
+}
+
+/**
+ * \brief AVX2 calibration to floating point pixels
+ */
+template<bool Offset, bool Gain>
+__attribute__((target("avx2")))
+static void	calibratefloat_avx2(float *to, const unsigned short *from,
+			const float *offset, const float *gain,
+			unsigned long n) {
+	unsigned long	i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(to + i, calibrate_avx2<Offset, Gain>(from + i,
+			(Offset) ? offset + i : NULL, (Gain) ? gain + i : NULL));
+	}
+	for (; i < n; i++) {
+		to[i] = calibrate_pixel<Offset, Gain>(from, offset, gain, i);
+	}
+}
+
+/**
+ * \brief Find the best instruction set level the processor supports
+ */
+static int	demux_cpu() {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return DEMUX_AVX2;
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		return DEMUX_SSSE3;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return DEMUX_SSE2;
+	}
+	return DEMUX_SCALAR;
+}
+
+#else /* DEMUX_X86 */
+
+static int	demux_cpu() {
+	return DEMUX_SCALAR;
+}
+
+#endif /* DEMUX_X86 */
+
+static std::once_flag	demux_once;
+static int	demux_cpulevel = DEMUX_SCALAR;
+static int	demux_limit = DEMUX_AVX2;
+
+static void	demux_init() {
+	demux_cpulevel = demux_cpu();
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "demux instruction set level %d",
+		demux_cpulevel);
+}
+
+/**
+ * \brief The instruction set level the kernels are selected for
+ */
+int	demux_level() {
+	std::call_once(demux_once, demux_init);
+	return (demux_limit < demux_cpulevel) ? demux_limit : demux_cpulevel;
+}
+
+/**
+ * \brief Limit the instruction set level of the kernels
+ *
+ * This is mainly useful to compare the kernels with each other and
+ * with the scalar code.
+ */
+void	demux_level(int limit) {
+	demux_limit = limit;
+}
+
+/**
+ * \brief Select the demultiplexing kernel for unbinned images
+ *
+ * \return the kernel, or NULL if the scalar code should be used
+ */
+demux11_kernel	demux11_select() {
+#if DEMUX_X86
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return demux11_avx2;
+	case DEMUX_SSSE3:
+		return demux11_ssse3;
+	case DEMUX_SSE2:
+		return demux11_sse2;
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return NULL;
+}
+
+/**
+ * \brief Select the demultiplexing kernel for 2x2 binned images
+ */
+demuxbinned_kernel	demux22_select() {
+#if DEMUX_X86
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return demux22_avx2;
+	case DEMUX_SSSE3:
+		return demux22_ssse3;
+	case DEMUX_SSE2:
+		return demux22_sse2;
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return NULL;
+}
+
+/**
+ * \brief Select the demultiplexing kernel for 4x4 binned images
+ */
+demuxbinned_kernel	demux44_select() {
+#if DEMUX_X86
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return demux44_avx2;
+	case DEMUX_SSSE3:
+		return demux44_ssse3;
+	case DEMUX_SSE2:
+		return demux44_sse2;
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return NULL;
+}
+
+/**
+ * \brief Select the 32 bit demultiplexing kernel for 2x2 binned images
+ *
+ * The SSSE3 level has nothing to add to the SSE2 kernel.
+ */
+demuxwide_kernel	demux22wide_select() {
+#if DEMUX_X86
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return demux22wide_avx2;
+	case DEMUX_SSSE3:
+	case DEMUX_SSE2:
+		return demux22wide_sse2;
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return NULL;
+}
+
+/**
+ * \brief Select the 32 bit demultiplexing kernel for 4x4 binned images
+ */
+demuxwide_kernel	demux44wide_select() {
+#if DEMUX_X86
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return demux44wide_avx2;
+	case DEMUX_SSSE3:
+	case DEMUX_SSE2:
+		return demux44wide_sse2;
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return NULL;
+}
+
+/**
+ * \brief Select the kernel converting unsigned short pixels to float
+ */
+tofloat16_kernel	tofloat16_select() {
+#if DEMUX_X86
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return tofloat16_avx2;
+	case DEMUX_SSSE3:
+	case DEMUX_SSE2:
+		return tofloat16_sse2;
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return NULL;
+}
+
+/**
+ * \brief Select the kernel converting unsigned int pixels to float
+ */
+tofloat32_kernel	tofloat32_select() {
+#if DEMUX_X86
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return tofloat32_avx2;
+	case DEMUX_SSSE3:
+	case DEMUX_SSE2:
+		return tofloat32_sse2;
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return NULL;
+}
+
+/**
+ * \brief Select the kernel adding unsigned short pixels to 32 bit sums
+ */
+accumulate16_kernel	accumulate16_select() {
+#if DEMUX_X86
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return accumulate16_avx2;
+	case DEMUX_SSSE3:
+	case DEMUX_SSE2:
+		return accumulate16_sse2;
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return NULL;
+}
+
+/**
+ * \brief Index of the calibration kernel variant in the tables below
+ */
+static inline unsigned int	calibrate_variant(bool offset, bool gain) {
+	return ((offset) ? 2 : 0) + ((gain) ? 1 : 0);
+}
+
+/**
+ * \brief Select the kernel calibrating pixels to 16 bits
+ *
+ * Unlike the other kernels, there is a scalar calibration kernel, so
+ * the result is never NULL.
+ *
+ * \param offset	whether the kernel has to subtract an offset
+ * \param gain		whether the kernel has to multiply by a gain
+ */
+calibrate16_kernel	calibrate16_select(bool offset, bool gain) {
+	static const calibrate16_kernel	scalar[4] = {
+		calibrate16_scalar<false, false>,
+		calibrate16_scalar<false, true>,
+		calibrate16_scalar<true, false>,
+		calibrate16_scalar<true, true>
+	};
+#if DEMUX_X86
+	static const calibrate16_kernel	avx2[4] = {
+		calibrate16_avx2<false, false>, calibrate16_avx2<false, true>,
+		calibrate16_avx2<true, false>, calibrate16_avx2<true, true>
+	};
+	static const calibrate16_kernel	sse2[4] = {
+		calibrate16_sse2<false, false>, calibrate16_sse2<false, true>,
+		calibrate16_sse2<true, false>, calibrate16_sse2<true, true>
+	};
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return avx2[calibrate_variant(offset, gain)];
+	case DEMUX_SSSE3:
+	case DEMUX_SSE2:
+		return sse2[calibrate_variant(offset, gain)];
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return scalar[calibrate_variant(offset, gain)];
+}
+
+/**
+ * \brief Select the kernel calibrating pixels to floating point
+ */
+calibratefloat_kernel	calibratefloat_select(bool offset, bool gain) {
+	static const calibratefloat_kernel	scalar[4] = {
+		calibratefloat_scalar<false, false>,
+		calibratefloat_scalar<false, true>,
+		calibratefloat_scalar<true, false>,
+		calibratefloat_scalar<true, true>
+	};
+#if DEMUX_X86
+	static const calibratefloat_kernel	avx2[4] = {
+		calibratefloat_avx2<false, false>,
+		calibratefloat_avx2<false, true>,
+		calibratefloat_avx2<true, false>,
+		calibratefloat_avx2<true, true>
+	};
+	static const calibratefloat_kernel	sse2[4] = {
+		calibratefloat_sse2<false, false>,
+		calibratefloat_sse2<false, true>,
+		calibratefloat_sse2<true, false>,
+		calibratefloat_sse2<true, true>
+	};
+	switch (demux_level()) {
+	case DEMUX_AVX2:
+		return avx2[calibrate_variant(offset, gain)];
+	case DEMUX_SSSE3:
+	case DEMUX_SSE2:
+		return sse2[calibrate_variant(offset, gain)];
+	default:
+		break;
+	}
+#endif /* DEMUX_X86 */
+	return scalar[calibrate_variant(offset, gain)];
+}
+
+} // namespace qhy
@@ -0,0 +1,138 @@
+/*
+ * demuxreference.cpp -- demultiplexing code of the SDK, kept as the
+ *                       reference for the optimized code
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <demuxreference.h>
+#include <utils.h>
+
+namespace qhy {
+
+/**
+ * \brief Demultiplexing for unbinned images
+ *
+ * This code comes more or less straight from the SDK provided by QHYCCD.
+ * Each raw line yields two image lines, so the offsets into raw data and
+ * image for the first line to convert can be computed directly.
+ */
+void	demux11reference(ImageBuffer& image, const Buffer& buffer,
+		int PixShift, int width, int height,
+		unsigned int firstline, unsigned int lastline) {
+	if (lastline > (unsigned int)height/2) {
+		lastline = height/2;
+	}
+	
+    long s,p,m,n;
+
+    s=PixShift*2 + firstline*width*4;
+    p=firstline*width*4;
+    m=0;
+    n=0;
+
+    for (n=firstline; n < lastline; n++)
+    {
+        for (m=0;m < width/2;m++)
+        {
+            image[p+3] = buffer[s+6];  //Gb
+            image[p+2] = buffer[s+7];
+            image[p+1] = buffer[s+4];
+            image[p+0] = buffer[s+5];
+
+            s = s + 8;
+            p = p + 4;
+        }
+
+        s=s-width*4;
+        for (m=0;m< width/2;m++)
+        {
+            image[p+3-2]  = buffer[s+2];
+            image[p+2-2]  = buffer[s+3];
+            image[p+1-2]  = buffer[s+0];//Gr
+            image[p+0-2]  = buffer[s+1];
+
+            s=s+8;
+            p=p+4;
+        }
+    }
+}
+
+/**
+ * \brief Demultiplexing for 2x2 binned images
+ *
+ * Note that binning is only partially done on chip, only binning
+ * in the horizontal direction is done by the CCD. The other direction
+ * is done numerically in the demultiplexing function.
+ * This code comes more or less straight from the SDK provided by QHYCCD
+ */
+void	demux22reference(ImageBuffer& image, const Buffer& buffer,
+		int PixShift, int width, int height,
+		unsigned int firstline, unsigned int lastline) {
+	if (lastline > (unsigned int)height) {
+		lastline = height;
+	}
+        long s,k;
+        unsigned long binpixel;
+
+        s=PixShift*2 + firstline*width*4;
+        k=firstline*width*2;
+
+        for (int i=firstline;i<(int)lastline;i++)
+        {
+                for (int j=0;j<width;j++)
+                {
+                        binpixel = buffer[s]*256 + buffer[s+1] + buffer[s+2]*256 + buffer[s+3];
+                        if (binpixel>65535) binpixel=65535;
+                        image[k]=LSB((unsigned short)binpixel);
+                        k=k+1;
+                        image[k]=MSB((unsigned short)binpixel);
+                        k=k+1;
+                        s=s+4;
+                }
+        }
+}
+
+/**
+ * \brief Demultiplexing for 4x4 binned images
+ *
+ * Note that binning is only partially done on chip, only 2x2 binning
+ * is done by the CCD. The remaining binning is done numerically in the
+ * demultiplexing function.
+ * This code comes more or less straight from the SDK provided by QHYCCD
+ */
+void	demux44reference(ImageBuffer& image, const Buffer& buffer,
+		int PixShift, int width, int height,
+		unsigned int firstline, unsigned int lastline) {
+	if (lastline > (unsigned int)height) {
+		lastline = height;
+	}
+
+        long s,k;
+        unsigned long binpixel;
+
+        s=PixShift*2 + firstline*width*8;
+        k=firstline*width*2;
+
+        for (int i=firstline;i<(int)lastline;i++){
+          for (int j=0;j<width;j++){
+                        binpixel=(buffer[s]+buffer[s+2]+buffer[s+4]+buffer[s+6])*256
+                                        + buffer[s+1]+buffer[s+3]+buffer[s+5]+buffer[s+7];
+
+                        if (binpixel>65535) binpixel=65535;
+                        image[k]=LSB((unsigned short)binpixel);
+                        k=k+1;
+                        image[k]=MSB((unsigned short)binpixel);
+                        k=k+1;
+
+                s=s+8;
+
+
+          }
+
+        }
+}
+
+} // namespace qhy
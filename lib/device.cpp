@@ -5,6 +5,13 @@
  */
 #include <qhylib.h>
 #include <device.h>
+#include <replaytransport.h>
+#include <recordingtransport.h>
+#include <libusbtransport.h>
+#include <devicemanager.h>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
 
 namespace qhy {
 
@@ -27,4 +34,80 @@ DevicePtr	getDevice(unsigned short idVendor, unsigned short idProduct) {
 	return DevicePtr(new PDevice(idVendor, idProduct));
 }
 
+/**
+ * \brief Location of the device in the form bus-p1.p2.p3
+ */
+std::string	DeviceInfo::location() const {
+	char	buffer[16];
+	snprintf(buffer, sizeof(buffer), "%d", bus);
+	std::string	result(buffer);
+	for (unsigned int i = 0; i < ports.size(); i++) {
+		snprintf(buffer, sizeof(buffer), "%c%d", (i) ? '.' : '-',
+			ports[i]);
+		result.append(buffer);
+	}
+	return result;
+}
+
+/**
+ * \brief Set bus and port path from a location of the form bus-p1.p2.p3
+ */
+void	DeviceInfo::location(const std::string& location) {
+	const char	*p = location.c_str();
+	char	*end;
+	long	b = strtol(p, &end, 10);
+	if ((end == p) || (*end != '-') || (b < 0) || (b > 255)) {
+		throw std::runtime_error("bad device location " + location);
+	}
+	std::vector<unsigned char>	path;
+	do {
+		p = end + 1;
+		long	port = strtol(p, &end, 10);
+		if ((end == p) || (port < 1) || (port > 255)) {
+			throw std::runtime_error("bad device location "
+				+ location);
+		}
+		path.push_back(port);
+	} while (*end == '.');
+	if (*end) {
+		throw std::runtime_error("bad device location " + location);
+	}
+	bus = b;
+	ports = path;
+}
+
+/**
+ * \brief Human readable description of a device
+ */
+std::string	DeviceInfo::toString() const {
+	char	buffer[128];
+	snprintf(buffer, sizeof(buffer), "%04x/%04x at %s address %d",
+		idVendor, idProduct, location().c_str(), address);
+	std::string	result(buffer);
+	if (serial.size() > 0) {
+		result.append(" serial ");
+		result.append(serial);
+	}
+	return result;
+}
+
+std::vector<DeviceInfo>	listDevices() {
+	return DeviceManager::get()->list();
+}
+
+DevicePtr	getDevice(const DeviceInfo& info) {
+	return DevicePtr(new PDevice(new LibusbTransport(info)));
+}
+
+DevicePtr	getRecordingDevice(unsigned short idVendor,
+	unsigned short idProduct, const std::string& tracefile) {
+	Transport	*transport = new LibusbTransport(idVendor, idProduct);
+	return DevicePtr(new PDevice(new RecordingTransport(transport,
+		tracefile)));
+}
+
+DevicePtr	getReplayDevice(const std::string& tracefile, bool realtime) {
+	return DevicePtr(new PDevice(new ReplayTransport(tracefile, realtime)));
+}
+
 } // namespace qhy
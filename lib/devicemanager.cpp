@@ -0,0 +1,257 @@
+/*
+ * devicemanager.cpp -- process wide management of libusb resources
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <devicemanager.h>
+#include <device.h>
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <utils.h>
+
+namespace qhy {
+
+std::mutex	DeviceManager::_mutex;
+std::weak_ptr<DeviceManager>	DeviceManager::_manager;
+
+/**
+ * \brief main function for the event thread
+ */
+static void	events_main(void *arg) {
+	try {
+		DeviceManager	*manager = (DeviceManager *)arg;
+		manager->main();
+	} catch (const std::exception& x) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "event thread failed: %s",
+			x.what());
+	}
+}
+
+/**
+ * \brief Create the libusb context and start the event thread
+ */
+DeviceManager::DeviceManager() : _ctx(NULL), _stop(0) {
+	int	rc = libusb_init(&_ctx);
+	if (rc) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot init USB: %s (%d)",
+			usbcause(rc).c_str(), rc);
+		throw USBError(rc);
+	}
+
+#if HAVE_LIBUSB_SET_DEBUG
+#if USBDEBUG
+	if (qhydebuglevel == LOG_DEBUG) {
+		libusb_set_debug(_ctx, 4 /* LIBUSB_LOG_LEVEL_DEBUG */);
+	}
+#endif
+#endif
+
+	try {
+		_thread = std::thread(events_main, this);
+	} catch (const std::exception& x) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot launch thread: %s",
+			x.what());
+		libusb_exit(_ctx);
+		throw std::runtime_error("cannot start event thread");
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "USB event thread started");
+}
+
+/**
+ * \brief Stop the event thread and release the context
+ */
+DeviceManager::~DeviceManager() {
+	_stop = 1;
+#if HAVE_LIBUSB_INTERRUPT_EVENT_HANDLER
+	libusb_interrupt_event_handler(_ctx);
+#endif
+	_thread.join();
+	libusb_exit(_ctx);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "USB event thread stopped");
+}
+
+/**
+ * \brief Get the device manager, creating it if necessary
+ */
+DeviceManagerPtr	DeviceManager::get() {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	DeviceManagerPtr	manager = _manager.lock();
+	if (!manager) {
+		manager = DeviceManagerPtr(new DeviceManager());
+		_manager = manager;
+	}
+	return manager;
+}
+
+/**
+ * \brief main method of the event thread
+ *
+ * The loop wakes up at least every 100ms to check whether it should
+ * end, in case libusb cannot interrupt the event handler. The stop flag
+ * is not handed to libusb as the completion flag, libusb would read it
+ * without synchronization with the destructor.
+ */
+void	DeviceManager::main() {
+	while (!_stop) {
+		struct timeval	tv = { 0, 100000 };
+		int	rc = libusb_handle_events_timeout_completed(_ctx, &tv,
+				NULL);
+		if ((rc < 0) && (rc != LIBUSB_ERROR_INTERRUPTED)) {
+			qhydebug(LOG_ERR, DEBUG_LOG, 0,
+				"event handling failed: %s",
+				usbcause(rc).c_str());
+		}
+	}
+}
+
+/**
+ * \brief Read the serial number of a device
+ *
+ * Returns an empty string if the device has no serial number or
+ * cannot be opened, e.g. because of missing permissions.
+ */
+static std::string	serialnumber(libusb_device *dev,
+				libusb_device_handle *handle,
+				uint8_t iSerialNumber) {
+	if (0 == iSerialNumber) {
+		return std::string();
+	}
+	libusb_device_handle	*h = handle;
+	if (NULL == h) {
+		int	rc = libusb_open(dev, &h);
+		if (rc) {
+			qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
+				"cannot open device for serial: %s",
+				usbcause(rc).c_str());
+			return std::string();
+		}
+	}
+	unsigned char	buffer[256];
+	int	rc = libusb_get_string_descriptor_ascii(h, iSerialNumber,
+			buffer, sizeof(buffer) - 1);
+	if (NULL == handle) {
+		libusb_close(h);
+	}
+	if (rc < 0) {
+		return std::string();
+	}
+	buffer[rc] = '\0';
+	return std::string((char *)buffer);
+}
+
+/**
+ * \brief Path of port numbers from the root hub to a device
+ *
+ * USB allows at most 7 tiers, so the path has at most 7 ports.
+ */
+static std::vector<unsigned char>	portpath(libusb_device *dev) {
+	uint8_t	ports[7];
+	int	n = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	if (n < 0) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot get port path: %s",
+			usbcause(n).c_str());
+		n = 0;
+	}
+	return std::vector<unsigned char>(ports, ports + n);
+}
+
+/**
+ * \brief Describe a device
+ */
+static DeviceInfo	deviceinfo(libusb_device *dev,
+				const libusb_device_descriptor& desc) {
+	DeviceInfo	info;
+	info.idVendor = desc.idVendor;
+	info.idProduct = desc.idProduct;
+	info.bus = libusb_get_bus_number(dev);
+	info.ports = portpath(dev);
+	info.address = libusb_get_device_address(dev);
+	return info;
+}
+
+/**
+ * \brief List all supported devices
+ */
+std::vector<DeviceInfo>	DeviceManager::list() {
+	std::vector<DeviceInfo>	result;
+	libusb_device	**devlist;
+	ssize_t	n = libusb_get_device_list(_ctx, &devlist);
+	if (n < 0) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot list devices: %s",
+			usbcause(n).c_str());
+		throw USBError(n);
+	}
+	for (ssize_t i = 0; i < n; i++) {
+		libusb_device_descriptor	desc;
+		if (libusb_get_device_descriptor(devlist[i], &desc)) {
+			continue;
+		}
+		if (!PDevice::supported(desc.idVendor, desc.idProduct)) {
+			continue;
+		}
+		DeviceInfo	info = deviceinfo(devlist[i], desc);
+		info.serial = serialnumber(devlist[i], NULL,
+			desc.iSerialNumber);
+		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "found %s",
+			info.toString().c_str());
+		result.push_back(info);
+	}
+	libusb_free_device_list(devlist, 1);
+	return result;
+}
+
+/**
+ * \brief Open the device described by a DeviceInfo
+ */
+libusb_device_handle	*DeviceManager::open(const DeviceInfo& info) {
+	libusb_device	**devlist;
+	ssize_t	n = libusb_get_device_list(_ctx, &devlist);
+	if (n < 0) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot list devices: %s",
+			usbcause(n).c_str());
+		throw USBError(n);
+	}
+	libusb_device_handle	*handle = NULL;
+	for (ssize_t i = 0; (i < n) && (NULL == handle); i++) {
+		libusb_device	*dev = devlist[i];
+		if ((libusb_get_bus_number(dev) != info.bus)
+			|| (portpath(dev) != info.ports)) {
+			continue;
+		}
+		libusb_device_descriptor	desc;
+		if (libusb_get_device_descriptor(dev, &desc)) {
+			continue;
+		}
+		if ((desc.idVendor != info.idVendor)
+			|| (desc.idProduct != info.idProduct)) {
+			continue;
+		}
+		int	rc = libusb_open(dev, &handle);
+		if (rc) {
+			libusb_free_device_list(devlist, 1);
+			qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot open %s: %s",
+				info.toString().c_str(), usbcause(rc).c_str());
+			throw USBError(rc);
+		}
+		if (info.serial.size() > 0) {
+			std::string	serial = serialnumber(dev, handle,
+						desc.iSerialNumber);
+			if (serial != info.serial) {
+				libusb_close(handle);
+				handle = NULL;
+			}
+		}
+	}
+	libusb_free_device_list(devlist, 1);
+	if (NULL == handle) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "device %s not found",
+			info.toString().c_str());
+		throw DeviceNotFound("device not found");
+	}
+	return handle;
+}
+
+} // namespace qhy
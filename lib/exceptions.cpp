@@ -53,7 +53,8 @@ std::string	usbcause(int usberror) {
 }
 #endif
 
-USBError::USBError(int usberror) : std::runtime_error(usbcause(usberror)) {
+USBError::USBError(int usberror) : std::runtime_error(usbcause(usberror)),
+	_usberror(usberror) {
 }
 
 } // namespace qhy
@@ -10,6 +10,22 @@
 
 namespace qhy {
 
+/**
+ * \brief Find out whether a device is a camera known to the factory
+ */
+bool	PDevice::supported(unsigned short idVendor, unsigned short idProduct) {
+	if (idVendor != 0x1618) {
+		return false;
+	}
+	switch (idProduct) {
+	case 0x6003:
+		return true;
+	default:
+		break;
+	}
+	return false;
+}
+
 /**
  * \brief Camera factory method
  */
@@ -22,23 +38,16 @@ Camera&	PDevice::camera() {
 	// if there is no camera yet, we have to create a camera. What camera
 	// object we construct depends on the vendor id and product id of
 	// the camera
-	struct libusb_device_descriptor	desc;
-	int	rc = libusb_get_device_descriptor(libusb_get_device(handle),
-			&desc);
-	if (rc < 0) {
-		qhydebug(LOG_ERR, DEBUG_LOG, 0,
-			"cann0t get device descriptor: %s",
-			libusb_strerror((enum libusb_error)rc));
-		throw USBError(rc);
-	}
-	if (desc.idVendor != 0x1618) {
+	unsigned short	idVendor = _transport->idVendor();
+	unsigned short	idProduct = _transport->idProduct();
+	if (idVendor != 0x1618) {
 		throw NotSupported("camera vendor not known");
 	}
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "creating device %04x/%04x",
-		desc.idVendor, desc.idProduct);
+		idVendor, idProduct);
 
 	// create cameras depending on the product id
-	switch (desc.idProduct) {
+	switch (idProduct) {
 	case 0x6003:
 		_camera = new Qhy8Pro(*this);
 		break;
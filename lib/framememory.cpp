@@ -0,0 +1,139 @@
+/*
+ * framememory.cpp -- memory for the raw data of images
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <framememory.h>
+#include <qhydebug.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif /* HAVE_SYS_MMAN_H */
+
+namespace qhy {
+
+// kinds of memory handed out, used as cookies of the buffers
+#define FRAMEMEMORY_HEAP	0
+#define FRAMEMEMORY_HUGEPAGES	1
+#define FRAMEMEMORY_LOCKED	2
+#define FRAMEMEMORY_DMA		3
+
+static const unsigned long	hugepagesize = 2 * 1024 * 1024;
+
+/**
+ * \brief Create an allocator using heap memory
+ */
+FrameAllocator::FrameAllocator(Transport& transport) : _transport(transport),
+	_memory(Camera::HeapMemory), _lock(false) {
+}
+
+/**
+ * \brief Change the kind of memory used for new buffers
+ *
+ * \return	true if the configuration changed
+ */
+bool	FrameAllocator::configure(enum Camera::FrameMemory memory, bool lock) {
+	if ((memory == _memory) && (lock == _lock)) {
+		return false;
+	}
+	_memory = memory;
+	_lock = lock;
+	return true;
+}
+
+/**
+ * \brief Allocate memory aligned to huge pages
+ *
+ * The memory is advised for transparent huge pages and, if requested,
+ * locked into RAM. Returns NULL if no aligned memory can be allocated.
+ */
+unsigned char	*FrameAllocator::hugepages(unsigned long length, int& cookie) {
+	unsigned long	rounded = ((length + hugepagesize - 1) / hugepagesize)
+				* hugepagesize;
+	void	*data = NULL;
+	int	rc = posix_memalign(&data, hugepagesize, rounded);
+	if (rc) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot allocate %lu aligned "
+			"bytes: %s", rounded, strerror(rc));
+		return NULL;
+	}
+	cookie = FRAMEMEMORY_HUGEPAGES;
+#ifdef MADV_HUGEPAGE
+	if (madvise(data, rounded, MADV_HUGEPAGE)) {
+		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "no huge pages: %s",
+			strerror(errno));
+	}
+#endif /* MADV_HUGEPAGE */
+#ifdef HAVE_SYS_MMAN_H
+	if (_lock) {
+		if (mlock(data, rounded)) {
+			qhydebug(LOG_WARNING, DEBUG_LOG, 0,
+				"cannot lock %lu bytes: %s", rounded,
+				strerror(errno));
+		} else {
+			cookie = FRAMEMEMORY_LOCKED;
+		}
+	}
+#endif /* HAVE_SYS_MMAN_H */
+	return (unsigned char *)data;
+}
+
+/**
+ * \brief Allocate memory of the configured kind, or the next best kind
+ */
+unsigned char	*FrameAllocator::allocate(unsigned long length, int& cookie) {
+	unsigned char	*data = NULL;
+	switch (_memory) {
+	case Camera::DMAMemory:
+		data = _transport.dmaalloc(length);
+		if (data) {
+			cookie = FRAMEMEMORY_DMA;
+			return data;
+		}
+		qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
+			"no DMA memory, falling back to huge pages");
+		// fall through
+	case Camera::HugePageMemory:
+		data = hugepages(length, cookie);
+		if (data) {
+			return data;
+		}
+		// fall through
+	case Camera::HeapMemory:
+		break;
+	}
+	cookie = FRAMEMEMORY_HEAP;
+	return new unsigned char[length];
+}
+
+/**
+ * \brief Release memory according to its kind
+ */
+void	FrameAllocator::release(unsigned char *data, unsigned long length,
+		int cookie) {
+	switch (cookie) {
+	case FRAMEMEMORY_DMA:
+		_transport.dmafree(data, length);
+		return;
+	case FRAMEMEMORY_LOCKED:
+#ifdef HAVE_SYS_MMAN_H
+		munlock(data, ((length + hugepagesize - 1) / hugepagesize)
+			* hugepagesize);
+#endif /* HAVE_SYS_MMAN_H */
+		// fall through
+	case FRAMEMEMORY_HUGEPAGES:
+		free(data);
+		return;
+	default:
+		delete[] data;
+		return;
+	}
+}
+
+} // namespace qhy
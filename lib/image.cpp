@@ -7,25 +7,30 @@
 #include <config.h>
 #endif /* HAVE_CONFIG_H */
 #include <stdexcept>
+#include <cstring>
 #include <qhylib.h>
 #include <qhydebug.h>
+#include <tracing.h>
+#include <demux.h>
 
 namespace qhy {
 
 /**
  * \brief common memory allocation for ImageBuffers
  */
-void	ImageBuffer::setup() {
+template<typename Pixel>
+void	Image<Pixel>::setup() {
 	_npixels = _height * _width;
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "allocating buffer for %d pixels", _npixels);
-	buffersize = 2 * _npixels;
-	_pixelbuffer = new unsigned short[_npixels];
+	buffersize = sizeof(Pixel) * _npixels;
+	_pixelbuffer = new Pixel[_npixels];
 }
 
 /**
  * \brief Create an ImageBuffer
  */
-ImageBuffer::ImageBuffer(unsigned int width, unsigned int height)
+template<typename Pixel>
+Image<Pixel>::Image(unsigned int width, unsigned int height)
 	: _width(width), _height(height) {
 	setup();
 }
@@ -33,7 +38,8 @@ ImageBuffer::ImageBuffer(unsigned int width, unsigned int height)
 /**
  * \brief Create an ImageBuffer 
  */
-ImageBuffer::ImageBuffer(const ImageSize& size) {
+template<typename Pixel>
+Image<Pixel>::Image(const ImageSize& size) {
 	_width = size.width();
 	_height = size.height();
 	setup();
@@ -42,7 +48,8 @@ ImageBuffer::ImageBuffer(const ImageSize& size) {
 /**
  * \brief Destroy an ImageBuffer
  */
-ImageBuffer::~ImageBuffer() {
+template<typename Pixel>
+Image<Pixel>::~Image() {
 	delete[] _pixelbuffer;
 }
 
@@ -52,7 +59,8 @@ ImageBuffer::~ImageBuffer() {
  * If range checking is enabled, this method throws a std::range_error
  * exception if the pixel coordinates are outside the image.
  */
-unsigned short	ImageBuffer::p(unsigned int x, unsigned int y) const {
+template<typename Pixel>
+Pixel	Image<Pixel>::p(unsigned int x, unsigned int y) const {
 #if ENABLE_RANGECHECK
 	if (!((x < _width) && (y < _height))) {
 		throw std::range_error("pixel coordinates outside image");
@@ -67,7 +75,8 @@ unsigned short	ImageBuffer::p(unsigned int x, unsigned int y) const {
  * If range checking is enabled, this method throws a std::range_error
  * exception if the pixel coordinates are outside the image.
  */
-unsigned short&	ImageBuffer::p(unsigned int x, unsigned int y) {
+template<typename Pixel>
+Pixel&	Image<Pixel>::p(unsigned int x, unsigned int y) {
 #if ENABLE_RANGECHECK
 	if (!((x < _width) && (y < _height))) {
 		throw std::range_error("pixel coordinates outside image");
@@ -84,7 +93,8 @@ unsigned short&	ImageBuffer::p(unsigned int x, unsigned int y) {
  * If range checking is enabled, this method throws a std::range_error
  * exception if the index is outside pixel buffer.
  */
-const unsigned char&	ImageBuffer::operator[](unsigned int i) const {
+template<typename Pixel>
+const unsigned char&	Image<Pixel>::operator[](unsigned int i) const {
 #if ENABLE_RANGECHECK
 	if (i >= buffersize) {
 		throw std::range_error("index too large");
@@ -101,7 +111,8 @@ const unsigned char&	ImageBuffer::operator[](unsigned int i) const {
  * If range checking is enabled, this method throws a std::range_error
  * exception if the index is outside pixel buffer.
  */
-unsigned char&	ImageBuffer::operator[](unsigned int i) {
+template<typename Pixel>
+unsigned char&	Image<Pixel>::operator[](unsigned int i) {
 #if ENABLE_RANGECHECK
 	if (i >= buffersize) {
 		throw std::range_error("index too large");
@@ -116,7 +127,8 @@ unsigned char&	ImageBuffer::operator[](unsigned int i) {
  * This method uses points from within the active area, the point (0,0)
  * is a corner of the active area.
  */
-unsigned short	ImageBuffer::ap(unsigned int x, unsigned int y) const {
+template<typename Pixel>
+Pixel	Image<Pixel>::ap(unsigned int x, unsigned int y) const {
 #if ENABLE_RANGECHECK
 	if (x >= _active.size.width()) {
 		throw std::range_error("x offset too large");
@@ -135,7 +147,8 @@ unsigned short	ImageBuffer::ap(unsigned int x, unsigned int y) const {
  * This method uses access to the active area if the active area is
  * defined, and returns the whole buffer otherwise.
  */
-unsigned short	ImageBuffer::pixel(unsigned int x, unsigned int y) const {
+template<typename Pixel>
+Pixel	Image<Pixel>::pixel(unsigned int x, unsigned int y) const {
 	if (_active.size.empty()) {
 		return ap(x, y);
 	}
@@ -145,26 +158,101 @@ unsigned short	ImageBuffer::pixel(unsigned int x, unsigned int y) const {
 /**
  * \brief Extract the active pixels from an image buffer
  */
-ImageBufferPtr	ImageBuffer::active_buffer() const {
+template<typename Pixel>
+std::shared_ptr<Image<Pixel> >	Image<Pixel>::active_buffer() const {
+	TraceSpan	span("active_buffer");
 	// handle the case that we don't have an active area defined,
 	// just copy the whole image
 	if (_active.empty()) {
-		ImageBufferPtr	result(new ImageBuffer(_width, _height));
+		std::shared_ptr<Image>	result(new Image(_width, _height));
 		long	s = _width * _height;
 		for (long i = 0; i < s; i++) {
 			result->pixelbuffer()[i] = _pixelbuffer[i];
 		}
+		result->metrics(_metrics);
+		result->statistics(_statistics);
 		return result;
 	}
+	// copy complete rows of the active area, in the same order as ap()
 	ImageSize	s = active_size();
-	ImageBufferPtr	result(new ImageBuffer(s));
-	long	i = 0;
+	if ((_active.origin.x() < 0) || (_active.origin.y() < 0)
+		|| (_active.origin.x() + s.width() > (int)_width)
+		|| (_active.origin.y() + s.height() > (int)_height)) {
+		throw std::range_error("active area outside image");
+	}
+	std::shared_ptr<Image>	result(new Image(s));
 	for (int y = 0; y < s.height(); y++) {
-		for (int x = 0; x < s.width(); x++) {
-			result->pixelbuffer()[i++] = ap(x, y);
-		}
+		const Pixel	*row = _pixelbuffer + _active.origin.x()
+			+ _width * (s.height() - 1 - y + _active.origin.y());
+		memcpy(result->pixelbuffer() + y * s.width(), row,
+			s.width() * sizeof(Pixel));
 	}
+	result->metrics(_metrics);
+	result->statistics(_statistics);
 	return result;
 }
 
+// the pixel types images can have
+template class Image<unsigned short>;
+template class Image<unsigned int>;
+template class Image<float>;
+
+/**
+ * \brief Convert unsigned short pixels to floating point
+ */
+void	floatpixels(const ImageBuffer& from, FloatImage& to) {
+	if (from.npixels() != to.npixels()) {
+		throw std::range_error("image sizes do not match");
+	}
+	tofloat16_kernel	kernel = tofloat16_select();
+	if (kernel) {
+		kernel(to.pixelbuffer(), from.pixelbuffer(), from.npixels());
+		return;
+	}
+	for (unsigned int i = 0; i < from.npixels(); i++) {
+		to.pixelbuffer()[i] = from.pixelbuffer()[i];
+	}
+}
+
+/**
+ * \brief Convert unsigned int pixels to floating point
+ */
+void	floatpixels(const ImageBuffer32& from, FloatImage& to) {
+	if (from.npixels() != to.npixels()) {
+		throw std::range_error("image sizes do not match");
+	}
+	tofloat32_kernel	kernel = tofloat32_select();
+	if (kernel) {
+		kernel(to.pixelbuffer(), from.pixelbuffer(), from.npixels());
+		return;
+	}
+	for (unsigned int i = 0; i < from.npixels(); i++) {
+		to.pixelbuffer()[i] = from.pixelbuffer()[i];
+	}
+}
+
+/**
+ * \brief Create a floating point copy of an image
+ *
+ * The copy has the same active area, metrics and statistics as the image.
+ */
+template<typename Pixel>
+static FloatImagePtr	floatcopy(const Image<Pixel>& image) {
+	TraceSpan	span("floatimage");
+	FloatImagePtr	result(new FloatImage(image.width(), image.height()));
+	floatpixels(image, *result);
+	result->active(image.active());
+	result->metrics(image.metrics());
+	result->statistics(image.statistics());
+	return result;
+}
+
+FloatImagePtr	floatimage(const ImageBuffer& image) {
+	return floatcopy(image);
+}
+
+FloatImagePtr	floatimage(const ImageBuffer32& image) {
+	return floatcopy(image);
+}
+
 } // namespace qhy
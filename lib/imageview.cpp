@@ -0,0 +1,102 @@
+/*
+ * imageview.cpp -- views of rectangles of an image buffer
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <qhylib.h>
+#include <stdexcept>
+#include <cstring>
+
+namespace qhy {
+
+/**
+ * \brief Create a view of the complete image
+ */
+ImageView::ImageView(ImageBufferPtr image)
+	: _image(image), _origin(image->pixelbuffer()),
+	  _size(image->width(), image->height()), _stride(image->width()) {
+}
+
+/**
+ * \brief Create a view of a rectangle of an image
+ *
+ * \param flip	whether the first row of the view should be the last
+ *		row of the rectangle
+ */
+ImageView::ImageView(ImageBufferPtr image, const ImageRectangle& rectangle,
+	bool flip)
+	: _image(image), _origin(NULL), _size(rectangle.size),
+	  _stride(image->width()) {
+	if ((rectangle.origin.x() < 0) || (rectangle.origin.y() < 0)
+		|| (rectangle.size.width() < 0) || (rectangle.size.height() < 0)
+		|| (rectangle.origin.x() + rectangle.size.width()
+			> (int)image->width())
+		|| (rectangle.origin.y() + rectangle.size.height()
+			> (int)image->height())) {
+		throw std::range_error("rectangle outside image");
+	}
+	int	y = rectangle.origin.y();
+	if (flip && (rectangle.size.height() > 0)) {
+		y += rectangle.size.height() - 1;
+		_stride = -_stride;
+	}
+	_origin = image->pixelbuffer() + rectangle.origin.x()
+			+ (long)y * image->width();
+}
+
+/**
+ * \brief Create a view of the active area of an image
+ *
+ * The view has the same orientation as ap() and active_buffer(), i.e.
+ * the rows of the active area appear in reverse order. If the image has
+ * no active area, the view contains the complete image.
+ */
+ImageView	ImageView::active(ImageBufferPtr image) {
+	if (image->active().empty()) {
+		return ImageView(image);
+	}
+	return ImageView(image, image->active(), true);
+}
+
+/**
+ * \brief Create a view of a rectangle of this view
+ *
+ * The rectangle is given in the coordinates of this view, flipping
+ * is relative to the orientation of this view.
+ */
+ImageView	ImageView::view(const ImageRectangle& rectangle, bool flip) const {
+	if ((rectangle.origin.x() < 0) || (rectangle.origin.y() < 0)
+		|| (rectangle.size.width() < 0) || (rectangle.size.height() < 0)
+		|| (rectangle.origin.x() + rectangle.size.width() > _size.width())
+		|| (rectangle.origin.y() + rectangle.size.height()
+			> _size.height())) {
+		throw std::range_error("rectangle outside view");
+	}
+	ImageView	result(*this);
+	result._size = rectangle.size;
+	int	y = rectangle.origin.y();
+	if (flip && (rectangle.size.height() > 0)) {
+		y += rectangle.size.height() - 1;
+		result._stride = -_stride;
+	}
+	result._origin = rowpointer(y) + rectangle.origin.x();
+	return result;
+}
+
+/**
+ * \brief Copy the pixels of the view into a new image buffer
+ */
+ImageBufferPtr	ImageView::copy() const {
+	ImageBufferPtr	result(new ImageBuffer(_size));
+	for (unsigned int y = 0; y < height(); y++) {
+		memcpy(result->pixelbuffer() + y * width(), rowpointer(y),
+			width() * sizeof(unsigned short));
+	}
+	result->metrics(_image->metrics());
+	return result;
+}
+
+} // namespace qhy
@@ -0,0 +1,337 @@
+/*
+ * libusbtransport.cpp -- USB transport based on libusb
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <libusbtransport.h>
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <utils.h>
+#include <condition_variable>
+#include <mutex>
+
+namespace qhy {
+
+/**
+ * \brief Convert the status of an asynchronous transfer to a libusb error
+ *
+ * The asynchronous API reports failures as a transfer status, but the
+ * USBError exception expects an error code as returned by the synchronous
+ * functions.
+ */
+static int	statuserror(enum libusb_transfer_status status) {
+	switch (status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		return LIBUSB_SUCCESS;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return LIBUSB_ERROR_TIMEOUT;
+	case LIBUSB_TRANSFER_CANCELLED:
+		return LIBUSB_ERROR_INTERRUPTED;
+	case LIBUSB_TRANSFER_STALL:
+		return LIBUSB_ERROR_PIPE;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return LIBUSB_ERROR_NO_DEVICE;
+	case LIBUSB_TRANSFER_OVERFLOW:
+		return LIBUSB_ERROR_OVERFLOW;
+	default:
+		break;
+	}
+	return LIBUSB_ERROR_IO;
+}
+
+/**
+ * \brief Bulk request based on an asynchronous libusb transfer
+ *
+ * The transfer is completed by the event thread of the device manager,
+ * the thread waiting for the request just blocks on a condition variable.
+ */
+class LibusbRequest : public BulkRequest {
+	libusb_device_handle	*_handle;
+	libusb_transfer	*_transfer;
+	bool	_done;
+	std::mutex	_mutex;
+	std::condition_variable	_cond;
+	static void	callback(libusb_transfer *transfer);
+public:
+	LibusbRequest(libusb_device_handle *handle, unsigned char endpoint);
+	virtual ~LibusbRequest();
+	virtual void	submit(unsigned char *data, int length,
+				unsigned int timeout);
+	virtual void	cancel();
+	virtual void	wait();
+};
+
+/**
+ * \brief Create a libusb bulk request
+ */
+LibusbRequest::LibusbRequest(libusb_device_handle *handle,
+	unsigned char endpoint) : BulkRequest(endpoint), _handle(handle) {
+	_transfer = libusb_alloc_transfer(0);
+	if (NULL == _transfer) {
+		throw USBError(LIBUSB_ERROR_NO_MEM);
+	}
+	_done = true;
+}
+
+/**
+ * \brief Destroy the request
+ *
+ * If the transfer is still in flight, it is cancelled first, so that
+ * libusb no longer accesses the buffer or the transfer structure.
+ */
+LibusbRequest::~LibusbRequest() {
+	if (!_completed) {
+		try {
+			cancel();
+			wait();
+		} catch (const std::exception& x) {
+			qhydebug(LOG_ERR, DEBUG_LOG, 0,
+				"cannot cancel transfer: %s", x.what());
+		}
+	}
+	libusb_free_transfer(_transfer);
+}
+
+/**
+ * \brief Completion callback, marks the transfer as done
+ *
+ * This runs on the event thread and wakes up the thread waiting
+ * for the request.
+ */
+void	LibusbRequest::callback(libusb_transfer *transfer) {
+	LibusbRequest	*request = (LibusbRequest *)transfer->user_data;
+	std::unique_lock<std::mutex>	lock(request->_mutex);
+	request->_done = true;
+	request->_cond.notify_all();
+}
+
+/**
+ * \brief Submit the transfer
+ */
+void	LibusbRequest::submit(unsigned char *data, int length,
+		unsigned int timeout) {
+	libusb_fill_bulk_transfer(_transfer, _handle, _endpoint,
+		data, length, callback, this, timeout);
+	_data = data;
+	_length = length;
+	_transferred = 0;
+	_status = 0;
+	_done = false;
+	int	rc = libusb_submit_transfer(_transfer);
+	if (rc < 0) {
+		_done = true;
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot submit transfer: %s",
+			usbcause(rc).c_str());
+		throw USBError(rc);
+	}
+	_completed = false;
+}
+
+/**
+ * \brief Cancel the transfer, it still has to be waited for
+ */
+void	LibusbRequest::cancel() {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	if (!_done) {
+		libusb_cancel_transfer(_transfer);
+	}
+}
+
+/**
+ * \brief Wait until the event thread has completed the transfer
+ */
+void	LibusbRequest::wait() {
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		while (!_done) {
+			_cond.wait(lock);
+		}
+	}
+	if (!_completed) {
+		_transferred = _transfer->actual_length;
+		_status = statuserror(_transfer->status);
+		_completed = true;
+	}
+}
+
+/**
+ * \brief Open a device through libusb
+ */
+LibusbTransport::LibusbTransport(unsigned short idVendor,
+	unsigned short idProduct)
+	: _idVendor(idVendor), _idProduct(idProduct) {
+	// initialize context and handle, to make sure
+	handle = NULL;
+	dataep = 0;
+
+	// all devices share the USB context of the device manager
+	manager = DeviceManager::get();
+	ctx = manager->context();
+
+	// get a device handle for the device
+	handle = libusb_open_device_with_vid_pid(ctx, idVendor, idProduct);
+	if (NULL == handle) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "could not open %04x/%04x",
+			idVendor, idProduct);
+		throw USBError(LIBUSB_ERROR_NOT_FOUND);
+	}
+	setup();
+}
+
+/**
+ * \brief Open a specific device through libusb
+ *
+ * This allows to address one of several identical cameras, as returned
+ * by listDevices().
+ */
+LibusbTransport::LibusbTransport(const DeviceInfo& info)
+	: _idVendor(info.idVendor), _idProduct(info.idProduct) {
+	handle = NULL;
+	dataep = 0;
+	manager = DeviceManager::get();
+	ctx = manager->context();
+	handle = manager->open(info);
+	setup();
+}
+
+/**
+ * \brief Find the data endpoint and claim the interface
+ */
+void	LibusbTransport::setup() {
+	// get the device
+	libusb_device	*dev = libusb_get_device(handle);
+
+	// get the active config descriptor
+	libusb_config_descriptor	*config = NULL;
+	libusb_get_active_config_descriptor(dev, &config);
+
+	// get a descriptor for interface 0
+	const libusb_interface	*interface = config->interface;
+	const libusb_interface_descriptor	*ifdesc = interface->altsetting;
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "interface has %d endpoints",
+		ifdesc->bNumEndpoints);
+	for (int epidx = 0; epidx < ifdesc->bNumEndpoints; epidx++) {
+		const libusb_endpoint_descriptor	*endpoint
+			= ifdesc->endpoint + epidx;
+		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "endpoint %d: %02x", epidx,
+			endpoint->bEndpointAddress);
+		// scan all endpoints and look for an IN endpoint with 512
+		// bytes maximum packet size, this is the data endpoint
+		if (endpoint->bEndpointAddress & 0x80) {
+			qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
+				"%02x has packet size %d",
+				(int)endpoint->bEndpointAddress,
+				(int)endpoint->wMaxPacketSize);
+			if (endpoint->wMaxPacketSize >= 512) {
+				dataep = endpoint->bEndpointAddress;
+			}
+		}
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "data endpoint is %02x", (int)dataep);
+
+	// clean up the descriptors
+	libusb_free_config_descriptor(config);
+
+	// claim the interface
+	int	rc = libusb_claim_interface(handle, 0);
+	if (rc) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot claim interface 0: %s",
+			libusb_strerror((enum libusb_error)rc));
+		libusb_close(handle);
+		throw USBError(rc);
+	}
+
+	// report success in openeing the device
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "device %04x/%04x opened",
+		_idVendor, _idProduct);
+}
+
+/**
+ * \brief Close the device
+ *
+ * The context is released by the device manager once the last device
+ * using it has been closed.
+ */
+LibusbTransport::~LibusbTransport() {
+	// close the device
+	if (handle) {
+		libusb_release_interface(handle, 0);
+		libusb_close(handle);
+		handle = NULL;
+	}
+}
+
+/**
+ * \brief control transfer encapsulation
+ *
+ * Performs a single control transfer
+ */
+int	LibusbTransport::controltransfer(uint8_t bmRequestType,
+		uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+		unsigned char *data, uint16_t wLength, unsigned int timeout) {
+	int	rc = libusb_control_transfer(handle, bmRequestType, bRequest,
+			wValue, wIndex, data, wLength, timeout);
+	if (rc < 0) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0,
+			"control transfer failed: %s (%d)",
+			libusb_strerror((enum libusb_error)rc), rc);
+		throw USBError(rc);
+	}
+	return rc;
+}
+
+/**
+ * \brief Perform a synchronous bulk transfer
+ */
+int	LibusbTransport::bulktransfer(unsigned char ep, unsigned char *data,
+		int length, unsigned int timeout) {
+	int	transferred;
+	int	rc = libusb_bulk_transfer(handle, ep, data, length,
+			&transferred, timeout);
+	if (rc < 0) {
+		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "transfer failed: %s (%d)",
+			libusb_strerror((enum libusb_error)rc), rc);
+		throw USBError(rc);
+	}
+	return transferred;
+}
+
+/**
+ * \brief Create an asynchronous bulk request for an endpoint
+ */
+BulkRequest	*LibusbTransport::bulkrequest(unsigned char ep) {
+	return new LibusbRequest(handle, ep);
+}
+
+/**
+ * \brief Allocate memory mapped from the USB driver
+ *
+ * Transfers into this memory are done by DMA without copying the data
+ * through a kernel buffer. Returns NULL if libusb or the kernel do not
+ * support this.
+ */
+unsigned char	*LibusbTransport::dmaalloc(unsigned long length) {
+#if HAVE_LIBUSB_DEV_MEM_ALLOC
+	return libusb_dev_mem_alloc(handle, length);
+#else
+	return NULL;
+#endif /* HAVE_LIBUSB_DEV_MEM_ALLOC */
+}
+
+/**
+ * \brief Release memory allocated with dmaalloc()
+ */
+void	LibusbTransport::dmafree(unsigned char *data, unsigned long length) {
+#if HAVE_LIBUSB_DEV_MEM_ALLOC
+	int	rc = libusb_dev_mem_free(handle, data, length);
+	if (rc) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot free DMA memory: %s",
+			usbcause(rc).c_str());
+	}
+#endif /* HAVE_LIBUSB_DEV_MEM_ALLOC */
+}
+
+} // namespace qhy
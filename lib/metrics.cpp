@@ -0,0 +1,202 @@
+/*
+ * metrics.cpp -- per frame and process wide performance metrics
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <metrics.h>
+#include <qhydebug.h>
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+
+namespace qhy {
+
+/**
+ * \brief Create an empty frame metrics record
+ */
+FrameMetrics::FrameMetrics() : registers(0), exposurestart(0),
+	firstpatch(0), lastpatch(0), allocationtime(0), demuxtime(0),
+	bytes(0), patches(0), shortpatches(0), intervalmin(0),
+	intervalmax(0), interval50(0), interval90(0), interval99(0) {
+}
+
+/**
+ * \brief Human readable summary of the frame metrics
+ */
+std::string	FrameMetrics::toString() const {
+	char	buffer[512];
+	snprintf(buffer, sizeof(buffer),
+		"%lu bytes in %u patches (%u short), "
+		"exposure %.3fs after registers, "
+		"first patch after %.3fs, readout %.3fs, "
+		"patch interval min %.6f median %.6f 90%% %.6f 99%% %.6f "
+		"max %.6f, allocation %.6fs, demux %.6fs",
+		bytes, patches, shortpatches,
+		exposurestart - registers, firstpatch - exposurestart,
+		lastpatch - firstpatch, intervalmin, interval50, interval90,
+		interval99, intervalmax, allocationtime, demuxtime);
+	return std::string(buffer);
+}
+
+/**
+ * \brief Create an empty histogram
+ */
+Histogram::Histogram() : count(0), sum(0), min(0), max(0) {
+	double	decade = 1e-6;
+	while (decade < 1000) {
+		bounds.push_back(decade);
+		bounds.push_back(2 * decade);
+		bounds.push_back(5 * decade);
+		decade *= 10;
+	}
+	counts.resize(bounds.size() + 1, 0);
+}
+
+/**
+ * \brief Add a value to the histogram
+ */
+void	Histogram::add(double value) {
+	unsigned int	i = std::lower_bound(bounds.begin(), bounds.end(), value)
+				- bounds.begin();
+	counts[i]++;
+	if ((0 == count) || (value < min)) {
+		min = value;
+	}
+	if ((0 == count) || (value > max)) {
+		max = value;
+	}
+	count++;
+	sum += value;
+}
+
+/**
+ * \brief Human readable form of the histogram, empty buckets are omitted
+ */
+std::string	Histogram::toString() const {
+	char	buffer[128];
+	snprintf(buffer, sizeof(buffer),
+		"n=%lu min=%.6f mean=%.6f max=%.6f", count, min, mean(), max);
+	std::string	result(buffer);
+	for (unsigned int i = 0; i < counts.size(); i++) {
+		if (0 == counts[i]) {
+			continue;
+		}
+		if (i < bounds.size()) {
+			snprintf(buffer, sizeof(buffer), " <=%g:%lu",
+				bounds[i], counts[i]);
+		} else {
+			snprintf(buffer, sizeof(buffer), " >%g:%lu",
+				bounds.back(), counts[i]);
+		}
+		result.append(buffer);
+	}
+	return result;
+}
+
+/**
+ * \brief Create an empty set of metrics
+ */
+Metrics::Metrics() : frames(0), failures(0), bytes(0), patches(0),
+	shortpatches(0) {
+}
+
+/*
+ * The process wide metrics are only updated once per frame, so a mutex
+ * is good enough to protect them.
+ */
+static std::mutex	metrics_mutex;
+static Metrics	metrics;
+
+/**
+ * \brief Get a copy of the process wide metrics
+ */
+Metrics	Metrics::snapshot() {
+	std::unique_lock<std::mutex>	lock(metrics_mutex);
+	return metrics;
+}
+
+/**
+ * \brief Reset the process wide metrics
+ */
+void	Metrics::reset() {
+	std::unique_lock<std::mutex>	lock(metrics_mutex);
+	metrics = Metrics();
+}
+
+/**
+ * \brief Value at a given fraction of a sorted vector, nearest rank
+ */
+static double	percentile(const std::vector<double>& sorted, double p) {
+	if (sorted.size() == 0) {
+		return 0;
+	}
+	unsigned int	rank = (unsigned int)(p * sorted.size() + 0.5);
+	if (rank > 0) {
+		rank--;
+	}
+	if (rank >= sorted.size()) {
+		rank = sorted.size() - 1;
+	}
+	return sorted[rank];
+}
+
+/**
+ * \brief Compute the patch timing of a frame from the patch arrival times
+ *
+ * \param intervals	scratch space for the patch intervals, passing the
+ *			same vector for every frame avoids allocations
+ */
+void	patchstatistics(FrameMetrics& frame,
+		const std::vector<double>& arrivals,
+		std::vector<double>& intervals) {
+	if (arrivals.size() == 0) {
+		return;
+	}
+	frame.firstpatch = arrivals.front();
+	frame.lastpatch = arrivals.back();
+	intervals.clear();
+	intervals.reserve(arrivals.size());
+	for (unsigned int i = 1; i < arrivals.size(); i++) {
+		intervals.push_back(arrivals[i] - arrivals[i - 1]);
+	}
+	if (intervals.size() == 0) {
+		return;
+	}
+	std::sort(intervals.begin(), intervals.end());
+	frame.intervalmin = intervals.front();
+	frame.intervalmax = intervals.back();
+	frame.interval50 = percentile(intervals, 0.5);
+	frame.interval90 = percentile(intervals, 0.9);
+	frame.interval99 = percentile(intervals, 0.99);
+}
+
+/**
+ * \brief Add a frame to the process wide metrics
+ */
+void	recordframe(const FrameMetrics& frame,
+		const std::vector<double>& arrivals) {
+	std::unique_lock<std::mutex>	lock(metrics_mutex);
+	metrics.frames++;
+	metrics.bytes += frame.bytes;
+	metrics.patches += frame.patches;
+	metrics.shortpatches += frame.shortpatches;
+	metrics.readouttime.add(frame.lastpatch - frame.firstpatch);
+	metrics.allocationtime.add(frame.allocationtime);
+	metrics.demuxtime.add(frame.demuxtime);
+	for (unsigned int i = 1; i < arrivals.size(); i++) {
+		metrics.patchinterval.add(arrivals[i] - arrivals[i - 1]);
+	}
+}
+
+/**
+ * \brief Count a frame that could not be read
+ */
+void	recordfailure() {
+	std::unique_lock<std::mutex>	lock(metrics_mutex);
+	metrics.failures++;
+}
+
+} // namespace qhy
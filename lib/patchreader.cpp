@@ -0,0 +1,219 @@
+/*
+ * patchreader.cpp -- asynchronous readout of image patches
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <patchreader.h>
+#include <qhydebug.h>
+#include <utils.h>
+#include <tracing.h>
+
+namespace qhy {
+
+/**
+ * \brief Create a PatchReader
+ *
+ * \param device	the device to read from
+ * \param patch_size	size of an individual patch in bytes
+ * \param total_patches	the number of patches making up the image
+ * \param depth		the number of transfers to keep in flight
+ */
+PatchReader::PatchReader(PDevice& device, int patch_size, int total_patches,
+	unsigned int depth) : _device(device), _patch_size(patch_size),
+	_total_patches(total_patches), _depth(depth), _requesteddepth(depth) {
+	_skip = 0;
+	_linesize = 0;
+	_lines = 0;
+	_bytes = 0;
+	_shortpatches = 0;
+	_arrivals.reserve(_total_patches);
+	_endpoint = _device.transport().dataendpoint() | 0x80;
+	if (_depth < 1) {
+		_depth = 1;
+	}
+	if (_depth > (unsigned int)_total_patches) {
+		_depth = _total_patches;
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
+		"%d patches of %d bytes, %u transfers in flight",
+		_total_patches, _patch_size, _depth);
+	try {
+		for (unsigned int i = 0; i < _depth; i++) {
+			requests.push_back(
+				_device.transport().bulkrequest(_endpoint));
+		}
+	} catch (...) {
+		for (unsigned int i = 0; i < requests.size(); i++) {
+			delete requests[i];
+		}
+		throw;
+	}
+}
+
+/**
+ * \brief Destroy the PatchReader
+ *
+ * If the reader is destroyed while transfers are still in flight, e.g.
+ * because a transfer failed, the remaining transfers are cancelled,
+ * so that the transport does not write to the target buffer after it
+ * has been released.
+ */
+PatchReader::~PatchReader() {
+	cancel();
+	for (unsigned int i = 0; i < requests.size(); i++) {
+		delete requests[i];
+	}
+}
+
+/**
+ * \brief Whether the reader was created for these patch parameters
+ *
+ * Readers can be reused for all images with the same patches, so that
+ * the transfers are not allocated again for every image.
+ */
+bool	PatchReader::matches(int patch_size, int total_patches,
+		unsigned int depth) const {
+	return (patch_size == _patch_size) && (total_patches == _total_patches)
+		&& (depth == _requesteddepth);
+}
+
+/**
+ * \brief Set the line geometry of the raw data
+ *
+ * The raw data sent by the camera consists of a number of bytes to
+ * skip, followed by lines of constant size. Knowing this geometry allows
+ * the reader to tell how many lines are already complete in the target
+ * buffer.
+ * \param skip		number of bytes before the first line
+ * \param linesize	the size of a raw line in bytes
+ * \param lines		the number of lines in the image
+ */
+void	PatchReader::geometry(unsigned long skip, unsigned long linesize,
+		unsigned int lines) {
+	_skip = skip;
+	_linesize = linesize;
+	_lines = lines;
+}
+
+/**
+ * \brief Number of complete raw lines received so far
+ */
+unsigned int	PatchReader::linesavailable() const {
+	if ((0 == _linesize) || (_bytes < _skip)) {
+		return 0;
+	}
+	unsigned long	lines = (_bytes - _skip) / _linesize;
+	if (lines > _lines) {
+		return _lines;
+	}
+	return lines;
+}
+
+/**
+ * \brief Cancel all transfers still in flight
+ */
+void	PatchReader::cancel() {
+	for (unsigned int i = 0; i < requests.size(); i++) {
+		requests[i]->cancel();
+	}
+	for (unsigned int i = 0; i < requests.size(); i++) {
+		try {
+			requests[i]->wait();
+		} catch (const std::exception& x) {
+			qhydebug(LOG_ERR, DEBUG_LOG, 0,
+				"cannot cancel transfer: %s", x.what());
+		}
+	}
+}
+
+/**
+ * \brief Read all patches into the target buffer
+ *
+ * Transfers complete in the order they were submitted, and since
+ * the reader always waits for the oldest transfer, the patches are
+ * appended to the target buffer in the order the camera sends them.
+ * Every transfer is pointed at a region of the target buffer reserved
+ * through a BufferPointer, which guarantees that no transfer can write
+ * beyond the end of the buffer.
+ *
+ * If a listener is given, it is informed whenever a patch has completed
+ * further lines, so that it can process them while the remaining
+ * transfers are still in flight.
+ *
+ * \param target	the buffer to receive the image data
+ * \param timeout	timeout for the transfers submitted initially, which
+ *			have to wait for the exposure to complete
+ * \param listener	consumer for completed lines, may be NULL
+ * \return		the number of bytes read
+ */
+unsigned long	PatchReader::read(Buffer& target, unsigned int timeout,
+		PatchListener *listener) {
+	BufferPointer	bp(target);
+	_bytes = 0;
+	_shortpatches = 0;
+	_arrivals.clear();
+	unsigned int	lines = 0;
+
+	// a reader may be reused for the next image, so transfers must not
+	// remain in flight into this target buffer if anything goes wrong
+	try {
+		// fill the queue, all these transfers have to wait for the
+		// end of the exposure
+		int	nextpatch = 0;
+		for (unsigned int i = 0; i < _depth; i++) {
+			requests[i]->submit(bp.reserve(_patch_size),
+				_patch_size, timeout);
+			nextpatch++;
+		}
+
+		// complete the patches in order, and resubmit the slot for
+		// the next patch not yet queued
+		for (int patchno = 0; patchno < _total_patches; patchno++) {
+			BulkRequest	*request = requests[patchno % _depth];
+			TraceSpan	span("patch", patchno);
+			request->wait();
+			if (request->status() < 0) {
+				qhydebug(LOG_ERR, DEBUG_LOG, 0,
+					"patch %d failed: %s", patchno,
+					usbcause(request->status()).c_str());
+				throw USBError(request->status());
+			}
+			_arrivals.push_back(gettime());
+			if (request->transferred() < _patch_size) {
+				_shortpatches++;
+			}
+			bp.commit(request->data(), request->transferred());
+			_bytes = bp.offset();
+			span.end();
+
+			// all following transfers should be done with a shorter
+			// timeout of at most 1 second
+			if (nextpatch < _total_patches) {
+				request->submit(bp.reserve(_patch_size),
+					_patch_size, 1000);
+				nextpatch++;
+			}
+
+			// the request is back in the queue, so we can now hand
+			// the new lines to the listener without starving the
+			// USB link
+			if (listener) {
+				unsigned int	newlines = linesavailable();
+				if (newlines > lines) {
+					lines = newlines;
+					listener->available(lines);
+				}
+			}
+		}
+	} catch (...) {
+		cancel();
+		throw;
+	}
+	return bp.offset();
+}
+
+} // namespace qhy
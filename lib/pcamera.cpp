@@ -8,6 +8,10 @@
 #include <qhydebug.h>
 #include <buffer.h>
 #include <camera.h>
+#include <patchreader.h>
+#include <metrics.h>
+#include <tracing.h>
+#include <utils.h>
 #include <cstring>
 
 namespace qhy {
@@ -16,20 +20,95 @@ extern void     logbuffer(const unsigned char *data, int length);
 
 #define CONTROL_TIMEOUT	500
 
+/**
+ * \brief Listener that demultiplexes lines as they arrive
+ *
+ * In pipelined mode, the PatchReader hands every newly completed range
+ * of raw lines to this listener, which demultiplexes them into the
+ * image while the remaining patches are still being transferred.
+ */
+template<typename Pixel>
+class PCamera::DemuxListener : public PatchListener {
+	PCamera&	_camera;
+	Image<Pixel>&	_image;
+	const Buffer&	_buffer;
+	bool	_active;
+	unsigned int	_lines;
+	double	_demuxtime;
+public:
+	DemuxListener(PCamera& camera, Image<Pixel>& image,
+		const Buffer& buffer, bool active)
+		: _camera(camera), _image(image), _buffer(buffer),
+		  _active(active), _lines(0), _demuxtime(0) { }
+	virtual void	available(unsigned int lines) {
+		if (lines <= _lines) {
+			return;
+		}
+		double	start = gettime();
+		TraceSpan	span("demuxlines", lines);
+		_camera.demuxbands(_image, _buffer, _lines, lines, _active);
+		_demuxtime += gettime() - start;
+		_lines = lines;
+	}
+	double	demuxtime() const { return _demuxtime; }
+};
+
+/**
+ * \brief Work item demultiplexing a range of raw lines in bands
+ */
+template<typename Pixel>
+class PCamera::DemuxBands : public ParallelWork {
+	PCamera&	_camera;
+	Image<Pixel>&	_image;
+	const Buffer&	_buffer;
+	unsigned int	_firstline;
+	unsigned int	_lastline;
+	bool	_active;
+	unsigned int	_bands;
+public:
+	DemuxBands(PCamera& camera, Image<Pixel>& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline, bool active,
+		unsigned int bands)
+		: _camera(camera), _image(image), _buffer(buffer),
+		  _firstline(firstline), _lastline(lastline),
+		  _active(active), _bands(bands) { }
+	virtual void	run(unsigned int band) {
+		_camera.demuxband(_image, _buffer, _firstline, _lastline,
+			_active, _bands, band);
+	}
+};
+
 /**
  * \brief Create a camera object
  */
-PCamera::PCamera(PDevice& device) : _device(device) {
+PCamera::PCamera(PDevice& device) : _device(device),
+	_allocator(device.transport()),
+	_buffers(new BufferPool(_poolcapacity)), _reader(NULL) {
 }
 
 /**
  * \brief Destroy a camera object
+ *
+ * The raw data buffers in the pool may use memory of the transport,
+ * so they must be released while the allocator and the transport
+ * are still there.
  */
 PCamera::~PCamera() {
+	delete _reader;
+	_buffers->flushraw();
+}
+
+/**
+ * \brief Statistics of the pool of raw data and image buffers
+ */
+BufferPoolStatistics	PCamera::poolstatistics() const {
+	return _buffers->statistics();
 }
 
 void	PCamera::sendregisters() {
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "sendregisters()");
+	TraceSpan	span("sendregisters");
+	_frame.registers = gettime();
 	// convert the register class into a control block
 	register_block	block(reg);
 
@@ -94,9 +173,14 @@ void	PCamera::exposuretime(double seconds) {
  * \brief read the image as a set of patches
  *
  * QHY cameras deliver data in patches so we need method to read these
- * patches into a contiguous buffer.
+ * patches into a contiguous buffer. The patches are read by a PatchReader
+ * that keeps queuedepth() bulk transfers in flight.
+ *
+ * \param target	the buffer to receive the raw image data
+ * \param listener	if not NULL, this listener is informed about every
+ *			new range of complete raw lines
  */
-int	PCamera::readpatches(Buffer& target) {
+int	PCamera::readpatches(Buffer& target, PatchListener *listener) {
 	// start reading patches
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
 		"read %d data patches into buffer of size %ld",
@@ -113,26 +197,26 @@ int	PCamera::readpatches(Buffer& target) {
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "exposuretime = %f, timeout %d",
 		_exposuretime, timeout);
 
-	// allocate a buffer for reading data 
-	Buffer	buffer(patch_size);
-	BufferPointer	bp(target);
-	int	transferred;
-	int	totalbytes = 0;
-	for (int patchno = 0; patchno < total_patches; patchno++) {
-		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "reading %d bytes",
-			patch_size);
-		transferred = _device.read(buffer.data(), patch_size, timeout);
-//logbuffer(buffer.data(), patch_size);
-
-		bp.append(buffer, transferred);
-		totalbytes += transferred;
-		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "patch %d: size %d",
-			patchno, transferred);
-		// all following transfers should be done with a shorter
-		// timeout of at most 1 second
-		timeout = 1000;
-	}
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "all patches read, %d bytes",
+	// read the patches with a queue of asynchronous transfers, the
+	// reader is kept for the next image with the same patches
+	if ((NULL != _reader)
+		&& (!_reader->matches(patch_size, total_patches, _queuedepth))) {
+		delete _reader;
+		_reader = NULL;
+	}
+	if (NULL == _reader) {
+		_reader = new PatchReader(_device, patch_size, total_patches,
+			_queuedepth);
+	}
+	PatchReader&	reader = *_reader;
+	reader.geometry(2 * reg.TopSkipPix, 2 * reg.LineSize, reg.VerticalSize);
+	unsigned long	totalbytes = reader.read(target, timeout, listener);
+	_frame.bytes = totalbytes;
+	_frame.patches = reader.arrivals().size();
+	_frame.shortpatches = reader.shortpatches();
+	_arrivals = reader.arrivals();
+	patchstatistics(_frame, _arrivals, _intervals);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "all patches read, %lu bytes",
 		totalbytes);
 	return totalbytes;
 }
@@ -149,6 +233,10 @@ void	PCamera::cancelExposure() {
  */
 void	PCamera::startExposure() {
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "start an exposure");
+	TraceSpan	span("startExposure");
+	_frame = FrameMetrics();
+	_arrivals.clear();
+
 	// send the registers with all the parameters to the camera
 	sendregisters();
 
@@ -156,6 +244,7 @@ void	PCamera::startExposure() {
 	unsigned char	buf[1];
 	buf[0] = 100;
 	_device.controlwrite(0xb3, 0, 0, buf, 1, CONTROL_TIMEOUT);
+	_frame.exposurestart = gettime();
 }
 
 /**
@@ -172,27 +261,189 @@ ImageSize	PCamera::imagesize() const {
 /**
  * \brief Get an image from the camera
  *
- * This includes waiting for the exposure to complete
+ * This includes waiting for the exposure to complete. In pipelined
+ * mode, the image is demultiplexed while it is downloaded, otherwise
+ * demultiplexing starts after the last patch has arrived.
  */
 ImageBufferPtr	PCamera::getImage() {
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "retrieving the image");
+	TraceSpan	span("getImage");
+	return acquire<unsigned short>(false);
+}
 
-	// create a data buffer
-	Buffer	rawbuffer(total_patches * patch_size);
+/**
+ * \brief Get the active area of an image from the camera
+ *
+ * If the camera can demultiplex directly into the active area, the
+ * pixels are written to their final place in a single pass. Otherwise
+ * the active area is extracted from the full image.
+ */
+ImageBufferPtr	PCamera::getActiveImage() {
+	if ((!activedemux()) || activearea().empty()) {
+		return getImage()->active_buffer();
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "retrieving the active image");
+	TraceSpan	span("getActiveImage");
+	return acquire<unsigned short>(true);
+}
 
-	int	l = readpatches(rawbuffer);
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "%d bytes received", l);
+/**
+ * \brief Get an image with 32 bit pixels from the camera
+ */
+ImageBuffer32Ptr	PCamera::getImage32() {
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "retrieving a 32 bit image");
+	TraceSpan	span("getImage32");
+	return acquire<unsigned int>(false);
+}
 
-	// prepare a pixel buffer
-	ImageSize	imgsize = imagesize();
-	ImageBuffer	*image = new ImageBuffer(imgsize);
+/**
+ * \brief Get the active area of an image with 32 bit pixels
+ */
+ImageBuffer32Ptr	PCamera::getActiveImage32() {
+	if ((!activedemux()) || activearea().empty()) {
+		return getImage32()->active_buffer();
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "retrieving a 32 bit active image");
+	TraceSpan	span("getActiveImage32");
+	return acquire<unsigned int>(true);
+}
+
+/**
+ * \brief Color filter pattern of the active area
+ *
+ * The active image starts at the last row of the active area, so the
+ * pattern is that of this pixel of the full image.
+ */
+std::string	PCamera::activebayer() const {
+	ImageRectangle	a = activearea();
+	if (_bayer.empty() || a.empty()) {
+		return _bayer;
+	}
+	return Debayer::shifted(_bayer, a.origin.x(),
+		a.origin.y() + a.size.height() - 1);
+}
+
+/**
+ * \brief Read an image and record the metrics of the frame
+ */
+template<typename Pixel>
+std::shared_ptr<Image<Pixel> >	PCamera::acquire(bool active) {
+	try {
+		std::shared_ptr<Image<Pixel> >	image
+			= readimage<Pixel>(active);
+		image->metrics(_frame);
+		recordframe(_frame, _arrivals);
+		return image;
+	} catch (...) {
+		recordfailure();
+		throw;
+	}
+}
+
+/**
+ * \brief Get an image buffer with 16 bit pixels from the pool
+ */
+void	PCamera::newimage(ImageBufferPtr& image, const ImageSize& size) {
+	image = _buffers->imagebuffer(size);
+}
+
+/**
+ * \brief Allocate an image buffer with 32 bit pixels
+ *
+ * These are not pooled, as they are not used for continuous capture.
+ */
+void	PCamera::newimage(ImageBuffer32Ptr& image, const ImageSize& size) {
+	image = ImageBuffer32Ptr(new ImageBuffer32(size));
+}
+
+/**
+ * \brief Read and demultiplex an image, keeping track of the metrics
+ *
+ * \param active	whether to produce only the active area of the image
+ */
+template<typename Pixel>
+std::shared_ptr<Image<Pixel> >	PCamera::readimage(bool active) {
+	double	start = gettime();
+
+	// get a data buffer and a pixel buffer from the pool
+	_buffers->capacity(_poolcapacity);
+	if (_allocator.configure(_framememory, _lockmemory)) {
+		_buffers->flushraw();
+	}
+	PooledBuffer	raw(_buffers, total_patches * patch_size, &_allocator);
+	Buffer&	rawbuffer = *raw;
+	ImageSize	imgsize = (active) ? activearea().size : imagesize();
+	std::shared_ptr<Image<Pixel> >	image;
+	newimage(image, imgsize);
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "%d x %d image buffer allocated",
 		image->width(), image->height());
+	_frame.allocationtime = gettime() - start;
+	resetstatistics();
+
+	if (_pipelined) {
+		// convert the lines as they arrive, and anything that may
+		// still be missing once all patches have been read
+		DemuxListener<Pixel>	listener(*this, *image, rawbuffer, active);
+		int	l = readpatches(rawbuffer, &listener);
+		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "%d bytes received", l);
+		listener.available(reg.VerticalSize);
+		if (!active) {
+			image->active(activearea());
+		}
+		_frame.demuxtime = listener.demuxtime();
+		image->statistics(framestatistics());
+		return image;
+	}
+
+	int	l = readpatches(rawbuffer);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "%d bytes received", l);
 
 	// convert the pixel into the image buffer
-	this->demux(*image, rawbuffer);
+	start = gettime();
+	TraceSpan	span("demux");
+	if (active) {
+		demuxbands(*image, rawbuffer, 0, reg.VerticalSize, true);
+	} else {
+		this->demux(*image, rawbuffer);
+	}
+	_frame.demuxtime = gettime() - start;
+	image->statistics(framestatistics());
+
+	return image;
+}
 
-	return ImageBufferPtr(image);
+/**
+ * \brief Prepare the partial statistics for the bands of a new frame
+ *
+ * The partials are kept from frame to frame, so that the histograms
+ * need not be allocated again.
+ */
+void	PCamera::resetstatistics() {
+	if (!_statistics) {
+		return;
+	}
+	if (_partials.size() < _demuxthreads) {
+		_partials.resize(_demuxthreads);
+	}
+	for (unsigned int i = 0; i < _demuxthreads; i++) {
+		_partials[i].reset();
+	}
+}
+
+/**
+ * \brief Merge the partial statistics of the bands
+ *
+ * \return	the statistics of the frame, or NULL if not enabled
+ */
+FrameStatisticsPtr	PCamera::framestatistics() {
+	if (!_statistics) {
+		return FrameStatisticsPtr();
+	}
+	TraceSpan	span("framestatistics");
+	for (unsigned int i = 1; i < _demuxthreads; i++) {
+		_partials[0].merge(_partials[i]);
+	}
+	return _partials[0].result();
 }
 
 /**
@@ -223,13 +474,170 @@ void	CameraNew::patch() {
 
 /**
  * \brief Demultiplex the image
+ *
+ * Demultiplexes all lines of the raw data and sets the active area
+ * of the image.
  */
-void	PCamera::demux(ImageBuffer& image, const Buffer& buffer) {
-	long	l = image.width() * image.height() * 2;
-//	logbuffer(buffer.data(), l);
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "copy %d bytes pixels", l);
-	memcpy(image.pixelbuffer(), buffer.data(), l);
-//	logbuffer((unsigned char *)image.pixelbuffer(), l);
+template<typename Pixel>
+void	PCamera::demux(Image<Pixel>& image, const Buffer& buffer) {
+	demuxbands(image, buffer, 0, reg.VerticalSize);
+	image.active(activearea());
+}
+
+/**
+ * \brief Demultiplex a range of raw lines, possibly in parallel
+ *
+ * If more than one demux thread is configured, the range is split into
+ * bands of consecutive raw lines which are converted concurrently.
+ * The bands map to disjoint rows of the image, and demuxlines()
+ * computes the offsets of its first line from the line geometry, so
+ * the bands are completely independent.
+ */
+template<typename Pixel>
+void	PCamera::demuxbands(Image<Pixel>& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline, bool active) {
+	if (firstline >= lastline) {
+		return;
+	}
+	unsigned int	lines = lastline - firstline;
+	unsigned int	bands = (_demuxthreads < lines) ? _demuxthreads : lines;
+	if (bands < 2) {
+		demuxband(image, buffer, firstline, lastline, active, 1, 0);
+		return;
+	}
+	if ((!_pool) || (_pool->size() != _demuxthreads)) {
+		_pool = ThreadPoolPtr(new ThreadPool(_demuxthreads));
+	}
+	DemuxBands<Pixel>	work(*this, image, buffer, firstline, lastline,
+					active, bands);
+	_pool->parallel(bands, work);
+}
+
+/**
+ * \brief Demultiplex one of several bands of a range of raw lines
+ *
+ * Every band has its own partial statistics, as bands are converted
+ * concurrently. In pipelined mode, band i of every range of lines adds
+ * to the same partial statistics.
+ */
+template<typename Pixel>
+void	PCamera::demuxband(Image<Pixel>& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		bool active, unsigned int bands, unsigned int band) {
+	unsigned int	lines = lastline - firstline;
+	unsigned int	first = firstline + (lines * band) / bands;
+	unsigned int	last = firstline + (lines * (band + 1)) / bands;
+	TraceSpan	span("demuxband", band);
+	PixelStatistics	*statistics = (_statistics) ? &_partials[band] : NULL;
+	if (active) {
+		demuxactivelines(image, buffer, first, last, statistics);
+	} else {
+		demuxlines(image, buffer, first, last, statistics);
+	}
+}
+
+/**
+ * \brief Demultiplex a range of raw lines
+ *
+ * The raw data consists of reg.VerticalSize lines of 2 * reg.LineSize
+ * bytes each. Derived classes override this method with the camera
+ * specific demultiplexing, the default just copies the pixel data.
+ * \param image		the image to write the pixels to
+ * \param buffer	the raw data received from the camera
+ * \param firstline	the first raw line to convert
+ * \param lastline	the line after the last raw line to convert
+ * \param statistics	if not NULL, the statistics to add the active
+ *			pixels to, the default includes all pixels
+ */
+void	PCamera::demuxlines(ImageBuffer& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		PixelStatistics *statistics) {
+	unsigned long	linesize = 2 * reg.LineSize;
+	unsigned long	l = image.size();
+	unsigned long	start = firstline * linesize;
+	unsigned long	end = (lastline >= reg.VerticalSize)
+				? l : lastline * linesize;
+	if (end > l) {
+		end = l;
+	}
+	if (start >= end) {
+		return;
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "copy %lu bytes pixels", end - start);
+	memcpy((unsigned char *)image.pixelbuffer() + start,
+		buffer.data() + start, end - start);
+	if (statistics) {
+		statistics->add(image.pixelbuffer() + start / 2,
+			(end - start) / 2);
+	}
+}
+
+/**
+ * \brief Demultiplex a range of raw lines into 32 bit pixels
+ *
+ * The default implementation widens the words of the raw data, just
+ * like the 16 bit version copies them.
+ */
+void	PCamera::demuxlines(ImageBuffer32& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		PixelStatistics *statistics) {
+	unsigned long	linesize = reg.LineSize;
+	unsigned long	n = image.npixels();
+	unsigned long	start = firstline * linesize;
+	unsigned long	end = (lastline >= reg.VerticalSize)
+				? n : lastline * linesize;
+	if (end > n) {
+		end = n;
+	}
+	if (end > buffer.length() / 2) {
+		end = buffer.length() / 2;
+	}
+	const unsigned short	*words = (const unsigned short *)buffer.data();
+	for (unsigned long i = start; i < end; i++) {
+		image.pixelbuffer()[i] = words[i];
+	}
+	if ((statistics) && (start < end)) {
+		statistics->add(image.pixelbuffer() + start, end - start);
+	}
+}
+
+/**
+ * \brief Whether the camera can demultiplex into the active area
+ *
+ * Cameras returning true implement demuxactivelines().
+ */
+bool	PCamera::activedemux() const {
+	return false;
+}
+
+/**
+ * \brief Demultiplex a range of raw lines into the active area
+ *
+ * The image has the size of the active area, and the pixels are written
+ * in the same orientation as active_buffer() produces them, i.e. with
+ * the rows in reverse order. The default implementation is never used,
+ * as activedemux() is false.
+ */
+void	PCamera::demuxactivelines(ImageBuffer& /* image */,
+		const Buffer& /* buffer */, unsigned int /* firstline */,
+		unsigned int /* lastline */, PixelStatistics * /* statistics */) {
+	throw NotSupported("cannot demultiplex into the active area");
+}
+
+void	PCamera::demuxactivelines(ImageBuffer32& /* image */,
+		const Buffer& /* buffer */, unsigned int /* firstline */,
+		unsigned int /* lastline */, PixelStatistics * /* statistics */) {
+	throw NotSupported("cannot demultiplex into the active area");
+}
+
+/**
+ * \brief The active area of the image in the current binning mode
+ *
+ * The default implementation has no active area, so the whole image is
+ * considered active.
+ */
+ImageRectangle	PCamera::activearea() const {
+	return ImageRectangle();
 }
 
 /**
@@ -248,4 +656,16 @@ void	PCamera::downloadSpeed(enum DownloadSpeed speed) {
 	}
 }
 
+// demultiplexing is available for these pixel types
+template void	PCamera::demux<unsigned short>(ImageBuffer& image,
+			const Buffer& buffer);
+template void	PCamera::demux<unsigned int>(ImageBuffer32& image,
+			const Buffer& buffer);
+template void	PCamera::demuxbands<unsigned short>(ImageBuffer& image,
+			const Buffer& buffer, unsigned int firstline,
+			unsigned int lastline, bool active);
+template void	PCamera::demuxbands<unsigned int>(ImageBuffer32& image,
+			const Buffer& buffer, unsigned int firstline,
+			unsigned int lastline, bool active);
+
 } // namespace qhy
@@ -13,8 +13,7 @@
 #include <device.h>
 #include <qhydebug.h>
 #include <utils.h>
-
-#include <libusb-1.0/libusb.h>
+#include <tracing.h>
 
 namespace qhy {
 
@@ -62,15 +61,9 @@ unsigned int	PDC201::transfer(unsigned char endpoint,
 	//qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
 	//	"transfer request for %lu bytes, endpoint %02x",
 	//	length, endpoint);
-	int	transferred_length;
-	int	rc = libusb_bulk_transfer(_device.handle,
-			endpoint, buffer, length, &transferred_length,
+	TraceSpan	span("dc201", endpoint);
+	int	transferred_length = _device.transfer(endpoint, buffer, length,
 			DC201_TIMEOUT);
-	if (rc) {
-		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "transfer failed: %s",
-			usbcause(rc).c_str());
-		throw USBError(rc);
-	}
 	//qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "%d bytes transferred",
 	//	transferred_length);
 	return transferred_length;
@@ -415,6 +408,8 @@ void	PDC201::main() {
 
 	// keep checking the 
 	while (!endthread) {
+		TraceSpan	span("regulator");
+
 		// find the current voltage, the regulator is based on the
 		// voltage, not the temperature
 		current_temperature = temperature();
@@ -467,6 +462,7 @@ void	PDC201::main() {
 
 		// now wait at most one second or until some other function
 		// signals that we should 
+		span.end();
 		interruptiblesleep(dt);
 	}
 
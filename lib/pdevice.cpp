@@ -7,6 +7,7 @@
 #include <config.h>
 #endif /* HAVE_CONFIG_H */
 #include <device.h>
+#include <libusbtransport.h>
 #include <qhylib.h>
 #include <qhydebug.h>
 #include <utils.h>
@@ -14,93 +15,36 @@
 namespace qhy {
 
 /**
- * \brief Create a new Device object
+ * \brief Common initialization of all constructors
  */
-PDevice::PDevice(unsigned short idVendor, unsigned short idProduct) {
-	// initialize context and handle, to make sure 
-	ctx = NULL;
-	handle = NULL;
-
+void	PDevice::setup() {
 	// initialize the pointers
 	_dc201 = NULL;
 	_camera = NULL;
+}
 
-	// initialize the USB context for this device
-	int	rc = libusb_init(&ctx);
-	if (rc) {
-		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot init USB: %s (%d)",
-			libusb_strerror((enum libusb_error)rc), rc),
-		throw USBError(rc);
-	}
-
-	// get a device handle for the device
-	handle = libusb_open_device_with_vid_pid(ctx, idVendor, idProduct);
-	if (NULL == handle) {
-		qhydebug(LOG_ERR, DEBUG_LOG, 0, "could not open %04x/%04x",
-			idVendor, idProduct);
-		libusb_exit(ctx);
-		throw USBError(LIBUSB_ERROR_NOT_FOUND);
-	}
-
-#if HAVE_LIBUSB_SET_DEBUG
-#if USBDEBUG
-	if (qhydebuglevel == LOG_DEBUG) {
-		libusb_set_debug(ctx, 4 /* LIBUSB_LOG_LEVEL_DEBUG */);
-	}
-#endif
-#endif
-
-	// get the device
-	libusb_device	*dev = libusb_get_device(handle);
-
-	// get the active config descriptor
-	libusb_config_descriptor	*config = NULL;
-	libusb_get_active_config_descriptor(dev, &config);
-
-	// get a descriptor for interface 0
-	const libusb_interface	*interface = config->interface;
-	const libusb_interface_descriptor	*ifdesc = interface->altsetting;
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "interface has %d endpoints",
-		ifdesc->bNumEndpoints);
-	for (int epidx = 0; epidx < ifdesc->bNumEndpoints; epidx++) {
-		const libusb_endpoint_descriptor	*endpoint
-			= ifdesc->endpoint + epidx;
-		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "endpoint %d: %02x", epidx,
-			endpoint->bEndpointAddress);
-		// scan all endpoints and look for an IN endpoint with 512
-		// bytes maximum packet size, this is the data endpoint
-		if (endpoint->bEndpointAddress & 0x80) {
-			qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
-				"%02x has packet size %d",
-				(int)endpoint->bEndpointAddress,
-				(int)endpoint->wMaxPacketSize);
-			if (endpoint->wMaxPacketSize >= 512) {
-				dataep = endpoint->bEndpointAddress;
-			}
-		}
-	}
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "data endpoint is %02x", (int)dataep);
-
-	// clean up the descriptors
-	libusb_free_config_descriptor(config);
-
-	// claim the interface
-	rc = libusb_claim_interface(handle, 0);
-	if (rc) {
-		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot claim interface 0: %s",
-			libusb_strerror((enum libusb_error)rc));
-		libusb_close(handle);
-		libusb_exit(ctx);
-		throw USBError(rc);
-	}
+/**
+ * \brief Create a new Device object
+ *
+ * This opens the first device with matching vendor and product id
+ * using a libusb transport.
+ */
+PDevice::PDevice(unsigned short idVendor, unsigned short idProduct) {
+	setup();
+	_transport = new LibusbTransport(idVendor, idProduct);
+}
 
-	// report success in openeing the device
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "device %04x/%04x opened",
-		idVendor, idProduct);
+/**
+ * \brief Create a new Device object on top of a transport
+ *
+ * The device takes ownership of the transport.
+ */
+PDevice::PDevice(Transport *transport) : _transport(transport) {
+	setup();
 }
 
 /**
- * \brief Destroy the device object
+ * \brief Destroy the device object
  */
 PDevice::~PDevice() {
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "destroying Device");
@@ -111,16 +55,7 @@ PDevice::~PDevice() {
 		delete _camera;
 	}
 	// close the device
-	if (handle) {
-		libusb_release_interface(handle, 0);
-		libusb_close(handle);
-		handle = NULL;
-	}
-	// deinitialize the context
-	if (ctx) {
-		libusb_exit(ctx);
-		ctx = NULL;
-	}
+	delete _transport;
 }
 
 /**
@@ -144,14 +79,8 @@ int	PDevice::controltransfer(uint8_t bmRequestType, uint8_t bRequest,
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "%02x %02x v=%04x, i=%04x, l=%d",
 		(int)bmRequestType,
 		(int)bRequest, (int)wValue, (int)wIndex, (int)wLength);
-	int	rc = libusb_control_transfer(handle, bmRequestType, bRequest,
+	int	rc = _transport->controltransfer(bmRequestType, bRequest,
 			wValue, wIndex, data, wLength, timeout);
-	if (rc < 0) {
-		qhydebug(LOG_ERR, DEBUG_LOG, 0,
-			"control transfer failed: %s (%d)",
-			libusb_strerror((enum libusb_error)rc), rc);
-		throw USBError(rc);
-	}
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "%d bytes transferred", rc);
 	return rc;
 }
@@ -166,11 +95,13 @@ int	PDevice::controlread(uint8_t bRequest, uint16_t wValue,
 		data, wLength, timeout);
 	if (rc < 0) {
 		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot read control: %s",
-			libusb_strerror((enum libusb_error)rc));
+			usbcause(rc).c_str());
 	} else {
 		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "receive buffer:");
 	}
-	logbuffer(data, wLength);
+	if (QHYDEBUG_ENABLED(LOG_DEBUG)) {
+		logbuffer(data, wLength);
+	}
 	return rc;
 }
 
@@ -181,7 +112,9 @@ int	PDevice::controlwrite(uint8_t bRequest, uint16_t wValue,
 		uint16_t wIndex, const unsigned char *data,
 		uint16_t wLength, unsigned int timeout) {
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "send buffer:");
-	logbuffer(data, wLength);
+	if (QHYDEBUG_ENABLED(LOG_DEBUG)) {
+		logbuffer(data, wLength);
+	}
 	return controltransfer(0x40, bRequest, wValue, wIndex,
 		const_cast<unsigned char *>(data), wLength, timeout);
 }
@@ -191,15 +124,7 @@ int	PDevice::controlwrite(uint8_t bRequest, uint16_t wValue,
  */
 int	PDevice::transfer(unsigned char ep, unsigned char *buffer,
 		int length, unsigned int timeout) {
-	int	transferred;
-	int	rc = libusb_bulk_transfer(handle, ep, buffer, length,
-			&transferred, timeout);
-	if (rc < 0) {
-		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "transfer failed: %s (%d)",
-			libusb_strerror((enum libusb_error)rc), rc);
-		throw USBError(rc);
-	}
-	return transferred;
+	return _transport->bulktransfer(ep, buffer, length, timeout);
 }
 
 /**
@@ -207,7 +132,8 @@ int	PDevice::transfer(unsigned char ep, unsigned char *buffer,
  */
 int	PDevice::read(unsigned char *buffer, int length,
 		unsigned int timeout) {
-	return transfer(dataep | 0x80, buffer, length, timeout);
+	return transfer(_transport->dataendpoint() | 0x80, buffer, length,
+		timeout);
 }
 
 /**
@@ -215,8 +141,8 @@ int	PDevice::read(unsigned char *buffer, int length,
  */
 int	PDevice::write(const unsigned char *buffer, int length,
 		unsigned int timeout) {
-	return transfer(dataep & ~0x80, const_cast<unsigned char *>(buffer),
-		length, timeout);
+	return transfer(_transport->dataendpoint() & ~0x80,
+		const_cast<unsigned char *>(buffer), length, timeout);
 }
 
 } // namespace qhy
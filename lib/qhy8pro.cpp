@@ -7,6 +7,8 @@
 #include <qhydebug.h>
 #include <qhylib.h>
 #include <utils.h>
+#include <demuxmode.h>
+#include <stdexcept>
 
 namespace qhy {
 
@@ -17,7 +19,8 @@ namespace qhy {
  *
  * \param device
  */
-Qhy8Pro::Qhy8Pro(PDevice &device) : CameraOld(device) {
+Qhy8Pro::Qhy8Pro(PDevice &device) : CameraOld(device), _demux(NULL),
+	_demuxactive(NULL), _demuxwide(NULL), _demuxwideactive(NULL) {
 	reg.devname = "QHY8PRO-0";
 	reg.Offset = 135;
 	reg.Gain = 0;
@@ -47,43 +50,45 @@ Qhy8Pro::Qhy8Pro(PDevice &device) : CameraOld(device) {
 	bayer("GBRG");
 }
 
+/**
+ * \brief Set up the registers and the demultiplexing for a binning mode
+ */
+template<typename Mode>
+void	Qhy8Pro::modesetup() {
+	demuxmode_registers<Mode>(reg, patch_size);
+	_demux = demuxmode<Mode>;
+	_demuxactive = demuxmode_cropped<Mode>;
+	_demuxwide = demuxmode<Mode>;
+	_demuxwideactive = demuxmode_cropped<Mode>;
+	_active = demuxmode_activearea<Mode>();
+}
+
 /**
  * \brief Set the binning mode mode
  *
  * Setting the binning mode influences quite a few of the variables int
- * the camera register file. The correct values are computed in this
- * method.
+ * the camera register file. The correct values are taken from the
+ * descriptor of the mode, which also selects the demultiplexing code.
  * \param m	the binning mode m
  */
 void	Qhy8Pro::mode(const BinningMode& m) {
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
 		"setting mode for the QHY8PRO camera");
 	PCamera::mode(m);
-	if (m == BinningMode(1, 1)) {
-		reg.HBIN = 1;
-		reg.VBIN = 1;
-		reg.LineSize = 6656;
-		reg.VerticalSize = 1015;
-		reg.TopSkipPix = 2300;
-		patch_size = 26624;
+	// binning mixes the colors of the filter pattern
+	if (m == BinningMode(Qhy8ProMode11::binx, Qhy8ProMode11::biny)) {
+		modesetup<Qhy8ProMode11>();
+		bayer("GBRG");
 		return;
 	}
-	if (m == BinningMode(2, 2)) {
-		reg.HBIN = 2;
-		reg.VBIN = 1;
-		reg.LineSize = 3328;
-		reg.VerticalSize = 1015;
-		reg.TopSkipPix = 1250;
-		patch_size = 26624;
+	if (m == BinningMode(Qhy8ProMode22::binx, Qhy8ProMode22::biny)) {
+		modesetup<Qhy8ProMode22>();
+		bayer("");
 		return;
 	}
-	if (m == BinningMode(4, 4)) {
-		reg.HBIN = 2;
-		reg.VBIN = 2;
-		reg.LineSize = 3328;
-		reg.VerticalSize = 507;
-		reg.TopSkipPix = 0;
-		patch_size = 3296 * 1024;
+	if (m == BinningMode(Qhy8ProMode44::binx, Qhy8ProMode44::biny)) {
+		modesetup<Qhy8ProMode44>();
+		bayer("");
 		return;
 	}
 	throw NotSupported("mode not supported");
@@ -92,145 +97,77 @@ void	Qhy8Pro::mode(const BinningMode& m) {
 }
 
 /**
- * \brief Demultiplexing of image data
+ * \brief Demultiplexing of a range of raw lines
+ *
+ * In all binning modes, one raw line of the QHY8PRO consists of
+ * 2 * reg.LineSize bytes. In unbinned mode, each raw line contains
+ * two image lines, in the binned modes it contains exactly one.
+ * The conversion is done by the code instantiated for the mode
+ * selected in mode().
  */
-void	Qhy8Pro::demux(ImageBuffer& image, const Buffer& buffer) {
-	if (_mode == BinningMode(1, 1)) {
-		demux11(image, buffer);
-		image.active(ImageRectangle(ImagePoint(28, 0),
-				ImageSize(3040, 2024)));
-		return;
-	}
-	if (_mode == BinningMode(2, 2)) {
-		demux22(image, buffer);
-		image.active(ImageRectangle(ImagePoint(16, 0),
-				ImageSize(1520, 1012)));
-		return;
-	}
-	if (_mode == BinningMode(4, 4)) {
-		demux44(image, buffer);
-		image.active(ImageRectangle(ImagePoint(8, 0),
-				ImageSize(760, 506)));
+void	Qhy8Pro::demuxlines(ImageBuffer& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		PixelStatistics *statistics) {
+	if (NULL == _demux) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "no binning mode set");
 		return;
 	}
+	_demux(image, buffer, firstline, lastline, statistics);
 }
 
 /**
- * \brief Demultiplexing for unbinned images
+ * \brief Demultiplexing of a range of raw lines into 32 bit pixels
  *
- * This code comes more or less straight from the SDK provided by QHYCCD
+ * The binned pixels are the plain sums of the raw words.
  */
-void	Qhy8Pro::demux11(ImageBuffer& image, const Buffer& buffer) {
-	int	PixShift = reg.TopSkipPix;
-	int	width = imagesize().first;
-	int	height = imagesize().second;
-	
-    long s,p,m,n;
-
-    s=PixShift*2;
-    p=0;
-    m=0;
-    n=0;
-
-    for (n=0; n < height/2; n++)
-    {
-        for (m=0;m < width/2;m++)
-        {
-            image[p+3] = buffer[s+6];  //Gb
-            image[p+2] = buffer[s+7];
-            image[p+1] = buffer[s+4];
-            image[p+0] = buffer[s+5];
-
-            s = s + 8;
-            p = p + 4;
-        }
-
-        s=s-width*4;
-        for (m=0;m< width/2;m++)
-        {
-            image[p+3-2]  = buffer[s+2];
-            image[p+2-2]  = buffer[s+3];
-            image[p+1-2]  = buffer[s+0];//Gr
-            image[p+0-2]  = buffer[s+1];
-
-            s=s+8;
-            p=p+4;
-        }
-    }
+void	Qhy8Pro::demuxlines(ImageBuffer32& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		PixelStatistics *statistics) {
+	if (NULL == _demuxwide) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "no binning mode set");
+		return;
+	}
+	_demuxwide(image, buffer, firstline, lastline, statistics);
 }
 
 /**
- * \brief Demultiplexing for 2x2 binned images
- *
- * Note that binning is only partially done on chip, only binning
- * in the horizontal direction is done by the CCD. The other direction
- * is done numerically in the demultiplexing function.
- * This code comes more or less straight from the SDK provided by QHYCCD
+ * \brief Active area of the image in the current binning mode
  */
-void	Qhy8Pro::demux22(ImageBuffer& image, const Buffer& buffer) {
-	int	PixShift = reg.TopSkipPix;
-	int	width = imagesize().first;
-	int	height = imagesize().second;
-        long s,k;
-        unsigned long binpixel;
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
-		"start demultiplexing 2 x 2 binned image");
-
-        s=PixShift*2;
-        k=0;
-
-        for (int i=0;i<height;i++)
-        {
-                for (int j=0;j<width;j++)
-                {
-                        binpixel = buffer[s]*256 + buffer[s+1] + buffer[s+2]*256 + buffer[s+3];
-                        if (binpixel>65535) binpixel=65535;
-                        image[k]=LSB((unsigned short)binpixel);
-                        k=k+1;
-                        image[k]=MSB((unsigned short)binpixel);
-                        k=k+1;
-                        s=s+4;
-                }
-        }
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "demultiplexing complete");
+ImageRectangle	Qhy8Pro::activearea() const {
+	return _active;
 }
 
 /**
- * \brief Demultiplexing for 4x4 binned images
- *
- * Note that binning is only partially done on chip, only 2x2 binning
- * is done by the CCD. The remaining binning is done numerically in the
- * demultiplexing function.
- * This code comes more or less straight from the SDK provided by QHYCCD
+ * \brief The QHY8PRO can demultiplex directly into the active area
  */
-void	Qhy8Pro::demux44(ImageBuffer& image, const Buffer& buffer) {
-	int	PixShift = reg.TopSkipPix;
-	int	width = imagesize().first;
-	int	height = imagesize().second;
-
-        long s,k;
-        unsigned long binpixel;
-
-        s=PixShift*2;
-        k=0;
-
-        for (int i=0;i<height;i++){
-          for (int j=0;j<width;j++){
-                        binpixel=(buffer[s]+buffer[s+2]+buffer[s+4]+buffer[s+6])*256
-                                        + buffer[s+1]+buffer[s+3]+buffer[s+5]+buffer[s+7];
-
-                        if (binpixel>65535) binpixel=65535;
-                        image[k]=LSB((unsigned short)binpixel);
-                        k=k+1;
-                        image[k]=MSB((unsigned short)binpixel);
-                        k=k+1;
-
-                s=s+8;
-
+bool	Qhy8Pro::activedemux() const {
+	return true;
+}
 
-          }
+/**
+ * \brief Demultiplexing of a range of raw lines into the active area
+ */
+void	Qhy8Pro::demuxactivelines(ImageBuffer& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		PixelStatistics *statistics) {
+	if (NULL == _demuxactive) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "no binning mode set");
+		return;
+	}
+	_demuxactive(image, buffer, firstline, lastline, statistics);
+}
 
-        }
+/**
+ * \brief Demultiplexing of raw lines into the active area, 32 bit pixels
+ */
+void	Qhy8Pro::demuxactivelines(ImageBuffer32& image, const Buffer& buffer,
+		unsigned int firstline, unsigned int lastline,
+		PixelStatistics *statistics) {
+	if (NULL == _demuxwideactive) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "no binning mode set");
+		return;
+	}
+	_demuxwideactive(image, buffer, firstline, lastline, statistics);
 }
 
 } // namespace qhy
@@ -0,0 +1,197 @@
+/*
+ * recordingtransport.cpp -- transport recording USB traffic
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <recordingtransport.h>
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <cstring>
+#include <libusb-1.0/libusb.h>
+
+namespace qhy {
+
+/**
+ * \brief Add a transfer to the trace
+ *
+ * The payload is the data actually transferred, i.e. nothing if the
+ * transfer failed.
+ */
+static void	addrecord(TraceRecorder& recorder, uint8_t type,
+			uint8_t endpoint, uint8_t bRequest, uint16_t wValue,
+			uint16_t wIndex, uint64_t start, int status,
+			uint32_t requested, const unsigned char *payload,
+			int transferred) {
+	usbtrace_record	record;
+	memset(&record, 0, sizeof(record));
+	record.timestamp = start;
+	record.duration = recorder.now() - start;
+	record.status = (status < 0) ? status : 0;
+	record.requested = requested;
+	record.length = (status < 0) ? 0 : transferred;
+	record.wValue = wValue;
+	record.wIndex = wIndex;
+	record.type = type;
+	record.endpoint = endpoint;
+	record.bRequest = bRequest;
+	recorder.record(record, payload);
+}
+
+/**
+ * \brief Bulk request recording the transfers of another request
+ *
+ * The duration recorded is the time from submission until the transfer
+ * was found to be completed by wait().
+ */
+class RecordingRequest : public BulkRequest {
+	TraceRecorder&	_recorder;
+	BulkRequest	*_request;
+	uint64_t	_start;
+	bool	_pending;
+	void	update();
+public:
+	RecordingRequest(TraceRecorder& recorder, BulkRequest *request)
+		: BulkRequest(request->endpoint()), _recorder(recorder),
+		  _request(request), _start(0), _pending(false) { }
+	virtual ~RecordingRequest() { delete _request; }
+	virtual void	submit(unsigned char *data, int length,
+				unsigned int timeout);
+	virtual void	cancel();
+	virtual void	wait();
+};
+
+/**
+ * \brief Copy the state of the wrapped request
+ */
+void	RecordingRequest::update() {
+	_data = _request->data();
+	_transferred = _request->transferred();
+	_status = _request->status();
+	_completed = _request->completed();
+}
+
+/**
+ * \brief Submit the wrapped request
+ */
+void	RecordingRequest::submit(unsigned char *data, int length,
+		unsigned int timeout) {
+	_start = _recorder.now();
+	_length = length;
+	_request->submit(data, length, timeout);
+	_pending = true;
+	update();
+}
+
+/**
+ * \brief Cancel the wrapped request
+ */
+void	RecordingRequest::cancel() {
+	_request->cancel();
+	update();
+}
+
+/**
+ * \brief Wait for the wrapped request and record it
+ *
+ * Cancelled transfers are not recorded, as they do not reflect a
+ * response of the device.
+ */
+void	RecordingRequest::wait() {
+	_request->wait();
+	update();
+	if (_pending && _completed) {
+		_pending = false;
+		if (_status != LIBUSB_ERROR_INTERRUPTED) {
+			addrecord(_recorder, USBTRACE_BULK, _endpoint, 0, 0, 0,
+				_start, _status, _length, _data,
+				_transferred);
+		}
+	}
+}
+
+/**
+ * \brief Create a recording transport
+ *
+ * The recording transport takes ownership of the transport it wraps.
+ * \param transport	the transport to record
+ * \param filename	name of the trace file
+ * \param capacity	size of the ring buffer for records not yet written
+ */
+RecordingTransport::RecordingTransport(Transport *transport,
+	const std::string& filename, unsigned long capacity)
+	: _transport(transport) {
+	usbtrace_header	header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, USBTRACE_MAGIC, sizeof(header.magic));
+	header.version = USBTRACE_VERSION;
+	header.idVendor = _transport->idVendor();
+	header.idProduct = _transport->idProduct();
+	header.dataendpoint = _transport->dataendpoint();
+	try {
+		_recorder = new TraceRecorder(filename, header, capacity);
+	} catch (...) {
+		delete _transport;
+		throw;
+	}
+}
+
+/**
+ * \brief Destroy the transport, this flushes the trace
+ */
+RecordingTransport::~RecordingTransport() {
+	delete _transport;
+	delete _recorder;
+}
+
+/**
+ * \brief Perform and record a control transfer
+ */
+int	RecordingTransport::controltransfer(uint8_t bmRequestType,
+		uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+		unsigned char *data, uint16_t wLength, unsigned int timeout) {
+	uint64_t	start = _recorder->now();
+	int	rc;
+	try {
+		rc = _transport->controltransfer(bmRequestType, bRequest,
+			wValue, wIndex, data, wLength, timeout);
+	} catch (const USBError& x) {
+		addrecord(*_recorder, USBTRACE_CONTROL, bmRequestType,
+			bRequest, wValue, wIndex, start, x.usberror(),
+			wLength, data, 0);
+		throw;
+	}
+	addrecord(*_recorder, USBTRACE_CONTROL, bmRequestType, bRequest,
+		wValue, wIndex, start, rc, wLength, data, rc);
+	return rc;
+}
+
+/**
+ * \brief Perform and record a synchronous bulk transfer
+ */
+int	RecordingTransport::bulktransfer(unsigned char ep, unsigned char *data,
+		int length, unsigned int timeout) {
+	uint64_t	start = _recorder->now();
+	int	rc;
+	try {
+		rc = _transport->bulktransfer(ep, data, length, timeout);
+	} catch (const USBError& x) {
+		addrecord(*_recorder, USBTRACE_BULK, ep, 0, 0, 0, start,
+			x.usberror(), length, data, 0);
+		throw;
+	}
+	addrecord(*_recorder, USBTRACE_BULK, ep, 0, 0, 0, start, rc, length,
+		data, rc);
+	return rc;
+}
+
+/**
+ * \brief Create a recording bulk request
+ */
+BulkRequest	*RecordingTransport::bulkrequest(unsigned char ep) {
+	return new RecordingRequest(*_recorder, _transport->bulkrequest(ep));
+}
+
+} // namespace qhy
@@ -0,0 +1,273 @@
+/*
+ * replaytransport.cpp -- USB transport replaying a recorded trace
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <replaytransport.h>
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <libusb-1.0/libusb.h>
+
+namespace qhy {
+
+/**
+ * \brief Bulk request answered from the trace
+ *
+ * The record to replay is selected when the request is submitted, so
+ * that requests queued on the same endpoint are answered in order and
+ * paced as if they had been queued on the device.
+ */
+class ReplayRequest : public BulkRequest {
+	ReplayTransport&	_transport;
+	ReplayTransport::Replay	_replay;
+public:
+	ReplayRequest(ReplayTransport& transport, unsigned char endpoint)
+		: BulkRequest(endpoint), _transport(transport) { }
+	virtual void	submit(unsigned char *data, int length,
+				unsigned int timeout);
+	virtual void	cancel();
+	virtual void	wait();
+};
+
+/**
+ * \brief Submit a request, this only selects the record to replay
+ */
+void	ReplayRequest::submit(unsigned char *data, int length,
+		unsigned int /* timeout */) {
+	_replay = _transport.next(USBTRACE_BULK, _endpoint, 0);
+	_data = data;
+	_length = length;
+	_transferred = 0;
+	_status = 0;
+	_completed = false;
+}
+
+/**
+ * \brief Cancel the request
+ */
+void	ReplayRequest::cancel() {
+	if (!_completed) {
+		_status = LIBUSB_ERROR_INTERRUPTED;
+		_completed = true;
+	}
+}
+
+/**
+ * \brief Wait for the request, i.e. replay the recorded data
+ */
+void	ReplayRequest::wait() {
+	if (_completed) {
+		return;
+	}
+	int	rc = _transport.complete(_replay, _data, _length);
+	if (rc < 0) {
+		_status = rc;
+	} else {
+		_transferred = rc;
+	}
+	_completed = true;
+}
+
+/**
+ * \brief Compute the stream key for a transfer
+ */
+unsigned int	ReplayTransport::key(uint8_t type, uint8_t endpoint,
+			uint8_t bRequest) {
+	return (type << 16) | (endpoint << 8) | bRequest;
+}
+
+/**
+ * \brief Create a replay transport from a trace file
+ *
+ * \param filename	name of the trace file
+ * \param realtime	whether to reproduce the timing of the recording
+ */
+ReplayTransport::ReplayTransport(const std::string& filename, bool realtime)
+	: _realtime(realtime) {
+	load(filename);
+}
+
+/**
+ * \brief Destroy the replay transport
+ */
+ReplayTransport::~ReplayTransport() {
+}
+
+/**
+ * \brief Read the trace file and index the records by endpoint
+ *
+ * The complete trace is kept in memory, so that replay never has to
+ * touch the file system. A record truncated at the end of the file, as
+ * it may result from a recording that was interrupted, is ignored.
+ */
+void	ReplayTransport::load(const std::string& filename) {
+	std::ifstream	in(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!in) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot open trace %s",
+			filename.c_str());
+		throw DeviceNotFound("cannot open trace file");
+	}
+	in.seekg(0, std::ios::end);
+	std::streamoff	size = in.tellg();
+	in.seekg(0, std::ios::beg);
+	if (size < (std::streamoff)sizeof(header)) {
+		throw std::runtime_error("trace file too short");
+	}
+	trace.resize(size);
+	in.read((char *)&trace[0], size);
+	if (!in) {
+		throw std::runtime_error("cannot read trace file");
+	}
+
+	// check the header
+	memcpy(&header, &trace[0], sizeof(header));
+	if ((0 != memcmp(header.magic, USBTRACE_MAGIC, sizeof(header.magic)))
+		|| (header.version != USBTRACE_VERSION)) {
+		throw std::runtime_error("not a USB trace file");
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "trace of device %04x/%04x",
+		header.idVendor, header.idProduct);
+
+	// index the records
+	unsigned long	offset = sizeof(header);
+	unsigned long	count = 0;
+	while (offset + sizeof(usbtrace_record) <= trace.size()) {
+		Record	record;
+		memcpy(&record.record, &trace[offset],
+			sizeof(usbtrace_record));
+		const usbtrace_record	*r = &record.record;
+		if (offset + sizeof(usbtrace_record) + r->length
+			> trace.size()) {
+			qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
+				"ignoring truncated record at %lu", offset);
+			break;
+		}
+		record.payload = &trace[offset + sizeof(usbtrace_record)];
+
+		// The service time is the time the device took for this
+		// transfer. For transfers queued behind others, only the
+		// time since the previous transfer on the same endpoint
+		// completed counts.
+		Stream&	stream = streams[key(r->type, r->endpoint,
+					(r->type == USBTRACE_CONTROL)
+						? r->bRequest : 0)];
+		uint64_t	service = r->duration;
+		if (stream.records.size() > 0) {
+			const usbtrace_record	*p
+				= &stream.records.back().record;
+			uint64_t	pend = p->timestamp + p->duration;
+			uint64_t	end = r->timestamp + r->duration;
+			if ((end > pend) && ((end - pend) < service)) {
+				service = end - pend;
+			}
+		}
+		record.service = std::chrono::nanoseconds(service);
+		stream.records.push_back(record);
+
+		offset += sizeof(usbtrace_record) + r->length;
+		count++;
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "%lu records in %d streams",
+		count, (int)streams.size());
+}
+
+/**
+ * \brief Select the next record to replay for a transfer
+ *
+ * In real-time mode, this also computes when the transfer is due: the
+ * device works on the transfers of an endpoint one at a time, so a
+ * transfer can only start when the previous one has completed.
+ */
+ReplayTransport::Replay	ReplayTransport::next(uint8_t type, uint8_t endpoint,
+		uint8_t bRequest) {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	std::map<unsigned int, Stream>::iterator	i
+		= streams.find(key(type, endpoint, bRequest));
+	if ((i == streams.end()) || (i->second.records.size() == 0)) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0,
+			"no recorded transfers for endpoint %02x/%02x",
+			endpoint, bRequest);
+		throw USBError(LIBUSB_ERROR_NOT_FOUND);
+	}
+	Stream&	stream = i->second;
+	Replay	replay;
+	replay.record = &stream.records[stream.position];
+	stream.position = (stream.position + 1) % stream.records.size();
+	replay.due = std::chrono::steady_clock::now();
+	if (_realtime) {
+		if (stream.busyuntil > replay.due) {
+			replay.due = stream.busyuntil;
+		}
+		replay.due += replay.record->service;
+		stream.busyuntil = replay.due;
+	}
+	return replay;
+}
+
+/**
+ * \brief Complete a transfer with the recorded data
+ *
+ * \return the number of bytes transferred or a libusb error code
+ */
+int	ReplayTransport::complete(const Replay& replay, unsigned char *data,
+		int length) {
+	if (_realtime) {
+		std::this_thread::sleep_until(replay.due);
+	}
+	const usbtrace_record	*r = &replay.record->record;
+	if (r->status < 0) {
+		return r->status;
+	}
+	int	n = r->length;
+	if (n > length) {
+		n = length;
+	}
+	// IN transfers receive the recorded data, for control transfers
+	// the direction is in the request type
+	if (r->endpoint & 0x80) {
+		memcpy(data, replay.record->payload, n);
+	}
+	return n;
+}
+
+/**
+ * \brief Replay a control transfer
+ */
+int	ReplayTransport::controltransfer(uint8_t bmRequestType,
+		uint8_t bRequest, uint16_t /* wValue */, uint16_t /* wIndex */,
+		unsigned char *data, uint16_t wLength,
+		unsigned int /* timeout */) {
+	int	rc = complete(next(USBTRACE_CONTROL, bmRequestType, bRequest),
+			data, wLength);
+	if (rc < 0) {
+		throw USBError(rc);
+	}
+	return rc;
+}
+
+/**
+ * \brief Replay a synchronous bulk transfer
+ */
+int	ReplayTransport::bulktransfer(unsigned char ep, unsigned char *data,
+		int length, unsigned int /* timeout */) {
+	int	rc = complete(next(USBTRACE_BULK, ep, 0), data, length);
+	if (rc < 0) {
+		throw USBError(rc);
+	}
+	return rc;
+}
+
+/**
+ * \brief Create a bulk request answered from the trace
+ */
+BulkRequest	*ReplayTransport::bulkrequest(unsigned char ep) {
+	return new ReplayRequest(*this, ep);
+}
+
+} // namespace qhy
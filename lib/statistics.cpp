@@ -0,0 +1,159 @@
+/*
+ * statistics.cpp -- pixel statistics collected during demultiplexing
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <statistics.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace qhy {
+
+/**
+ * \brief Create empty frame statistics
+ */
+FrameStatistics::FrameStatistics() : count(0), min(0), max(0), mean(0),
+	stddev(0), saturated(0) {
+}
+
+/**
+ * \brief Human readable summary of the statistics, without the histogram
+ */
+std::string	FrameStatistics::toString() const {
+	char	buffer[256];
+	snprintf(buffer, sizeof(buffer),
+		"%lu pixels, min %u, max %u, mean %.3f, stddev %.3f, "
+		"%lu saturated", count, min, max, mean, stddev, saturated);
+	return std::string(buffer);
+}
+
+/**
+ * \brief Create partial statistics with an empty histogram
+ */
+PixelStatistics::PixelStatistics() : _histogram(2 * 65536) {
+	reset();
+}
+
+/**
+ * \brief Forget all pixels, keeping the memory of the histogram
+ */
+void	PixelStatistics::reset() {
+	memset(&_histogram[0], 0, _histogram.size() * sizeof(unsigned int));
+	_large = 0;
+	_largesum = 0;
+	_largesquares = 0;
+	_largemin = 0;
+	_largemax = 0;
+	_largesaturated = 0;
+	_saturation = 65535;
+}
+
+/**
+ * \brief Add a pixel of a 32 bit image that does not fit the histogram
+ */
+void	PixelStatistics::addlarge(unsigned int pixel) {
+	if ((0 == _large) || (pixel < _largemin)) {
+		_largemin = pixel;
+	}
+	if ((0 == _large) || (pixel > _largemax)) {
+		_largemax = pixel;
+	}
+	_large++;
+	_largesum += pixel;
+	_largesquares += (double)pixel * pixel;
+	if (pixel >= _saturation) {
+		_largesaturated++;
+	}
+}
+
+/**
+ * \brief Add the pixels of another band
+ */
+void	PixelStatistics::merge(const PixelStatistics& other) {
+	for (unsigned int v = 0; v < _histogram.size(); v++) {
+		_histogram[v] += other._histogram[v];
+	}
+	if (other._saturation > _saturation) {
+		_saturation = other._saturation;
+	}
+	if (0 == other._large) {
+		return;
+	}
+	if ((0 == _large) || (other._largemin < _largemin)) {
+		_largemin = other._largemin;
+	}
+	if ((0 == _large) || (other._largemax > _largemax)) {
+		_largemax = other._largemax;
+	}
+	_large += other._large;
+	_largesum += other._largesum;
+	_largesquares += other._largesquares;
+	_largesaturated += other._largesaturated;
+}
+
+/**
+ * \brief Derive the frame statistics from the histogram
+ *
+ * The variance is computed from the deviations of the histogram bins
+ * from the mean, which avoids the cancellation of the textbook formula
+ * for all pixels that fit into the histogram.
+ */
+FrameStatisticsPtr	PixelStatistics::result() const {
+	FrameStatisticsPtr	result(new FrameStatistics());
+	FrameStatistics&	s = *result;
+	s.histogram.resize(65536);
+	unsigned long long	sum = _largesum;
+	bool	empty = true;
+	for (unsigned int v = 0; v < 65536; v++) {
+		unsigned long	h = (unsigned long)_histogram[v]
+					+ _histogram[v + 65536];
+		s.histogram[v] = h;
+		if (0 == h) {
+			continue;
+		}
+		if (empty) {
+			s.min = v;
+			empty = false;
+		}
+		s.max = v;
+		s.count += h;
+		sum += (unsigned long long)v * h;
+	}
+	if (_large) {
+		if (empty) {
+			s.min = _largemin;
+		}
+		s.max = _largemax;
+		s.count += _large;
+	}
+	if (_saturation > 65535) {
+		s.saturated = _largesaturated;
+	} else {
+		s.saturated = _large;
+		for (unsigned int v = _saturation; v < 65536; v++) {
+			s.saturated += s.histogram[v];
+		}
+	}
+	if (0 == s.count) {
+		return result;
+	}
+	s.mean = (double)sum / s.count;
+	double	squares = _largesquares - 2 * s.mean * _largesum
+				+ _large * s.mean * s.mean;
+	for (unsigned int v = 0; v < 65536; v++) {
+		unsigned long	h = (unsigned long)_histogram[v]
+					+ _histogram[v + 65536];
+		if (h) {
+			double	d = v - s.mean;
+			squares += h * d * d;
+		}
+	}
+	s.stddev = sqrt(((squares > 0) ? squares : 0) / s.count);
+	return result;
+}
+
+} // namespace qhy
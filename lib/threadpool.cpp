@@ -0,0 +1,192 @@
+/*
+ * threadpool.cpp -- worker threads for parallel image processing
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <threadpool.h>
+#include <qhydebug.h>
+#include <exception>
+#include <stdexcept>
+
+namespace qhy {
+
+/**
+ * \brief Bookkeeping for the parts of a parallel() call
+ */
+class parallelbatch {
+public:
+	ParallelWork&	work;
+	std::mutex	mutex;
+	std::condition_variable	cond;
+	unsigned int	remaining;
+	std::exception_ptr	error;
+	parallelbatch(ParallelWork& w, unsigned int parts)
+		: work(w), remaining(parts) { }
+	void	run(unsigned int part) {
+		std::exception_ptr	e;
+		try {
+			work.run(part);
+		} catch (...) {
+			e = std::current_exception();
+		}
+		std::unique_lock<std::mutex>	lock(mutex);
+		if (e && !error) {
+			error = e;
+		}
+		if (0 == --remaining) {
+			cond.notify_all();
+		}
+	}
+};
+
+/**
+ * \brief main function for the worker threads
+ */
+static void	worker_main(void *arg) {
+	ThreadPool	*pool = (ThreadPool *)arg;
+	pool->main();
+}
+
+/**
+ * \brief Start the worker threads
+ */
+ThreadPool::ThreadPool(unsigned int threads) : _next(0), _stop(false) {
+	if (threads < 1) {
+		throw std::range_error("thread pool needs at least one thread");
+	}
+	try {
+		for (unsigned int i = 1; i < threads; i++) {
+			_threads.push_back(std::thread(worker_main, this));
+		}
+	} catch (const std::exception& x) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot launch thread: %s",
+			x.what());
+		{
+			std::unique_lock<std::mutex>	lock(_mutex);
+			_stop = true;
+		}
+		_cond.notify_all();
+		for (unsigned int i = 0; i < _threads.size(); i++) {
+			_threads[i].join();
+		}
+		throw std::runtime_error("cannot start worker threads");
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "thread pool with %u threads",
+		threads);
+}
+
+/**
+ * \brief Stop the worker threads
+ */
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		_stop = true;
+	}
+	_cond.notify_all();
+	for (unsigned int i = 0; i < _threads.size(); i++) {
+		_threads[i].join();
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "thread pool stopped");
+}
+
+/**
+ * \brief Worker loop, executes tasks until the pool is destroyed
+ */
+void	ThreadPool::main() {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	while (true) {
+		while (!_stop && (_next == _tasks.size())) {
+			_cond.wait(lock);
+		}
+		if (_next == _tasks.size()) {
+			return;
+		}
+		task	t = _tasks[_next++];
+		if (_next == _tasks.size()) {
+			_tasks.clear();
+			_next = 0;
+		}
+		lock.unlock();
+		t.first->run(t.second);
+		lock.lock();
+	}
+}
+
+/**
+ * \brief Process parts 0 to parts - 1 of some work concurrently
+ *
+ * The call returns when all parts are complete. If some part throws an
+ * exception, the first such exception is rethrown once all other parts
+ * have completed.
+ */
+void	ThreadPool::parallel(unsigned int parts, ParallelWork& work) {
+	if (0 == parts) {
+		return;
+	}
+	parallelbatch	batch(work, parts);
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		for (unsigned int part = 1; part < parts; part++) {
+			_tasks.push_back(task(&batch, part));
+		}
+	}
+	_cond.notify_all();
+	batch.run(0);
+	std::unique_lock<std::mutex>	lock(batch.mutex);
+	while (batch.remaining > 0) {
+		batch.cond.wait(lock);
+	}
+	if (batch.error) {
+		std::rethrow_exception(batch.error);
+	}
+}
+
+/**
+ * \brief Create a band runner with a single thread
+ *
+ * \param stage	name of the stage, for error messages
+ */
+BandRunner::BandRunner(const std::string& stage) : _stage(stage),
+	_threads(1) {
+}
+
+/**
+ * \brief Set the number of threads computing bands of rows
+ */
+void	BandRunner::threads(unsigned int threads) {
+	if (threads < 1) {
+		throw std::range_error("need at least one " + _stage
+			+ " thread");
+	}
+	_threads = threads;
+}
+
+/**
+ * \brief The number of bands to split rows into
+ */
+unsigned int	BandRunner::bands(unsigned int rows) const {
+	return (_threads < rows) ? _threads : rows;
+}
+
+/**
+ * \brief Process the bands of some work
+ *
+ * A single band is processed by the calling thread, no band at all if
+ * the image has no rows.
+ */
+void	BandRunner::run(unsigned int bands, ParallelWork& work) {
+	if (bands > 1) {
+		if ((!_pool) || (_pool->size() != _threads)) {
+			_pool = ThreadPoolPtr(new ThreadPool(_threads));
+		}
+		_pool->parallel(bands, work);
+	} else if (bands > 0) {
+		work.run(0);
+	}
+}
+
+} // namespace qhy
@@ -0,0 +1,178 @@
+/*
+ * tracerecorder.cpp -- buffered writer for USB trace files
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <recordingtransport.h>
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <cstring>
+
+namespace qhy {
+
+/**
+ * \brief main function for the flush thread
+ */
+static void	recorder_main(void *arg) {
+	try {
+		TraceRecorder	*recorder = (TraceRecorder *)arg;
+		recorder->main();
+	} catch (const std::exception& x) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "trace thread failed: %s",
+			x.what());
+	}
+}
+
+/**
+ * \brief Create a trace file and start the flush thread
+ *
+ * \param filename	name of the trace file to create
+ * \param header		file header describing the traced device
+ * \param capacity	size of the ring buffer in bytes
+ */
+TraceRecorder::TraceRecorder(const std::string& filename,
+	const usbtrace_header& header, unsigned long capacity)
+	: _capacity(capacity), _head(0), _tail(0), _dropped(0),
+	  _stop(false) {
+	_file = fopen(filename.c_str(), "wb");
+	if (NULL == _file) {
+		qhydebug(LOG_ERR, DEBUG_LOG, DEBUG_ERRNO,
+			"cannot create trace %s", filename.c_str());
+		throw std::runtime_error("cannot create trace file");
+	}
+	if (1 != fwrite(&header, sizeof(header), 1, _file)) {
+		fclose(_file);
+		throw std::runtime_error("cannot write trace header");
+	}
+	_ring = new unsigned char[_capacity];
+	_start = std::chrono::steady_clock::now();
+	try {
+		_thread = std::thread(recorder_main, this);
+	} catch (const std::exception& x) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0, "cannot launch thread: %s",
+			x.what());
+		delete[] _ring;
+		fclose(_file);
+		throw std::runtime_error("cannot start trace thread");
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "recording USB traffic to %s",
+		filename.c_str());
+}
+
+/**
+ * \brief Stop the flush thread and close the trace file
+ */
+TraceRecorder::~TraceRecorder() {
+	{
+		std::unique_lock<std::mutex>	lock(_mutex);
+		_stop = true;
+	}
+	_cond.notify_all();
+	_thread.join();
+	fclose(_file);
+	delete[] _ring;
+	if (_dropped) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0,
+			"%lu trace records dropped, ring too small", _dropped);
+	}
+}
+
+/**
+ * \brief Nanoseconds since the start of the trace
+ */
+uint64_t	TraceRecorder::now() const {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - _start).count();
+}
+
+/**
+ * \brief Copy data into the ring, wrapping around at the end
+ */
+void	TraceRecorder::copyin(unsigned long position, const void *data,
+		unsigned long length) {
+	unsigned long	offset = position % _capacity;
+	unsigned long	first = _capacity - offset;
+	if (first > length) {
+		first = length;
+	}
+	memcpy(_ring + offset, data, first);
+	if (length > first) {
+		memcpy(_ring, (const unsigned char *)data + first,
+			length - first);
+	}
+}
+
+/**
+ * \brief Add a record to the trace
+ *
+ * The record is only copied into the ring, writing it to the file is
+ * left to the flush thread, which is woken up early if the ring is
+ * more than half full.
+ */
+void	TraceRecorder::record(const usbtrace_record& record,
+		const unsigned char *payload) {
+	unsigned long	need = sizeof(record) + record.length;
+	unsigned long	used;
+	{
+		std::unique_lock<std::mutex>	lock(_producer);
+		unsigned long	head = _head.load(std::memory_order_relaxed);
+		used = head - _tail.load(std::memory_order_acquire);
+		if (used + need > _capacity) {
+			_dropped++;
+			return;
+		}
+		copyin(head, &record, sizeof(record));
+		if (record.length) {
+			copyin(head + sizeof(record), payload, record.length);
+		}
+		_head.store(head + need, std::memory_order_release);
+	}
+	if (2 * (used + need) > _capacity) {
+		_cond.notify_one();
+	}
+}
+
+/**
+ * \brief Write everything in the ring to the trace file
+ */
+void	TraceRecorder::flush() {
+	unsigned long	head = _head.load(std::memory_order_acquire);
+	unsigned long	tail = _tail.load(std::memory_order_relaxed);
+	while (tail < head) {
+		unsigned long	offset = tail % _capacity;
+		unsigned long	length = _capacity - offset;
+		if (length > head - tail) {
+			length = head - tail;
+		}
+		if (1 != fwrite(_ring + offset, length, 1, _file)) {
+			qhydebug(LOG_ERR, DEBUG_LOG, DEBUG_ERRNO,
+				"cannot write trace");
+		}
+		tail += length;
+	}
+	_tail.store(tail, std::memory_order_release);
+	fflush(_file);
+}
+
+/**
+ * \brief main method of the flush thread
+ *
+ * The ring is flushed at least ten times per second, so that a trace
+ * of a session that ends in a crash is mostly complete.
+ */
+void	TraceRecorder::main() {
+	std::unique_lock<std::mutex>	lock(_mutex);
+	while (!_stop) {
+		_cond.wait_for(lock, std::chrono::milliseconds(100));
+		lock.unlock();
+		flush();
+		lock.lock();
+	}
+	lock.unlock();
+	flush();
+}
+
+} // namespace qhy
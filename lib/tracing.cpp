@@ -0,0 +1,197 @@
+/*
+ * tracing.cpp -- record spans and write them in Chrome trace event format
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <tracing.h>
+#include <qhylib.h>
+#include <qhydebug.h>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <mutex>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+namespace qhy {
+
+std::atomic<bool>	tracing(false);
+
+/**
+ * \brief A completed span
+ */
+struct traceevent {
+	const char	*name;
+	uint64_t	start;
+	uint64_t	duration;
+	long	arg;
+};
+
+/**
+ * \brief Preallocated event buffer of a thread
+ *
+ * Only the owning thread adds events, the buffer is read when tracing
+ * stops. Buffers are never freed while their thread is alive, they are
+ * reused by the next trace instead, so a thread that is still recording
+ * a span when tracing stops never writes to released memory.
+ */
+class tracebuffer {
+public:
+	traceevent	*events;
+	unsigned long	capacity;
+	std::atomic<unsigned long>	count;
+	std::atomic<unsigned long>	dropped;
+	std::atomic<bool>	orphaned;
+	unsigned int	tid;
+	tracebuffer(unsigned long c, unsigned int t) : capacity(c), count(0),
+		dropped(0), orphaned(false), tid(t) {
+		events = new traceevent[capacity];
+	}
+	~tracebuffer() { delete[] events; }
+};
+
+static std::mutex	trace_mutex;
+static std::list<tracebuffer *>	tracebuffers;
+static std::string	tracefilename;
+static unsigned long	tracecapacity = 0;
+static unsigned int	tracethreads = 0;
+static const std::chrono::steady_clock::time_point	traceepoch
+	= std::chrono::steady_clock::now();
+
+/**
+ * \brief owner of the buffer of a thread, marks it orphaned on exit
+ */
+class tracebufferholder {
+public:
+	tracebuffer	*buffer;
+	tracebufferholder() : buffer(NULL) { }
+	~tracebufferholder() {
+		if (buffer) {
+			buffer->orphaned.store(true, std::memory_order_release);
+		}
+	}
+};
+
+static thread_local tracebufferholder	threadbuffer;
+
+/**
+ * \brief Nanoseconds of the monotonic clock
+ */
+uint64_t	tracenow() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - traceepoch).count();
+}
+
+/**
+ * \brief Record a span in the buffer of the calling thread
+ *
+ * The only allocation happens the first time a thread records a span.
+ */
+void	tracespan(const char *name, uint64_t start, uint64_t end, long arg) {
+	tracebuffer	*buffer = threadbuffer.buffer;
+	if (NULL == buffer) {
+		std::unique_lock<std::mutex>	lock(trace_mutex);
+		buffer = new tracebuffer(tracecapacity, ++tracethreads);
+		tracebuffers.push_back(buffer);
+		threadbuffer.buffer = buffer;
+	}
+	unsigned long	n = buffer->count.load(std::memory_order_relaxed);
+	if (n >= buffer->capacity) {
+		buffer->dropped++;
+		return;
+	}
+	traceevent&	event = buffer->events[n];
+	event.name = name;
+	event.start = start;
+	event.duration = end - start;
+	event.arg = arg;
+	buffer->count.store(n + 1, std::memory_order_release);
+}
+
+/**
+ * \brief Start recording spans
+ *
+ * \param filename	the file the trace is written to by tracestop()
+ * \param capacity	number of spans each thread can record
+ */
+void	tracestart(const std::string& filename, unsigned long capacity) {
+	std::unique_lock<std::mutex>	lock(trace_mutex);
+	if (tracing) {
+		throw std::runtime_error("tracing already active");
+	}
+	// existing buffers are reused, they keep the capacity they were
+	// allocated with
+	for (std::list<tracebuffer *>::iterator i = tracebuffers.begin();
+		i != tracebuffers.end(); i++) {
+		(*i)->count = 0;
+		(*i)->dropped = 0;
+	}
+	tracefilename = filename;
+	if (tracecapacity < capacity) {
+		tracecapacity = capacity;
+	}
+	tracing = true;
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "tracing to %s", filename.c_str());
+}
+
+/**
+ * \brief Stop recording spans and write the trace file
+ *
+ * The file can be loaded into chrome://tracing or the Perfetto UI. Each
+ * thread that recorded spans appears as a separate track.
+ */
+void	tracestop() {
+	std::unique_lock<std::mutex>	lock(trace_mutex);
+	if (!tracing) {
+		return;
+	}
+	tracing = false;
+	FILE	*out = fopen(tracefilename.c_str(), "w");
+	if (NULL == out) {
+		qhydebug(LOG_ERR, DEBUG_LOG, DEBUG_ERRNO, "cannot create %s",
+			tracefilename.c_str());
+		throw std::runtime_error("cannot create trace file");
+	}
+	int	pid = getpid();
+	fprintf(out, "{\"traceEvents\":[\n");
+	const char	*separator = "";
+	unsigned long	dropped = 0;
+	std::list<tracebuffer *>::iterator	i = tracebuffers.begin();
+	while (i != tracebuffers.end()) {
+		tracebuffer	*buffer = *i;
+		unsigned long	n = buffer->count.load(std::memory_order_acquire);
+		for (unsigned long j = 0; j < n; j++) {
+			const traceevent&	e = buffer->events[j];
+			fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"qhy\","
+				"\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+				"\"pid\":%d,\"tid\":%u", separator, e.name,
+				e.start / 1000., e.duration / 1000., pid,
+				buffer->tid);
+			if (e.arg >= 0) {
+				fprintf(out, ",\"args\":{\"n\":%ld}", e.arg);
+			}
+			fprintf(out, "}");
+			separator = ",\n";
+		}
+		dropped += buffer->dropped;
+		if (buffer->orphaned.load(std::memory_order_acquire)) {
+			delete buffer;
+			i = tracebuffers.erase(i);
+		} else {
+			i++;
+		}
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(out);
+	if (dropped) {
+		qhydebug(LOG_ERR, DEBUG_LOG, 0,
+			"%lu spans dropped, trace buffers too small", dropped);
+	}
+}
+
+} // namespace qhy
@@ -0,0 +1,57 @@
+/*
+ * transport.cpp -- common parts of all USB transports
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#include <transport.h>
+
+namespace qhy {
+
+/**
+ * \brief Create a bulk request for an endpoint
+ *
+ * A new request counts as completed, as there is nothing to wait for.
+ */
+BulkRequest::BulkRequest(unsigned char endpoint) : _endpoint(endpoint) {
+	_data = 0;
+	_length = 0;
+	_transferred = 0;
+	_status = 0;
+	_completed = true;
+}
+
+/**
+ * \brief Destroy the bulk request
+ */
+BulkRequest::~BulkRequest() {
+}
+
+/**
+ * \brief Construct a transport
+ */
+Transport::Transport() {
+}
+
+/**
+ * \brief Destroy the transport
+ */
+Transport::~Transport() {
+}
+
+/**
+ * \brief Allocate memory the USB driver can transfer data into directly
+ *
+ * Transports without such memory return 0, which is the default.
+ */
+unsigned char	*Transport::dmaalloc(unsigned long /* length */) {
+	return 0;
+}
+
+/**
+ * \brief Release memory allocated with dmaalloc()
+ */
+void	Transport::dmafree(unsigned char * /* data */,
+		unsigned long /* length */) {
+}
+
+} // namespace qhy
@@ -30,16 +30,76 @@ DevicePtr	device;
 
 static void	usage(const char *progname) {
 	std::cout << "usage: " << progname;
-	std::cout << "%s [ -d ] [ -p cameraid ] [ -b bin ] [ -e seconds ] "
-		"fitsfile" << std::endl;
+	std::cout << "%s [ -d ] [ -g logfile ] [ -p cameraid ] [ -b bin ] "
+		"[ -e seconds ] "
+		"[ -q depth ] [ -s ] [ -n threads ] [ -m memory ] [ -i ] [ -w ] [ -x NxM ] [ -a ] [ -c method ] "
+		"[ -B bias ] [ -D dark ] [ -F flat ] [ -L library ] [ -M method ] [ -A ] "
+		"[ -k ] [ -o ] [ -r trace ] [ -t trace ] [ -u bus-ports ] "
+		"[ -j json ] "
+		"fitsfile"
+		<< std::endl;
 	std::cout << "retrieve an image from a QHYCCD camera and save it "
 			"in <fitsfile>" << std::endl;
 	std::cout << "options:" << std::endl;
 	std::cout << "  -d           increase the debug level" << std::endl;
+	std::cout << "  -g logfile   write debug messages to logfile"
+		<< std::endl;
 	std::cout << "  -b bin       binning mode, take a bin x bin "
 		"binned image" << std::endl;
 	std::cout << "  -e seconds   exposure time in seconds" << std::endl;
 	std::cout << "  -f           fast download speed" << std::endl;
+	std::cout << "  -q depth     number of USB transfers in flight during "
+		"download" << std::endl;
+	std::cout << "  -s           demultiplex while downloading" << std::endl;
+	std::cout << "  -n threads   number of threads for demultiplexing"
+		<< std::endl;
+	std::cout << "  -m memory    memory for the raw data: heap, huge, "
+		"dma, or lock" << std::endl;
+	std::cout << "               for locked huge pages" << std::endl;
+	std::cout << "  -i           compute pixel statistics of the active "
+		"area while" << std::endl;
+	std::cout << "               demultiplexing and display them"
+		<< std::endl;
+	std::cout << "  -w           save 32 bit pixels, binned pixels do not "
+		"saturate" << std::endl;
+	std::cout << "  -x NxM       bin NxM pixels in software, pixels of "
+		"the same color" << std::endl;
+	std::cout << "               if the image is debayered" << std::endl;
+	std::cout << "  -a           average the pixels of software bins "
+		"instead of adding them" << std::endl;
+	std::cout << "  -c method    debayer the image and save three color "
+		"planes," << std::endl;
+	std::cout << "               method is super, bilinear or edge"
+		<< std::endl;
+	std::cout << "  -B bias      subtract the master bias from this FITS "
+		"file" << std::endl;
+	std::cout << "  -D dark      subtract the master dark from this FITS "
+		"file" << std::endl;
+	std::cout << "  -F flat      divide by the master flat from this FITS "
+		"file" << std::endl;
+	std::cout << "  -L library   subtract a dark from the dark library in "
+		"this directory" << std::endl;
+	std::cout << "  -M method    derive darks from the library masters by "
+		"nearest, interpolate" << std::endl;
+	std::cout << "               or scale" << std::endl;
+	std::cout << "  -A           add the image to the dark library as a "
+		"master dark" << std::endl;
+	std::cout << "  -k           save calibrated pixels as floating point"
+		<< std::endl;
+	std::cout << "  -o           keep the overscan, save the full sensor "
+		"image" << std::endl;
+	std::cout << "  -r trace     replay USB traffic from a trace file "
+		"instead of using a camera" << std::endl;
+	std::cout << "  -t trace     record USB traffic to a trace file"
+		<< std::endl;
+	std::cout << "  -j json      write a trace of the acquisition in "
+		"Chrome trace event format" << std::endl;
+	std::cout << "  -l           list the cameras attached to the host"
+		<< std::endl;
+	std::cout << "  -u bus-ports use the camera at this USB location, e.g. "
+		"1-2.4 for" << std::endl;
+	std::cout << "               port 4 of the hub at port 2 of bus 1"
+		<< std::endl;
 	std::cout << "  -p cameraid  set the USB product id of the camera";
 	std::cout << std::endl;
 	std::cout << "               known cameras:" << std::endl;
@@ -58,6 +118,106 @@ unsigned short	getProduct(const char *s) {
 	return result;
 }
 
+/**
+ * \brief Log information about an image and write it to a FITS file
+ *
+ * \param bitpix	FITS image type matching the pixel type
+ * \param datatype	FITS data type of the pixels
+ */
+template<typename Pixel>
+static void	saveimage(Camera& camera, const Image<Pixel>& image,
+		double starttime, const char *filename, int bitpix,
+		int datatype) {
+	double	endtime = gettime();
+
+	ImageSize	size = image.image_size();
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
+		"image size: %d x %d, (%f seconds)",
+		size.width(), size.height(), endtime - starttime);
+
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "frame metrics: %s",
+		image.metrics().toString().c_str());
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "buffer pool: %s",
+		camera.poolstatistics().toString().c_str());
+	if (image.statistics()) {
+		std::cout << "statistics: " << image.statistics()->toString()
+			<< std::endl;
+	}
+
+	// write the image data to 
+	unlink(filename);
+	fitsfile	*fits = NULL;
+	int	status = 0;
+	fits_create_file(&fits, filename, &status);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "fits file %s created\n", filename);
+	long	naxes[2] = { image.width(), image.height() };
+	fits_create_img(fits, bitpix, 2, naxes, &status);
+	long	fpixel[2] = { 1, 1 };
+	fits_write_pix(fits, datatype, fpixel, image.npixels(),
+		image.pixelbuffer(), &status);
+	fits_close_file(fits, &status);
+}
+
+/**
+ * \brief Write a planar color image to a FITS file with three planes
+ */
+static void	savecolorimage(const ColorImage& image, const char *filename) {
+	unlink(filename);
+	fitsfile	*fits = NULL;
+	int	status = 0;
+	fits_create_file(&fits, filename, &status);
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "fits file %s created\n", filename);
+	long	naxes[3] = { image.width(), image.height(), 3 };
+	fits_create_img(fits, SHORT_IMG, 3, naxes, &status);
+	long	fpixel[3] = { 1, 1, 1 };
+	fits_write_pix(fits, TUSHORT, fpixel, 3 * image.npixels(),
+		image.pixelbuffer(), &status);
+	fits_close_file(fits, &status);
+}
+
+/**
+ * \brief Read a master frame for calibration from a FITS file
+ */
+static FloatImagePtr	readmaster(const char *filename) {
+	fitsfile	*fits = NULL;
+	int	status = 0;
+	long	naxes[2] = { 0, 0 };
+	fits_open_file(&fits, filename, READONLY, &status);
+	fits_get_img_size(fits, 2, naxes, &status);
+	if (status) {
+		throw std::runtime_error(std::string("cannot open master ")
+			+ filename);
+	}
+	FloatImagePtr	image(new FloatImage(naxes[0], naxes[1]));
+	long	fpixel[2] = { 1, 1 };
+	fits_read_pix(fits, TFLOAT, fpixel, image->npixels(), NULL,
+		image->pixelbuffer(), NULL, &status);
+	fits_close_file(fits, &status);
+	if (status) {
+		throw std::runtime_error(std::string("cannot read master ")
+			+ filename);
+	}
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "master %s: %d x %d", filename,
+		image->width(), image->height());
+	return image;
+}
+
+/**
+ * \brief Take the dark of an image from the dark library, if there is one
+ */
+static void	librarydark(Calibration& calibration, DarkLibrary *library,
+		const Camera& camera, double temperature,
+		const ImageBuffer& image) {
+	if (NULL == library) {
+		return;
+	}
+	calibration.dark(library->dark(camera.mode(),
+		ImageSize(image.width(), image.height()),
+		camera.exposuretime(), temperature));
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "dark library: %lu hits, %lu misses",
+		library->hits(), library->misses());
+}
+
 /**
  * \brief Main function for the qhyccd program
  */
@@ -70,11 +230,39 @@ int	qhycamera_main(int argc, char *argv[]) {
 	BinningMode	binningmode(binning, binning);
 	double	exposuretime = 1;
 	enum Camera::DownloadSpeed	speed = Camera::Low;
-	while (EOF != (c = getopt(argc, argv, "de:b:p:h?f")))
+	unsigned int	queuedepth = 0;
+	bool	pipelined = false;
+	unsigned int	demuxthreads = 0;
+	enum Camera::FrameMemory	framememory = Camera::HeapMemory;
+	bool	lockmemory = false;
+	bool	overscan = false;
+	bool	wide = false;
+	bool	statistics = false;
+	const char	*biasfile = NULL;
+	const char	*darkfile = NULL;
+	const char	*flatfile = NULL;
+	const char	*librarydir = NULL;
+	enum DarkLibrary::Method	darkmethod = DarkLibrary::Scaled;
+	bool	addmaster = false;
+	bool	floatoutput = false;
+	bool	color = false;
+	bool	softbin = false;
+	BinningMode	softmode(1, 1);
+	enum SoftwareBinning::Combine	combine = SoftwareBinning::Sum;
+	enum Debayer::Method	debayermethod = Debayer::Bilinear;
+	const char	*tracefile = NULL;
+	const char	*recordfile = NULL;
+	const char	*location = NULL;
+	const char	*logfile = NULL;
+	const char	*jsonfile = NULL;
+	while (EOF != (c = getopt(argc, argv, "de:b:g:p:h?fq:sn:m:iwx:ac:B:D:F:L:M:Akor:t:lu:j:")))
 		switch (c) {
 		case 'd':
 			qhydebuglevel = LOG_DEBUG;
 			break;
+		case 'g':
+			logfile = optarg;
+			break;
 		case 'e':
 			exposuretime = atof(optarg);
 			break;
@@ -88,6 +276,102 @@ int	qhycamera_main(int argc, char *argv[]) {
 		case 'f':
 			speed = Camera::High;
 			break;
+		case 'q':
+			queuedepth = atoi(optarg);
+			break;
+		case 's':
+			pipelined = true;
+			break;
+		case 'n':
+			demuxthreads = atoi(optarg);
+			break;
+		case 'm':
+			if (0 == strcmp(optarg, "huge")) {
+				framememory = Camera::HugePageMemory;
+			} else if (0 == strcmp(optarg, "lock")) {
+				framememory = Camera::HugePageMemory;
+				lockmemory = true;
+			} else if (0 == strcmp(optarg, "dma")) {
+				framememory = Camera::DMAMemory;
+			} else {
+				framememory = Camera::HeapMemory;
+			}
+			break;
+		case 'i':
+			statistics = true;
+			break;
+		case 'w':
+			wide = true;
+			break;
+		case 'x':
+			softbin = true;
+			if (2 != sscanf(optarg, "%dx%d", &softmode.x(),
+				&softmode.y())) {
+				throw std::runtime_error("bad software binning");
+			}
+			break;
+		case 'a':
+			combine = SoftwareBinning::Average;
+			break;
+		case 'c':
+			color = true;
+			if (0 == strcmp(optarg, "super")) {
+				debayermethod = Debayer::Superpixel;
+			} else if (0 == strcmp(optarg, "edge")) {
+				debayermethod = Debayer::EdgeAware;
+			} else {
+				debayermethod = Debayer::Bilinear;
+			}
+			break;
+		case 'B':
+			biasfile = optarg;
+			break;
+		case 'D':
+			darkfile = optarg;
+			break;
+		case 'F':
+			flatfile = optarg;
+			break;
+		case 'L':
+			librarydir = optarg;
+			break;
+		case 'M':
+			if (0 == strcmp(optarg, "nearest")) {
+				darkmethod = DarkLibrary::Nearest;
+			} else if (0 == strcmp(optarg, "interpolate")) {
+				darkmethod = DarkLibrary::Interpolated;
+			} else {
+				darkmethod = DarkLibrary::Scaled;
+			}
+			break;
+		case 'A':
+			addmaster = true;
+			break;
+		case 'k':
+			floatoutput = true;
+			break;
+		case 'o':
+			overscan = true;
+			break;
+		case 'r':
+			tracefile = optarg;
+			break;
+		case 't':
+			recordfile = optarg;
+			break;
+		case 'j':
+			jsonfile = optarg;
+			break;
+		case 'l': {
+			std::vector<DeviceInfo>	devices = listDevices();
+			for (unsigned int i = 0; i < devices.size(); i++) {
+				std::cout << devices[i].toString() << std::endl;
+			}
+			}
+			return EXIT_SUCCESS;
+		case 'u':
+			location = optarg;
+			break;
 		case 'h':
 		case '?':
 			usage(argv[0]);
@@ -99,16 +383,78 @@ int	qhycamera_main(int argc, char *argv[]) {
 		throw std::runtime_error("file name argument missing");
 	}
 	char	*filename = argv[optind];
+	if (wide && color) {
+		throw std::runtime_error("cannot debayer 32 bit images");
+	}
+
+	// read the master frames before the exposure
+	std::shared_ptr<DarkLibrary>	library;
+	if (librarydir) {
+		library = std::shared_ptr<DarkLibrary>(
+				new DarkLibrary(librarydir));
+		library->method(darkmethod);
+	}
+	if (addmaster && ((!library) || biasfile || darkfile || flatfile
+		|| wide || color || softbin || floatoutput)) {
+		throw std::runtime_error("only uncalibrated 16 bit images can "
+			"be added to the dark library");
+	}
+	if (darkfile && library) {
+		throw std::runtime_error("dark file and dark library are "
+			"exclusive");
+	}
+	DarkLibrary	*darks = (addmaster) ? NULL : library.get();
+	Calibration	calibration;
+	bool	calibrate = (biasfile || darkfile || flatfile || darks);
+	if (biasfile) {
+		calibration.bias(readmaster(biasfile));
+	}
+	if (darkfile) {
+		calibration.dark(readmaster(darkfile));
+	}
+	if (flatfile) {
+		calibration.flat(readmaster(flatfile));
+	}
+	if (calibrate && wide && !softbin) {
+		throw std::runtime_error("cannot calibrate 32 bit images");
+	}
+	if (floatoutput && ((!calibrate) || wide || color || softbin)) {
+		throw std::runtime_error("floating point pixels only for "
+			"calibrated images");
+	}
+
+	// debug messages are written by a background thread, so that they
+	// do not disturb the timing of the image download
+	if (qhydebuglevel == LOG_DEBUG) {
+		if (qhydebugstart(logfile) < 0) {
+			throw std::runtime_error("cannot open log file");
+		}
+	}
 
 	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "qhycamera started");
+	if (jsonfile) {
+		tracestart(jsonfile);
+	}
 
 	// open a device, just for testing purposes
-	device = getDevice(0x1618, idProduct);
+	if (tracefile) {
+		device = getReplayDevice(tracefile);
+	} else if (recordfile) {
+		device = getRecordingDevice(0x1618, idProduct, recordfile);
+	} else if (location) {
+		DeviceInfo	info;
+		info.idVendor = 0x1618;
+		info.idProduct = idProduct;
+		info.location(location);
+		device = getDevice(info);
+	} else {
+		device = getDevice(0x1618, idProduct);
+	}
 
 	// turn of the cooler
 	device->dc201().pwm(0);
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "temperature: %f",
-		device->dc201().temperature());
+	double	temperature = device->dc201().temperature();
+	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "temperature: %f", temperature);
 
 	double	starttime = gettime();
 
@@ -117,32 +463,87 @@ int	qhycamera_main(int argc, char *argv[]) {
 	camera.mode(binningmode);
 	camera.exposuretime(exposuretime);
 	camera.downloadSpeed(speed);
+	if (queuedepth > 0) {
+		camera.queuedepth(queuedepth);
+	}
+	camera.pipelined(pipelined);
+	camera.framememory(framememory);
+	camera.lockmemory(lockmemory);
+	camera.statistics(statistics);
+	if (demuxthreads > 0) {
+		camera.demuxthreads(demuxthreads);
+	}
 	camera.startExposure();
-	ImageBufferPtr	image = camera.getImage();
-
-	double	endtime = gettime();
-
-	ImageSize	size = image->image_size();
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0,
-		"image size: %d x %d, (%f seconds)",
-		size.width(), size.height(), endtime - starttime);
-
-	ImageBufferPtr	result = image->active_buffer();
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "active size: %d x %d",
-		result->width(), result->height());
+	SoftwareBinning	softbinning(softmode, combine, color);
+	if (demuxthreads > 0) {
+		softbinning.threads(demuxthreads);
+		calibration.threads(demuxthreads);
+	}
+	if (color) {
+		std::string	pattern = (overscan) ? camera.bayer()
+						: camera.activebayer();
+		if (pattern.empty()) {
+			throw std::runtime_error("camera mode has no color pattern");
+		}
+		ImageBufferPtr	image = (overscan) ? camera.getImage()
+						: camera.getActiveImage();
+		if (calibrate) {
+			librarydark(calibration, darks, camera, temperature,
+				*image);
+			calibration(*image);
+		}
+		if (softbin) {
+			image = softbinning.binned(ImageView(image));
+		}
+		qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "debayering %s image",
+			pattern.c_str());
+		Debayer	debayer(pattern, debayermethod);
+		if (demuxthreads > 0) {
+			debayer.threads(demuxthreads);
+		}
+		savecolorimage(*debayer(ImageView(image)), filename);
+	} else if (wide && softbin) {
+		ImageBufferPtr	image = (overscan) ? camera.getImage()
+						: camera.getActiveImage();
+		if (calibrate) {
+			librarydark(calibration, darks, camera, temperature,
+				*image);
+			calibration(*image);
+		}
+		saveimage(camera, *softbinning.binned32(ImageView(image)),
+			starttime, filename, LONG_IMG, TUINT);
+	} else if (wide) {
+		ImageBuffer32Ptr	image = (overscan) ? camera.getImage32()
+						: camera.getActiveImage32();
+		saveimage(camera, *image, starttime, filename, LONG_IMG, TUINT);
+	} else if (floatoutput) {
+		ImageBufferPtr	image = (overscan) ? camera.getImage()
+						: camera.getActiveImage();
+		librarydark(calibration, darks, camera, temperature, *image);
+		saveimage(camera, *calibration.calibratedfloat(*image),
+			starttime, filename, FLOAT_IMG, TFLOAT);
+	} else {
+		ImageBufferPtr	image = (overscan) ? camera.getImage()
+						: camera.getActiveImage();
+		if (calibrate) {
+			librarydark(calibration, darks, camera, temperature,
+				*image);
+			calibration(*image);
+		}
+		if (softbin) {
+			image = softbinning.binned(ImageView(image));
+		}
+		if (addmaster) {
+			library->add(camera.mode(), camera.exposuretime(),
+				temperature, *image);
+		}
+		saveimage(camera, *image, starttime, filename, SHORT_IMG,
+			TUSHORT);
+	}
 
-	// write the image data to 
-	unlink(filename);
-	fitsfile	*fits = NULL;
-	int	status = 0;
-	fits_create_file(&fits, filename, &status);
-	qhydebug(LOG_DEBUG, DEBUG_LOG, 0, "fits file %s created\n", filename);
-	long	naxes[2] = { result->width(), result->height() };
-	fits_create_img(fits, SHORT_IMG, 2, naxes, &status);
-	long	fpixel[2] = { 1, 1 };
-	fits_write_pix(fits, TUSHORT, fpixel, image->npixels(),
-		result->pixelbuffer(), &status);
-	fits_close_file(fits, &status);
+	if (jsonfile) {
+		tracestop();
+	}
 
 	return EXIT_SUCCESS;
 }
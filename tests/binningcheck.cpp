@@ -0,0 +1,84 @@
+/*
+ * binningcheck.cpp -- compare software binning with direct sums
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <check.h>
+
+using namespace qhy;
+
+/**
+ * \brief Bin a pixel of the view directly
+ *
+ * With bayer aware binning, the pixels of a bin are two pixels apart,
+ * and bins of the same color are interleaved in pairs.
+ */
+static unsigned long	binpixel(const ImageView& view, const BinningMode& mode,
+				bool bayer, bool average, unsigned int x,
+				unsigned int y) {
+	unsigned int	step = (bayer) ? 2 : 1;
+	unsigned int	fx = (x / step) * step * mode.x() + (x % step);
+	unsigned int	fy = (y / step) * step * mode.y() + (y % step);
+	unsigned long	sum = 0;
+	for (int j = 0; j < mode.y(); j++) {
+		for (int i = 0; i < mode.x(); i++) {
+			sum += view(fx + i * step, fy + j * step);
+		}
+	}
+	if (average) {
+		unsigned int	n = mode.x() * mode.y();
+		sum = (sum + n / 2) / n;
+	}
+	return sum;
+}
+
+/**
+ * \brief Check all bin sizes at all kernel levels
+ *
+ * The views are cropped and every other one is flipped, so that the
+ * rows are neither contiguous nor aligned.
+ */
+static void	checkbinning(Check& check, int best) {
+	ImageBufferPtr	image(new ImageBuffer(37, 29));
+	for (int bx = 1; bx <= 5; bx++)
+	for (int by = 1; by <= 4; by++)
+	for (int bayer = 0; bayer < 2; bayer++)
+	for (int average = 0; average < 2; average++) {
+		BinningMode	mode(bx, by);
+		randomfill(*image, (bx + by) & 1);
+		for (int level = DEMUX_SCALAR; level <= best; level++)
+		for (unsigned int t = 1; t <= 3; t += 2) {
+			demux_level(level);
+			SoftwareBinning	binning(mode, (average)
+				? SoftwareBinning::Average : SoftwareBinning::Sum,
+				bayer);
+			binning.threads(t);
+			ImageView	view(image, ImageRectangle(ImagePoint(1, 2),
+						ImageSize(33, 25)), level & 1);
+			ImageBuffer32Ptr	wide = binning.binned32(view);
+			ImageBufferPtr	narrow = binning.binned(view);
+			bool	ok = true;
+			for (unsigned int y = 0; y < wide->height(); y++) {
+				for (unsigned int x = 0; x < wide->width(); x++) {
+					unsigned long	s = binpixel(view, mode,
+								bayer, average,
+								x, y);
+					unsigned long	s16 = (s > 65535) ? 65535 : s;
+					ok = ok && (wide->p(x, y) == s)
+						&& (narrow->p(x, y) == s16);
+				}
+			}
+			check(ok, "%dx%d bayer %d average %d level %d "
+				"threads %u", bx, by, bayer, average, level, t);
+		}
+	}
+}
+
+int	main(int argc, char *argv[]) {
+	Check	check("binningcheck");
+	checkbinning(check, bestlevel());
+	return check.result();
+}
@@ -0,0 +1,140 @@
+/*
+ * bufferpoolcheck.cpp -- check the recycling of raw and image buffers
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <check.h>
+#include <bufferpool.h>
+
+using namespace qhy;
+
+/**
+ * \brief Compare the pool statistics with the expected counters
+ */
+static void	counters(Check& check, const BufferPoolPtr& pool,
+			const char *step, unsigned long hits,
+			unsigned long misses, unsigned long evicted,
+			unsigned long outstanding, unsigned long available) {
+	BufferPoolStatistics	s = pool->statistics();
+	check((s.hits == hits) && (s.misses == misses)
+		&& (s.evicted == evicted) && (s.outstanding == outstanding)
+		&& (s.available == available),
+		"%s: %s", step, s.toString().c_str());
+}
+
+/**
+ * \brief Request and release raw buffers
+ *
+ * Buffers are only reused for the same length, the oldest unused
+ * buffer is evicted when a buffer is returned to a full pool.
+ */
+static void	checkraw(Check& check) {
+	BufferPoolPtr	pool(new BufferPool(2));
+	Buffer	*a = pool->rawbuffer(1000, NULL);
+	Buffer	*b = pool->rawbuffer(1000, NULL);
+	Buffer	*c = pool->rawbuffer(2000, NULL);
+	counters(check, pool, "raw requests", 0, 3, 0, 3, 0);
+	pool->release(a);
+	pool->release(b);
+	pool->release(c);
+	counters(check, pool, "raw release", 0, 3, 1, 0, 2);
+	check(pool->statistics().bytes == 3000, "%lu bytes instead of 3000",
+		pool->statistics().bytes);
+
+	Buffer	*d = pool->rawbuffer(1000, NULL);
+	check(d == b, "the unused buffer of 1000 bytes was not reused");
+	Buffer	*e = pool->rawbuffer(1000, NULL);
+	counters(check, pool, "raw reuse", 1, 4, 1, 2, 1);
+	pool->release(d);
+	pool->release(e);
+	pool->flushraw();
+	counters(check, pool, "raw flush", 1, 4, 4, 0, 0);
+	check(pool->statistics().bytes == 0, "%lu bytes after the flush",
+		pool->statistics().bytes);
+
+	{
+		PooledBuffer	pooled(pool, 500);
+		counters(check, pool, "pooled buffer", 1, 5, 4, 1, 0);
+	}
+	counters(check, pool, "pooled buffer gone", 1, 5, 4, 0, 1);
+}
+
+/**
+ * \brief Request and recycle image buffers
+ *
+ * A recycled buffer must look like a new one, without the active area,
+ * the metrics and the statistics of its previous frame.
+ */
+static void	checkimages(Check& check) {
+	BufferPoolPtr	pool(new BufferPool(1));
+	ImageBuffer	*first = NULL;
+	{
+		ImageBufferPtr	image = pool->imagebuffer(ImageSize(40, 30));
+		ImageBufferPtr	other = pool->imagebuffer(ImageSize(40, 30));
+		counters(check, pool, "image requests", 0, 2, 0, 2, 0);
+		first = image.get();
+		image->active(ImageRectangle(ImagePoint(2, 3),
+			ImageSize(30, 20)));
+		FrameMetrics	metrics;
+		metrics.bytes = 2400;
+		metrics.patches = 7;
+		image->metrics(metrics);
+		image->statistics(FrameStatisticsPtr(new FrameStatistics()));
+		other.reset();
+		counters(check, pool, "one image recycled", 0, 2, 0, 1, 1);
+	}
+	counters(check, pool, "both images recycled", 0, 2, 1, 0, 1);
+
+	ImageBufferPtr	recycled = pool->imagebuffer(ImageSize(40, 30));
+	counters(check, pool, "image reuse", 1, 2, 1, 1, 0);
+	check(recycled.get() == first, "the last recycled image not reused");
+	check(recycled->active().empty()
+		&& (recycled->image_size() == ImageSize(40, 30)),
+		"recycled image keeps its active area");
+	check((0 == recycled->metrics().bytes)
+		&& (0 == recycled->metrics().patches),
+		"recycled image keeps its metrics");
+	check(!recycled->statistics(), "recycled image keeps its statistics");
+
+	ImageBufferPtr	other = pool->imagebuffer(ImageSize(30, 40));
+	check((other->width() == 30) && (other->height() == 40),
+		"image of %ux%u instead of 30x40", other->width(),
+		other->height());
+	counters(check, pool, "different size", 1, 3, 1, 2, 0);
+}
+
+/**
+ * \brief Images keep their pool alive
+ *
+ * The camera holds the only pointer to its pool, the deleter of the
+ * images it returned must still find the pool after the camera is gone.
+ */
+static void	checklifetime(Check& check) {
+	BufferPoolPtr	pool(new BufferPool(2));
+	std::weak_ptr<BufferPool>	weak(pool);
+	ImageBufferPtr	image = pool->imagebuffer(ImageSize(16, 8));
+	ImageBufferPtr	copy = image;
+	pool.reset();
+	check(!weak.expired(), "the pool died with its camera");
+	image.reset();
+	check(!weak.expired(), "the pool died with one of two pointers");
+	copy->p(3, 4) = 17;
+	check(copy->p(3, 4) == 17, "the image is no longer usable");
+	copy.reset();
+	check(weak.expired(), "the pool survived its last image");
+}
+
+int	main(int argc, char *argv[]) {
+	Check	check("bufferpoolcheck");
+	try {
+		checkraw(check);
+		checkimages(check);
+		checklifetime(check);
+	} catch (const std::exception& x) {
+		check(false, "exception: %s", x.what());
+	}
+	return check.result();
+}
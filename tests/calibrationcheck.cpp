@@ -0,0 +1,85 @@
+/*
+ * calibrationcheck.cpp -- compare the calibration kernels with the formula
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <check.h>
+#include <cmath>
+
+using namespace qhy;
+
+/**
+ * \brief A master frame with random pixels from base to base + range
+ */
+static FloatImagePtr	master(unsigned int w, unsigned int h, float base,
+				unsigned int range) {
+	FloatImagePtr	image(new FloatImage(w, h));
+	for (unsigned int i = 0; i < image->npixels(); i++) {
+		image->pixelbuffer()[i] = base + rand() % range;
+	}
+	return image;
+}
+
+/**
+ * \brief Check every combination of masters at all kernel levels
+ *
+ * The masters present are selected by the bits of combination: bias,
+ * dark and flat. The widths are not multiples of the vector sizes, so
+ * the scalar tails of the kernels are covered too.
+ */
+static void	checkcalibration(Check& check, int best) {
+	for (unsigned int w = 1; w < 50; w += 7)
+	for (unsigned int h = 1; h < 6; h++)
+	for (int combination = 1; combination < 8; combination++) {
+		ImageBuffer	image(w, h);
+		randomfill(image);
+		FloatImagePtr	bias, dark, flat;
+		if (combination & 1) {
+			bias = master(w, h, 0.37f, 1000);
+		}
+		if (combination & 2) {
+			dark = master(w, h, -10.5f, 3000);
+		}
+		if (combination & 4) {
+			flat = master(w, h, 20000.f, 30000);
+		}
+		for (int level = DEMUX_SCALAR; level <= best; level++)
+		for (unsigned int t = 1; t <= 3; t += 2) {
+			demux_level(level);
+			Calibration	calibration;
+			calibration.threads(t);
+			calibration.bias(bias);
+			calibration.dark(dark);
+			calibration.flat(flat);
+			ImageBufferPtr	narrow = calibration.calibrated(image);
+			FloatImagePtr	wide = calibration.calibratedfloat(image);
+			FloatImagePtr	offset = (dark) ? dark : bias;
+			FloatImagePtr	gain = calibration.invflat();
+			bool	ok = true;
+			for (unsigned int i = 0; i < image.npixels(); i++) {
+				float	v = image.pixelbuffer()[i];
+				if (offset) {
+					v = v - offset->pixelbuffer()[i];
+				}
+				if (gain) {
+					v = v * gain->pixelbuffer()[i];
+				}
+				float	c = (v < 0.f) ? 0.f
+					: ((v > 65535.f) ? 65535.f : v);
+				ok = ok && (wide->pixelbuffer()[i] == v)
+					&& (narrow->pixelbuffer()[i] == lrintf(c));
+			}
+			check(ok, "%ux%u masters %d level %d threads %u",
+				w, h, combination, level, t);
+		}
+	}
+}
+
+int	main(int argc, char *argv[]) {
+	Check	check("calibrationcheck");
+	checkcalibration(check, bestlevel());
+	return check.result();
+}
@@ -0,0 +1,85 @@
+/*
+ * check.h -- common helpers of the check programs
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifndef qhy_check_h
+#define qhy_check_h
+
+#include <qhylib.h>
+#include <demux.h>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+
+namespace qhy {
+
+/**
+ * \brief Count and report the mismatches found by a check program
+ *
+ * Only the first few mismatches are reported, the count decides the
+ * exit code of the program.
+ */
+class Check {
+	const char	*_name;
+	unsigned int	_failures;
+	unsigned int	_checks;
+public:
+	Check(const char *name) : _name(name), _failures(0), _checks(0) {
+		srand(4711);
+	}
+	/**
+	 * \brief Record the outcome of a comparison
+	 */
+	bool	operator()(bool ok, const char *format, ...)
+		__attribute__((format(printf, 3, 4))) {
+		_checks++;
+		if (ok) {
+			return true;
+		}
+		if (_failures++ < 20) {
+			va_list	ap;
+			va_start(ap, format);
+			fprintf(stderr, "%s: ", _name);
+			vfprintf(stderr, format, ap);
+			fprintf(stderr, "\n");
+			va_end(ap);
+		}
+		return false;
+	}
+	/**
+	 * \brief Summarize the checks, the result is the exit code
+	 */
+	int	result() const {
+		printf("%s: %u checks, %u failed\n", _name, _checks, _failures);
+		return (_failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+};
+
+/**
+ * \brief The best kernel level of this processor
+ *
+ * The checks run at every level from DEMUX_SCALAR up to this one.
+ */
+inline int	bestlevel() {
+	demux_level(DEMUX_AVX2);
+	return demux_level();
+}
+
+/**
+ * \brief Fill an image with random pixels
+ *
+ * Bright images have most pixels close to saturation, to exercise the
+ * clamping of the kernels.
+ */
+template<typename Pixel>
+void	randomfill(Image<Pixel>& image, bool bright = false) {
+	Pixel	*p = image.pixelbuffer();
+	for (unsigned int i = 0; i < image.npixels(); i++) {
+		p[i] = (bright) ? (65535 - (rand() & 0xff)) : (rand() & 0xffff);
+	}
+}
+
+} // namespace qhy
+
+#endif /* qhy_check_h */
@@ -0,0 +1,261 @@
+/*
+ * darklibrarycheck.cpp -- check the darks derived by the dark library
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <check.h>
+#include <cmath>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace qhy;
+
+static const ImageSize	size(13, 7);
+static const BinningMode	unbinned(1, 1);
+
+/**
+ * \brief The masters written to the library
+ */
+class masters {
+public:
+	FloatImagePtr	bias;		// 0s at -10C
+	FloatImagePtr	short10;	// 10s at -10C
+	FloatImagePtr	long30;		// 30s at -10C
+	FloatImagePtr	warm10;		// 10s at 0C
+	FloatImagePtr	binned;		// 2x2, 5s at -10C, the only one
+	masters();
+};
+
+/**
+ * \brief A master with a bias level plus random dark current
+ */
+static FloatImagePtr	master(const ImageSize& s, float base,
+				unsigned int current) {
+	FloatImagePtr	image(new FloatImage(s));
+	for (unsigned int i = 0; i < image->npixels(); i++) {
+		image->pixelbuffer()[i] = base + (rand() % (current + 1))
+			+ 0.25f * (rand() % 4);
+	}
+	return image;
+}
+
+masters::masters() {
+	bias = master(size, 100, 10);
+	short10 = master(size, 100, 500);
+	long30 = master(size, 100, 1500);
+	warm10 = master(size, 100, 2000);
+	binned = master(ImageSize(6, 3), 400, 300);
+}
+
+/**
+ * \brief Compare two darks pixel by pixel
+ */
+static bool	same(const FloatImagePtr& a, const FloatImagePtr& b) {
+	return a && b && (a->width() == b->width())
+		&& (a->height() == b->height())
+		&& (0 == memcmp(a->pixelbuffer(), b->pixelbuffer(), a->size()));
+}
+
+/**
+ * \brief Interpolation between two masters, as the library computes it
+ */
+static FloatImagePtr	interpolate(const FloatImagePtr& lower, double le,
+				const FloatImagePtr& upper, double ue,
+				double exposure) {
+	FloatImagePtr	result(new FloatImage(size));
+	float	w = (exposure - le) / (ue - le);
+	for (unsigned int i = 0; i < result->npixels(); i++) {
+		float	l = lower->pixelbuffer()[i];
+		result->pixelbuffer()[i] = l
+			+ (upper->pixelbuffer()[i] - l) * w;
+	}
+	return result;
+}
+
+/**
+ * \brief Dark current of a master scaled to an exposure, plus the bias
+ */
+static FloatImagePtr	scale(const FloatImagePtr& bias,
+				const FloatImagePtr& dark, double de, double dt,
+				double exposure, double temperature,
+				double doubling) {
+	FloatImagePtr	result(new FloatImage(size));
+	float	factor = (exposure / de)
+			* pow(2., (temperature - dt) / doubling);
+	for (unsigned int i = 0; i < result->npixels(); i++) {
+		float	b = bias->pixelbuffer()[i];
+		result->pixelbuffer()[i] = b + (dark->pixelbuffer()[i] - b)
+			* factor;
+	}
+	return result;
+}
+
+/**
+ * \brief Write the masters and a file that is not a valid master
+ */
+static void	checkadd(Check& check, const std::string& directory,
+			const masters& m) {
+	DarkLibrary	library(directory);
+	library.add(unbinned, 0, -10, *m.bias);
+	library.add(unbinned, 10, -10, *m.short10);
+	library.add(unbinned, 30, -10, *m.long30);
+	library.add(unbinned, 10, 0, *m.warm10);
+	library.add(BinningMode(2, 2), 5, -10, *m.binned);
+	check(library.masters().size() == 5, "%lu masters after add",
+		library.masters().size());
+	std::string	bad = directory + "/bad.dark";
+	int	fd = open(bad.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	check((fd >= 0) && (write(fd, "QHYDARK1", 8) == 8),
+		"cannot write %s", bad.c_str());
+	close(fd);
+}
+
+/**
+ * \brief Reopen the library and check the headers read by the scan
+ */
+static void	checkscan(Check& check, DarkLibrary& library) {
+	std::vector<DarkMaster>	found = library.masters();
+	check(found.size() == 5, "%lu masters found by the scan",
+		found.size());
+	unsigned int	valid = 0;
+	for (unsigned int i = 0; i < found.size(); i++) {
+		const DarkMaster&	d = found[i];
+		if (d.mode == unbinned) {
+			valid += (d.size == size) && (d.temperature == -10
+				|| ((d.temperature == 0) && (d.exposure == 10)));
+		} else {
+			valid += (d.mode == BinningMode(2, 2))
+				&& (d.size == ImageSize(6, 3))
+				&& (d.exposure == 5) && (d.temperature == -10);
+		}
+	}
+	check(valid == found.size(), "only %u of the masters read back",
+		valid);
+}
+
+/**
+ * \brief Check the darks of the three methods against the formulas
+ *
+ * Temperatures are rounded to the resolution of 0.5 degrees first.
+ */
+static void	checkmethods(Check& check, DarkLibrary& library,
+			const masters& m) {
+	library.method(DarkLibrary::Nearest);
+	check(same(library.dark(unbinned, size, 12, -10.2), m.short10),
+		"nearest of 12s at -10C is not the 10s master");
+	check(same(library.dark(unbinned, size, 12, 0.3), m.warm10),
+		"nearest of 12s at 0.5C is not the warm master");
+	check(same(library.dark(unbinned, size, 25, -10), m.long30),
+		"nearest of 25s is not the 30s master");
+
+	library.method(DarkLibrary::Interpolated);
+	check(same(library.dark(unbinned, size, 20, -10),
+		interpolate(m.short10, 10, m.long30, 30, 20)),
+		"interpolated dark of 20s");
+	check(same(library.dark(unbinned, size, 14.5, -10),
+		interpolate(m.short10, 10, m.long30, 30, 14.5)),
+		"interpolated dark of 14.5s");
+	check(same(library.dark(unbinned, size, 10, -10), m.short10),
+		"interpolated dark at a master is not the master");
+	check(same(library.dark(unbinned, size, 45, -10),
+		scale(m.bias, m.long30, 30, -10, 45, -10, 6.0)),
+		"interpolated dark beyond the masters is not scaled");
+
+	library.method(DarkLibrary::Scaled);
+	check(same(library.dark(unbinned, size, 20, -7.1),
+		scale(m.bias, m.long30, 30, -10, 20, -7, 6.0)),
+		"scaled dark of 20s at -7C");
+	library.doubling(5.0);
+	check(same(library.dark(unbinned, size, 8, -3),
+		scale(m.bias, m.warm10, 10, 0, 8, -3, 5.0)),
+		"scaled dark of 8s at -3C with doubling 5");
+	check(same(library.dark(unbinned, size, 0, -10), m.bias),
+		"scaled dark of a bias is not the bias");
+	check(same(library.dark(BinningMode(2, 2), ImageSize(6, 3), 60, 5),
+		m.binned), "scaled dark without bias is not the master");
+
+	bool	thrown = false;
+	try {
+		library.dark(BinningMode(3, 3), size, 10, -10);
+	} catch (const std::runtime_error&) {
+		thrown = true;
+	}
+	check(thrown, "no exception for a mode without masters");
+}
+
+/**
+ * \brief Check the counters, the capacity and the flushes of the cache
+ */
+static void	checkcache(Check& check, DarkLibrary& library,
+			const masters& m) {
+	library.method(DarkLibrary::Nearest);
+	library.capacity(2);
+	unsigned long	hits = library.hits();
+	unsigned long	misses = library.misses();
+	FloatImagePtr	a = library.dark(unbinned, size, 10, -10);
+	FloatImagePtr	again = library.dark(unbinned, size, 10, -9.9);
+	check(a == again, "the cache does not share darks");
+	library.dark(unbinned, size, 30, -10);
+	library.dark(unbinned, size, 0, -10);	// evicts the 10s dark
+	library.dark(unbinned, size, 0, -10);
+	FloatImagePtr	evicted = library.dark(unbinned, size, 10, -10);
+	check(evicted != a, "the least recently used dark was not evicted");
+	check(same(evicted, a), "the dark changed after eviction");
+	check((library.hits() - hits == 2)
+		&& (library.misses() - misses == 4),
+		"%lu hits and %lu misses instead of 2 and 4",
+		library.hits() - hits, library.misses() - misses);
+
+	// adding a master flushes the cache, the dark is derived again
+	FloatImagePtr	replacement = master(size, 100, 700);
+	library.add(unbinned, 10, -10, *replacement);
+	misses = library.misses();
+	check(same(library.dark(unbinned, size, 10, -10), replacement),
+		"the replaced master is still in use");
+	check(library.misses() == misses + 1, "no miss after add()");
+	library.add(unbinned, 10, -10, *m.short10);
+}
+
+/**
+ * \brief Remove the library directory
+ */
+static void	cleanup(const std::string& directory) {
+	DIR	*dir = opendir(directory.c_str());
+	if (NULL == dir) {
+		return;
+	}
+	struct dirent	*entry;
+	while (NULL != (entry = readdir(dir))) {
+		if (entry->d_name[0] != '.') {
+			unlink((directory + "/" + entry->d_name).c_str());
+		}
+	}
+	closedir(dir);
+	rmdir(directory.c_str());
+}
+
+int	main(int argc, char *argv[]) {
+	Check	check("darklibrarycheck");
+	char	directory[] = "/tmp/darklibrarycheck.XXXXXX";
+	if (NULL == mkdtemp(directory)) {
+		perror("cannot create library directory");
+		return EXIT_FAILURE;
+	}
+	masters	m;
+	try {
+		checkadd(check, directory, m);
+		DarkLibrary	library(directory);
+		checkscan(check, library);
+		checkmethods(check, library, m);
+		checkcache(check, library, m);
+	} catch (const std::exception& x) {
+		check(false, "exception: %s", x.what());
+	}
+	cleanup(directory);
+	return check.result();
+}
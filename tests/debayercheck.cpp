@@ -0,0 +1,148 @@
+/*
+ * debayercheck.cpp -- compare the debayer kernels with the scalar code
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <check.h>
+
+using namespace qhy;
+
+static const char	*patterns[4] = { "RGGB", "GBRG", "GRBG", "BGGR" };
+static const char	*methods[3] = { "superpixel", "bilinear", "edgeaware" };
+
+/**
+ * \brief Compare two color images pixel by pixel
+ */
+static bool	same(const ColorImage& a, const ColorImage& b) {
+	if ((a.width() != b.width()) || (a.height() != b.height())) {
+		return false;
+	}
+	for (unsigned int y = 0; y < a.height(); y++) {
+		for (unsigned int x = 0; x < a.width(); x++) {
+			for (int c = ColorImage::Red; c <= ColorImage::Blue; c++) {
+				ColorImage::Color	color = (ColorImage::Color)c;
+				if (a.p(x, y, color) != b.p(x, y, color)) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * \brief Superpixel debayering computed directly from the mosaic
+ */
+static bool	superpixel(const ImageView& view, const std::string& pattern,
+			const ColorImage& result) {
+	for (unsigned int y = 0; y < result.height(); y++) {
+		for (unsigned int x = 0; x < result.width(); x++) {
+			unsigned int	red = 0, blue = 0, green = 0;
+			for (unsigned int i = 0; i < 4; i++) {
+				unsigned int	v = view(2 * x + (i & 1),
+							2 * y + (i >> 1));
+				switch (pattern[i]) {
+				case 'R':	red = v; break;
+				case 'B':	blue = v; break;
+				default:	green += v; break;
+				}
+			}
+			green = (green + 1) >> 1;
+			if ((result.p(x, y, ColorImage::Red) != red)
+				|| (result.p(x, y, ColorImage::Green) != green)
+				|| (result.p(x, y, ColorImage::Blue) != blue)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * \brief Check that a uniformly colored mosaic stays uniform
+ */
+static void	checkuniform(Check& check, int best) {
+	ImageBufferPtr	image(new ImageBuffer(16, 16));
+	for (unsigned int y = 0; y < 16; y++) {
+		for (unsigned int x = 0; x < 16; x++) {
+			unsigned int	i = (x & 1) + 2 * (y & 1);
+			image->p(x, y) = (0 == i) ? 100 : ((3 == i) ? 300 : 200);
+		}
+	}
+	for (int level = DEMUX_SCALAR; level <= best; level++) {
+		demux_level(level);
+		for (int m = Debayer::Superpixel; m <= Debayer::EdgeAware; m++) {
+			Debayer	debayer("RGGB", (Debayer::Method)m);
+			ColorImagePtr	result = debayer(ImageView(image));
+			bool	ok = true;
+			for (unsigned int y = 0; y < result->height(); y++) {
+				for (unsigned int x = 0; x < result->width(); x++) {
+					ok = ok
+					&& (result->p(x, y, ColorImage::Red) == 100)
+					&& (result->p(x, y, ColorImage::Green) == 200)
+					&& (result->p(x, y, ColorImage::Blue) == 300);
+				}
+			}
+			check(ok, "uniform %s at level %d", methods[m], level);
+		}
+	}
+}
+
+/**
+ * \brief Check all kernel levels, band counts and layouts
+ *
+ * Views start at even and odd pixels, so the kernels see every pattern
+ * and the borders at every alignment. The scalar code with a single
+ * band is the reference for all other combinations.
+ */
+static void	checkkernels(Check& check, int best) {
+	for (unsigned int w = 4; w < 48; w += 3) {
+		for (unsigned int h = 4; h < 14; h += 3) {
+			ImageBufferPtr	image(new ImageBuffer(w + 3, h + 3));
+			randomfill(*image, (w + h) & 1);
+			ImageView	view(image, ImageRectangle(
+				ImagePoint(w & 1, h & 1), ImageSize(w, h)));
+			for (int p = 0; p < 4; p++)
+			for (int m = Debayer::Superpixel; m <= Debayer::EdgeAware;
+				m++) {
+				demux_level(DEMUX_SCALAR);
+				Debayer	reference(patterns[p], (Debayer::Method)m);
+				ColorImagePtr	expected = reference(view);
+				if (Debayer::Superpixel == m) {
+					std::string	vp = Debayer::viewpattern(
+							patterns[p], view);
+					check(superpixel(view, vp, *expected),
+						"superpixel %ux%u %s", w, h,
+						patterns[p]);
+				}
+				for (int level = DEMUX_SCALAR; level <= best;
+					level++)
+				for (unsigned int t = 1; t <= 3; t++)
+				for (int l = ColorImage::Planar;
+					l <= ColorImage::Interleaved; l++) {
+					demux_level(level);
+					Debayer	debayer(patterns[p],
+						(Debayer::Method)m,
+						(ColorImage::Layout)l);
+					debayer.threads(t);
+					ColorImagePtr	result = debayer(view);
+					check(same(*expected, *result),
+						"%s %ux%u %s level %d threads %u "
+						"layout %d", methods[m], w, h,
+						patterns[p], level, t, l);
+				}
+			}
+		}
+	}
+}
+
+int	main(int argc, char *argv[]) {
+	Check	check("debayercheck");
+	int	best = bestlevel();
+	checkuniform(check, best);
+	checkkernels(check, best);
+	return check.result();
+}
@@ -0,0 +1,163 @@
+/*
+ * demuxcheck.cpp -- compare the demultiplexing kernels with the SDK code
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <check.h>
+#include <qhy8pro.h>
+#include <demuxmode.h>
+#include <demuxreference.h>
+#include <statistics.h>
+#include <cmath>
+#include <cstring>
+
+using namespace qhy;
+
+typedef void	(*referencefunction)(ImageBuffer& image, const Buffer& buffer,
+			int PixShift, int width, int height,
+			unsigned int firstline, unsigned int lastline);
+
+/**
+ * \brief Fill a raw buffer for a trial
+ *
+ * Trial 0 is random, trial 1 has many bytes at 0xff so that the binned
+ * sums saturate, trial 2 saturates everything.
+ */
+static void	rawfill(Buffer& raw, int trial) {
+	unsigned char	*d = raw.data();
+	for (unsigned long i = 0; i < raw.length(); i++) {
+		switch (trial) {
+		case 0:	d[i] = rand(); break;
+		case 1:	d[i] = (rand() & 1) ? 0xff : rand(); break;
+		default: d[i] = 0xff; break;
+		}
+	}
+}
+
+/**
+ * \brief Compare the statistics of the active area with a direct count
+ *
+ * The histogram must contain exactly the pixels up to 65535.
+ */
+template<typename Mode, typename Pixel>
+static void	checkstatistics(Check& check, const Image<Pixel>& image,
+			const PixelStatistics& statistics, int level) {
+	FrameStatisticsPtr	s = statistics.result();
+	unsigned int	saturation = demuxmode_saturation<Mode, Pixel>();
+	unsigned long	count = 0, saturated = 0, histogram = 0;
+	unsigned int	min = 0xffffffff, max = 0;
+	double	sum = 0;
+	for (unsigned int y = Mode::activey;
+		y < Mode::activey + Mode::activeheight; y++) {
+		for (unsigned int x = Mode::activex;
+			x < Mode::activex + Mode::activewidth; x++) {
+			unsigned int	v = image.pixelbuffer()[y * Mode::width + x];
+			count++;
+			sum += v;
+			min = (v < min) ? v : min;
+			max = (v > max) ? v : max;
+			saturated += (v >= saturation) ? 1 : 0;
+			histogram += (v <= 65535) ? 1 : 0;
+		}
+	}
+	for (unsigned int v = 0; v < s->histogram.size(); v++) {
+		histogram -= s->histogram[v];
+	}
+	double	mean = sum / count;
+	check((s->count == count) && (s->min == min) && (s->max == max)
+		&& (s->saturated == saturated) && (0 == histogram)
+		&& (fabs(s->mean - mean) <= 1e-9 * mean),
+		"%dx%d statistics at level %d: %s", Mode::rows, Mode::words,
+		level, s->toString().c_str());
+}
+
+/**
+ * \brief Check all ways to demultiplex a mode against the reference
+ *
+ * The 16 bit image is converted in random chunks of lines, as the patch
+ * reader does, the 32 bit image must agree with the reference wherever
+ * the reference did not saturate, and the cropped conversion must give
+ * the active area in the order of active_buffer(). The statistics
+ * collected on the way must match the converted pixels.
+ */
+template<typename Mode>
+static void	checkmode(Check& check, referencefunction reference,
+			int best) {
+	unsigned long	length = 2 * Mode::TopSkipPix
+				+ 2UL * Mode::LineSize * Mode::VerticalSize;
+	unsigned long	patches = (length + Mode::patch_size - 1)
+				/ Mode::patch_size;
+	Buffer	raw(patches * Mode::patch_size);
+	for (int trial = 0; trial < 3; trial++) {
+		rawfill(raw, trial);
+		ImageBuffer	expected(Mode::width, Mode::height);
+		memset(expected.pixelbuffer(), 0, expected.size());
+		reference(expected, raw, Mode::TopSkipPix, Mode::width,
+			Mode::height, 0, Mode::VerticalSize);
+		expected.active(demuxmode_activearea<Mode>());
+		ImageBufferPtr	active = expected.active_buffer();
+		for (int level = DEMUX_SCALAR; level <= best; level++) {
+			demux_level(level);
+
+			ImageBuffer	image(Mode::width, Mode::height);
+			memset(image.pixelbuffer(), 0, image.size());
+			PixelStatistics	statistics;
+			unsigned int	line = 0;
+			while (line < Mode::VerticalSize) {
+				unsigned int	next = line + 1 + rand() % 50;
+				demuxmode<Mode, unsigned short>(image, raw,
+					line, next, &statistics);
+				line = next;
+			}
+			check(0 == memcmp(image.pixelbuffer(),
+				expected.pixelbuffer(), image.size()),
+				"%dx%d trial %d level %d differs", Mode::rows,
+				Mode::words, trial, level);
+			checkstatistics<Mode>(check, image, statistics, level);
+
+			ImageBuffer32	wide(Mode::width, Mode::height);
+			memset(wide.pixelbuffer(), 0, wide.size());
+			statistics.reset();
+			demuxmode<Mode, unsigned int>(wide, raw, 0,
+				Mode::VerticalSize, &statistics);
+			unsigned int	i = 0;
+			for (; i < wide.npixels(); i++) {
+				unsigned int	e = expected.pixelbuffer()[i];
+				unsigned int	w = wide.pixelbuffer()[i];
+				if ((e < 65535) ? (w != e) : (w < e)) {
+					break;
+				}
+			}
+			check(i == wide.npixels(),
+				"%dx%d trial %d level %d wide pixel %u differs",
+				Mode::rows, Mode::words, trial, level, i);
+			checkstatistics<Mode>(check, wide, statistics, level);
+
+			ImageBuffer	cropped(Mode::activewidth,
+						Mode::activeheight);
+			line = 0;
+			while (line < Mode::VerticalSize) {
+				unsigned int	next = line + 1 + rand() % 50;
+				demuxmode_cropped<Mode, unsigned short>(cropped,
+					raw, line, next, NULL);
+				line = next;
+			}
+			check(0 == memcmp(cropped.pixelbuffer(),
+				active->pixelbuffer(), cropped.size()),
+				"%dx%d trial %d level %d cropped differs",
+				Mode::rows, Mode::words, trial, level);
+		}
+	}
+}
+
+int	main(int argc, char *argv[]) {
+	Check	check("demuxcheck");
+	int	best = bestlevel();
+	checkmode<Qhy8ProMode11>(check, demux11reference, best);
+	checkmode<Qhy8ProMode22>(check, demux22reference, best);
+	checkmode<Qhy8ProMode44>(check, demux44reference, best);
+	return check.result();
+}
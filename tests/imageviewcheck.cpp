@@ -0,0 +1,157 @@
+/*
+ * imageviewcheck.cpp -- check image views against ap() and active_buffer()
+ *
+ * (c) 2014 Prof Dr Andreas Mueller, Hochschule Rapperswil
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+#include <check.h>
+#include <cstring>
+#include <stdexcept>
+
+using namespace qhy;
+
+/**
+ * \brief Create an image with random pixels and an active area
+ */
+static ImageBufferPtr	testimage() {
+	ImageBufferPtr	image(new ImageBuffer(37, 23));
+	randomfill(*image);
+	image->active(ImageRectangle(ImagePoint(3, 2), ImageSize(29, 17)));
+	FrameMetrics	metrics;
+	metrics.patches = 11;
+	image->metrics(metrics);
+	return image;
+}
+
+/**
+ * \brief The active area view must show the pixels of ap()
+ */
+static void	checkactive(Check& check, ImageBufferPtr image) {
+	ImageView	active = ImageView::active(image);
+	check((active.size() == image->active_size()) && active.flipped(),
+		"active view of %ux%u", active.width(), active.height());
+	unsigned int	wrong = 0;
+	for (unsigned int y = 0; y < active.height(); y++) {
+		for (unsigned int x = 0; x < active.width(); x++) {
+			wrong += (active(x, y) != image->ap(x, y)) ? 1 : 0;
+		}
+	}
+	check(0 == wrong, "%u pixels of the active view differ from ap()",
+		wrong);
+
+	ImageBufferPtr	expected = image->active_buffer();
+	ImageBufferPtr	copy = active.copy();
+	check(0 == memcmp(copy->pixelbuffer(), expected->pixelbuffer(),
+		expected->size()), "copy differs from active_buffer()");
+	check(copy->metrics().patches == 11, "copy lost the metrics");
+
+	ImageBufferPtr	plain(new ImageBuffer(5, 4));
+	ImageView	whole = ImageView::active(plain);
+	check((whole.size() == ImageSize(5, 4)) && whole.contiguous(),
+		"view of an image without active area is not the image");
+}
+
+/**
+ * \brief Nested views, flipped or not, must agree with ap()
+ *
+ * Flipping a view of the flipped active area gives back the orientation
+ * of the image buffer.
+ */
+static void	checknested(Check& check, ImageBufferPtr image) {
+	ImageView	active = ImageView::active(image);
+	ImageRectangle	r(ImagePoint(4, 5), ImageSize(20, 9));
+	ImageRectangle	inner(ImagePoint(1, 2), ImageSize(13, 6));
+	for (int flip = 0; flip < 2; flip++) {
+		ImageView	v = active.view(r, flip);
+		for (int innerflip = 0; innerflip < 2; innerflip++) {
+			ImageView	w = v.view(inner, innerflip);
+			unsigned int	wrong = 0;
+			for (unsigned int y = 0; y < w.height(); y++) {
+				unsigned int	vy = (innerflip)
+					? inner.origin.y() + inner.size.height() - 1 - y
+					: inner.origin.y() + y;
+				unsigned int	ay = (flip)
+					? r.origin.y() + r.size.height() - 1 - vy
+					: r.origin.y() + vy;
+				for (unsigned int x = 0; x < w.width(); x++) {
+					unsigned int	ax = r.origin.x()
+						+ inner.origin.x() + x;
+					wrong += (w(x, y) != image->ap(ax, ay))
+						? 1 : 0;
+				}
+			}
+			check(0 == wrong, "%u pixels of view %d/%d differ",
+				wrong, flip, innerflip);
+			check(w.flipped() == (flip == innerflip),
+				"view %d/%d has the wrong orientation",
+				flip, innerflip);
+			ImageBufferPtr	copy = w.copy();
+			unsigned int	y = 0;
+			for (; y < w.height(); y++) {
+				if (memcmp(copy->pixelbuffer() + y * w.width(),
+					w.rowpointer(y),
+					w.width() * sizeof(unsigned short))) {
+					break;
+				}
+			}
+			check(y == w.height(), "copy of view %d/%d differs "
+				"in row %u", flip, innerflip, y);
+		}
+	}
+}
+
+/**
+ * \brief Rectangles outside the image or view must be rejected
+ */
+static void	checkrange(Check& check, ImageBufferPtr image) {
+	ImageRectangle	bad[] = {
+		ImageRectangle(ImagePoint(-1, 0), ImageSize(5, 5)),
+		ImageRectangle(ImagePoint(0, -1), ImageSize(5, 5)),
+		ImageRectangle(ImagePoint(0, 0), ImageSize(-1, 5)),
+		ImageRectangle(ImagePoint(33, 0), ImageSize(5, 5)),
+		ImageRectangle(ImagePoint(0, 19), ImageSize(5, 5)),
+		ImageRectangle(ImagePoint(0, 0), ImageSize(38, 23)),
+	};
+	for (unsigned int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		bool	thrown = false;
+		try {
+			ImageView(image, bad[i]);
+		} catch (const std::range_error&) {
+			thrown = true;
+		}
+		check(thrown, "rectangle %u outside the image accepted", i);
+	}
+	bool	thrown = false;
+	try {
+		ImageView(image, ImageRectangle(ImagePoint(0, 0),
+			ImageSize(37, 23)), true);
+	} catch (const std::range_error&) {
+		thrown = true;
+	}
+	check(!thrown, "the complete image was rejected");
+
+	ImageView	active = ImageView::active(image);
+	thrown = false;
+	try {
+		active.view(ImageRectangle(ImagePoint(20, 10),
+			ImageSize(10, 5)));
+	} catch (const std::range_error&) {
+		thrown = true;
+	}
+	check(thrown, "rectangle outside the view accepted");
+}
+
+int	main(int argc, char *argv[]) {
+	Check	check("imageviewcheck");
+	try {
+		ImageBufferPtr	image = testimage();
+		checkactive(check, image);
+		checknested(check, image);
+		checkrange(check, image);
+	} catch (const std::exception& x) {
+		check(false, "exception: %s", x.what());
+	}
+	return check.result();
+}